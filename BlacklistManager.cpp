@@ -23,8 +23,7 @@ BlacklistManager::BlacklistManager(const string &storageFile)
 
 // Prüfen, ob eine IP aktuell gesperrt ist
 bool BlacklistManager::isBlacklisted(const string &ip) {
-    lock_guard<mutex> lock(mtx_);
-    cleanupExpired(); // alte Sperren entfernen
+    shared_lock<shared_mutex> lock(mtx_);
     auto it = blacklist_.find(ip);
 
     // Nur gesperrt, wenn Ablaufzeit in der Zukunft liegt
@@ -33,7 +32,7 @@ bool BlacklistManager::isBlacklisted(const string &ip) {
 
 // Fehlversuch protokollieren und ggf. sperren
 bool BlacklistManager::recordFailure(const string &ip, const string &username) {
-    lock_guard<mutex> lock(mtx_);
+    lock_guard<shared_mutex> lock(mtx_);
     cleanupExpired();
 
     // Key kombiniert IP + Username → verhindert Überschneidung
@@ -55,7 +54,7 @@ bool BlacklistManager::recordFailure(const string &ip, const string &username) {
 
 // Erfolgreicher Login → Fehlversuche zurücksetzen
 void BlacklistManager::recordSuccess(const string &ip, const string &username) {
-    lock_guard<mutex> lock(mtx_);
+    lock_guard<shared_mutex> lock(mtx_);
     attempts_.erase(attemptKey(ip, username));
 }
 
@@ -2,6 +2,7 @@
 
 #include <ctime>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -14,7 +15,9 @@ public:
     /// @param storageFile Pfad zur Persistenz-Datei der Blacklist.
     explicit BlacklistManager(const std::string &storageFile);
 
-    /// Prüft, ob die IP aktuell gesperrt ist und entfernt abgelaufene Einträge.
+    /// Prüft, ob die IP aktuell gesperrt ist.
+    /// Nimmt nur eine geteilte Sperre, damit parallele Acceptor-Threads sich nicht blockieren;
+    /// abgelaufene Einträge werden beim nächsten schreibenden Zugriff entfernt.
     /// @param ip Zu prüfende IPv4-Adresse.
     /// @return true, falls die IP gesperrt ist.
     bool isBlacklisted(const std::string &ip);
@@ -34,7 +37,7 @@ private:
     std::string storageFile_;
     std::unordered_map<std::string, std::time_t> blacklist_;
     std::unordered_map<std::string, int> attempts_;
-    std::mutex mtx_;
+    std::shared_mutex mtx_;
 
     void load();
     void persist();
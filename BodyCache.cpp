@@ -0,0 +1,202 @@
+#include "BodyCache.h"
+#include "ServerStats.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace {
+    constexpr size_t ENTRY_OVERHEAD = 160;        // Listenknoten, Map-Knoten, Strings
+    constexpr size_t MAX_BODY = 256 * 1024;       // größere Bodies gehen per sendfile()
+    constexpr size_t WINDOW_PERCENT = 10;         // Anteil des LRU-Fensters am Budget
+    constexpr size_t SKETCH_BYTES_PER_SLOT = 4096; // erwartete Größe einer Nachricht
+    constexpr size_t SKETCH_MIN_WIDTH = 1024;
+    constexpr size_t SKETCH_ROWS = 4;
+    constexpr uint8_t SKETCH_MAX = 15;
+    constexpr uint64_t SKETCH_SEEDS[SKETCH_ROWS] = {
+        0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0x27D4EB2F165667C5ULL};
+
+    size_t roundUpPow2(size_t n) {
+        size_t p = 1;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    size_t messageBytes(const std::string &username, const CachedMessage &msg) {
+        return ENTRY_OVERHEAD + username.size() + msg.sender.size() + msg.subject.size()
+               + msg.body.size();
+    }
+}
+
+using namespace std;
+
+BodyCache::FrequencySketch::FrequencySketch(size_t width)
+    : counters_(SKETCH_ROWS * width, 0), width_(width), sampleSize_(10 * width) {}
+
+size_t BodyCache::FrequencySketch::index(size_t hash, size_t row) const {
+    uint64_t h = static_cast<uint64_t>(hash) * SKETCH_SEEDS[row];
+    h ^= h >> 32;
+    return row * width_ + (static_cast<size_t>(h) & (width_ - 1));
+}
+
+void BodyCache::FrequencySketch::increment(size_t hash) {
+    for (size_t row = 0; row < SKETCH_ROWS; ++row) {
+        uint8_t &counter = counters_[index(hash, row)];
+        if (counter < SKETCH_MAX) {
+            ++counter;
+        }
+    }
+    // Altern: nach sampleSize_ Zugriffen alle Zähler halbieren
+    if (++additions_ >= sampleSize_) {
+        for (uint8_t &counter : counters_) {
+            counter >>= 1;
+        }
+        additions_ /= 2;
+    }
+}
+
+unsigned BodyCache::FrequencySketch::estimate(size_t hash) const {
+    unsigned value = SKETCH_MAX;
+    for (size_t row = 0; row < SKETCH_ROWS; ++row) {
+        value = min<unsigned>(value, counters_[index(hash, row)]);
+    }
+    return value;
+}
+
+size_t BodyCache::KeyHash::operator()(const Key &key) const {
+    return hash<string>{}(key.username) ^ (static_cast<size_t>(key.id) * 0x9E3779B97F4A7C15ULL);
+}
+
+BodyCache::BodyCache(size_t budget, ServerStats &stats)
+    : budget_(budget), stats_(stats) {
+    size_t shardBudget = budget / SHARDS;
+    windowBudget_ = shardBudget * WINDOW_PERCENT / 100;
+    mainBudget_ = shardBudget - windowBudget_;
+    if (!enabled()) {
+        return;
+    }
+    size_t width = roundUpPow2(max(SKETCH_MIN_WIDTH, shardBudget / SKETCH_BYTES_PER_SLOT));
+    for (size_t i = 0; i < SHARDS; ++i) {
+        shards_.push_back(make_unique<Shard>(width));
+    }
+}
+
+bool BodyCache::fits(size_t bodySize) const {
+    return enabled() && bodySize <= MAX_BODY && ENTRY_OVERHEAD + bodySize <= mainBudget_;
+}
+
+bool BodyCache::suspended() const {
+    int64_t until = suspendedUntil_.load(memory_order_relaxed);
+    return until != 0 && chrono::steady_clock::now().time_since_epoch().count() < until;
+}
+
+void BodyCache::suspend(chrono::steady_clock::time_point until) {
+    suspendedUntil_.store(until.time_since_epoch().count(), memory_order_relaxed);
+    for (auto &shard : shards_) {
+        lock_guard<mutex> lock(shard->mtx);
+        while (!shard->window.empty()) {
+            remove(*shard, shard->window.begin());
+        }
+        while (!shard->main.empty()) {
+            remove(*shard, shard->main.begin());
+        }
+    }
+}
+
+BodyCache::Shard &BodyCache::shardFor(size_t hash) {
+    return *shards_[(hash >> 8) % SHARDS]; // untere Bits verteilen schon den Sketch
+}
+
+shared_ptr<const CachedMessage> BodyCache::find(const string &username, int id) {
+    if (!enabled()) {
+        return nullptr;
+    }
+    Key key{username, id};
+    size_t hash = KeyHash{}(key);
+    Shard &shard = shardFor(hash);
+    lock_guard<mutex> lock(shard.mtx);
+    shard.sketch.increment(hash);
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        ++stats_.bodyMisses;
+        return nullptr;
+    }
+    ++stats_.bodyHits;
+    list<Entry> &region = it->second->main ? shard.main : shard.window;
+    region.splice(region.begin(), region, it->second);
+    return it->second->message;
+}
+
+void BodyCache::insert(const string &username, int id, shared_ptr<const CachedMessage> message) {
+    if (!enabled() || !message || !fits(message->body.size())) {
+        return;
+    }
+    Entry entry;
+    entry.key = Key{username, id};
+    entry.hash = KeyHash{}(entry.key);
+    entry.bytes = messageBytes(username, *message);
+    entry.message = move(message);
+    if (entry.bytes > mainBudget_) {
+        return;
+    }
+
+    Shard &shard = shardFor(entry.hash);
+    lock_guard<mutex> lock(shard.mtx);
+    auto old = shard.entries.find(entry.key);
+    if (old != shard.entries.end()) {
+        remove(shard, old->second);
+    }
+    shard.windowBytes += entry.bytes;
+    stats_.bodyBytes += entry.bytes;
+    Key key = entry.key;
+    shard.window.push_front(move(entry));
+    shard.entries.emplace(move(key), shard.window.begin());
+    admit(shard);
+}
+
+// Aus dem Fenster fallende Nachrichten gegen den LRU-Kandidaten des Hauptbereichs
+// antreten lassen: nur wer häufiger gelesen wurde, verdrängt ihn
+void BodyCache::admit(Shard &shard) {
+    while (shard.windowBytes > windowBudget_ && !shard.window.empty()) {
+        auto candidate = prev(shard.window.end());
+        unsigned frequency = shard.sketch.estimate(candidate->hash);
+        while (shard.mainBytes + candidate->bytes > mainBudget_ && !shard.main.empty()
+               && frequency > shard.sketch.estimate(shard.main.back().hash)) {
+            remove(shard, prev(shard.main.end()));
+            ++stats_.bodyEvictions;
+        }
+        if (shard.mainBytes + candidate->bytes > mainBudget_) {
+            remove(shard, candidate);
+            ++stats_.bodyRejected;
+            continue;
+        }
+        shard.windowBytes -= candidate->bytes;
+        shard.mainBytes += candidate->bytes;
+        candidate->main = true;
+        shard.main.splice(shard.main.begin(), shard.window, candidate);
+    }
+}
+
+void BodyCache::erase(const string &username, const vector<int> &ids) {
+    if (!enabled()) {
+        return;
+    }
+    for (int id : ids) {
+        Key key{username, id};
+        size_t hash = KeyHash{}(key);
+        Shard &shard = shardFor(hash);
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            remove(shard, it->second);
+        }
+    }
+}
+
+void BodyCache::remove(Shard &shard, list<Entry>::iterator it) {
+    (it->main ? shard.mainBytes : shard.windowBytes) -= it->bytes;
+    stats_.bodyBytes -= it->bytes;
+    shard.entries.erase(it->key);
+    (it->main ? shard.main : shard.window).erase(it);
+}
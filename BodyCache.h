@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ServerStats;
+
+/// Vollständig gelesene Nachricht im BodyCache (Empfänger ist der Postfachinhaber).
+struct CachedMessage {
+    std::string sender;
+    std::string subject;
+    std::string body;
+};
+
+/// Prozessweiter Cache ganzer Nachrichten für wiederholte READs, Schlüssel (Benutzer,
+/// Nummer). Aufgeteilt in Shards mit eigener Sperre, damit parallele READs verschiedener
+/// Nachrichten sich nicht gegenseitig aufhalten.
+/// Verdrängt wird nach W-TinyLFU: neue Nachrichten kommen in ein kleines LRU-Fenster;
+/// wer daraus herausfällt, darf nur dann in den Hauptbereich, wenn er laut einem
+/// Häufigkeits-Sketch öfter gelesen wurde als der LRU-Kandidat dort. Ein einmaliger
+/// Durchlauf über viele Nachrichten (z.B. ein Export) verdrängt so nicht die heißen.
+/// Nachrichten ändern sich nach dem Speichern nicht und Nummern werden nicht
+/// wiederverwendet; ungültig wird ein Eintrag nur durch erase() beim Löschen. Ein DEL
+/// in einem anderen Prozess sieht der Cache nicht, daher suspend() während einer
+/// Übergabe per SIGUSR2.
+class BodyCache {
+public:
+    /// @param budget Speicherbudget in Bytes über alle Shards (0 = Cache aus).
+    /// @param stats Zähler für Treffer, Fehlschläge, Ablehnungen, Verdrängungen und Größe.
+    BodyCache(size_t budget, ServerStats &stats);
+
+    /// @return true, wenn der Cache ein Budget hat und nicht ausgesetzt ist.
+    bool enabled() const { return budget_ > 0 && !suspended(); }
+
+    /// Leert den Cache und setzt ihn bis until aus (keine Treffer, keine Aufnahme).
+    /// @param until Ende der Pause; time_point::max() = für immer.
+    void suspend(std::chrono::steady_clock::time_point until);
+
+    /// @return true, wenn ein Body dieser Größe überhaupt aufgenommen würde.
+    bool fits(size_t bodySize) const;
+
+    /// Sucht eine Nachricht und zählt den Zugriff im Häufigkeits-Sketch mit.
+    /// @return Nachricht oder nullptr; bleibt auch nach Verdrängung gültig.
+    std::shared_ptr<const CachedMessage> find(const std::string &username, int id);
+
+    /// Nimmt eine Nachricht ins LRU-Fenster auf (ersetzt einen vorhandenen Eintrag).
+    void insert(const std::string &username, int id, std::shared_ptr<const CachedMessage> message);
+
+    /// Entfernt gelöschte Nachrichten.
+    void erase(const std::string &username, const std::vector<int> &ids);
+
+private:
+    static constexpr size_t SHARDS = 16;
+
+    struct Key {
+        std::string username;
+        int id = 0;
+        bool operator==(const Key &other) const {
+            return id == other.id && username == other.username;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const;
+    };
+
+    struct Entry {
+        Key key;
+        size_t hash = 0;
+        std::shared_ptr<const CachedMessage> message;
+        size_t bytes = 0;
+        bool main = false; // im Hauptbereich statt im Fenster
+    };
+
+    /// Count-Min-Sketch mit Zählern bis 15 (4 Zeilen); alle Zähler werden halbiert,
+    /// sobald genug Zugriffe gezählt sind, damit alte Häufigkeiten verblassen.
+    class FrequencySketch {
+    public:
+        explicit FrequencySketch(size_t width);
+        void increment(size_t hash);
+        unsigned estimate(size_t hash) const;
+
+    private:
+        std::vector<uint8_t> counters_; // 4 Zeilen × width_, je ein Zähler pro Byte
+        size_t width_;
+        size_t additions_ = 0;
+        size_t sampleSize_;
+
+        size_t index(size_t hash, size_t row) const;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::list<Entry> window; // vorne = zuletzt benutzt
+        std::list<Entry> main;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries;
+        size_t windowBytes = 0;
+        size_t mainBytes = 0;
+        FrequencySketch sketch;
+
+        explicit Shard(size_t width) : sketch(width) {}
+    };
+
+    size_t budget_;
+    std::atomic<int64_t> suspendedUntil_{0}; // steady_clock-Ticks, 0 = nicht ausgesetzt
+    size_t windowBudget_; // je Shard
+    size_t mainBudget_;   // je Shard
+    ServerStats &stats_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    bool suspended() const;
+    Shard &shardFor(size_t hash);
+    void remove(Shard &shard, std::list<Entry>::iterator it);
+    void admit(Shard &shard);
+};
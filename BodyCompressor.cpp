@@ -0,0 +1,118 @@
+#include "BodyCompressor.h"
+
+#include <zlib.h>
+
+namespace {
+    constexpr size_t INFLATE_CHUNK = 16384;  // erster Ausgabepuffer, wächst bei Bedarf
+
+    // Voreingestelltes Wörterbuch: deflate findet Wiederholungen auch darin. Häufige
+    // Wendungen stehen am Ende (kürzere Distanzen). Nie ändern, siehe BodyCompressor
+    constexpr char DICTIONARY[] =
+        "Please find attached the document. Let me know if you have any questions. "
+        "Thank you for your message. I will get back to you as soon as possible. "
+        "Could you please send me the latest version? The meeting has been moved to "
+        "tomorrow morning. See you on Monday, Tuesday, Wednesday, Thursday, Friday. "
+        "Best regards, Kind regards, Thanks, Cheers, Hi all, Hello, Dear "
+        "Im Anhang findest du die Unterlagen. Bei Fragen melde dich gerne. "
+        "Vielen Dank für deine Nachricht. Ich melde mich so bald wie möglich. "
+        "Kannst du mir bitte die aktuelle Version schicken? Das Treffen wurde auf "
+        "morgen verschoben. Bis Montag, Dienstag, Mittwoch, Donnerstag, Freitag. "
+        "Die Abgabe für die Übung ist am Ende der Woche, die Prüfung im Hörsaal. "
+        "Mit freundlichen Grüßen, Liebe Grüße, Viele Grüße, Danke, Hallo zusammen, "
+        "Sehr geehrte Damen und Herren, Hallo, Hi, Liebe, Lieber\n\n"
+        "der die das und ist nicht mit von für auf ein eine zu im dem den sich auch "
+        "the and for that this with you are have not will from your can be on in of to is\n";
+    constexpr size_t DICTIONARY_SIZE = sizeof(DICTIONARY) - 1;
+
+    // zlib-Ströme eines Threads; werden pro Body zurückgesetzt statt neu angelegt
+    struct Streams {
+        z_stream deflater{};
+        z_stream inflater{};
+        bool deflateReady = false;
+        bool inflateReady = false;
+
+        Streams() {
+            deflateReady = deflateInit(&deflater, Z_DEFAULT_COMPRESSION) == Z_OK;
+            inflateReady = inflateInit(&inflater) == Z_OK;
+        }
+        ~Streams() {
+            if (deflateReady) {
+                deflateEnd(&deflater);
+            }
+            if (inflateReady) {
+                inflateEnd(&inflater);
+            }
+        }
+    };
+
+    Streams &streams() {
+        thread_local Streams s;
+        return s;
+    }
+
+    Bytef *bytes(std::string_view data) {
+        return reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    }
+}
+
+using namespace std;
+
+bool BodyCompressor::compress(string_view body, string &out) {
+    if (body.size() < MIN_SIZE || body.size() > MAX_SIZE) {
+        return false;
+    }
+    Streams &s = streams();
+    if (!s.deflateReady || deflateReset(&s.deflater) != Z_OK ||
+        deflateSetDictionary(&s.deflater, bytes(DICTIONARY), DICTIONARY_SIZE) != Z_OK) {
+        return false;
+    }
+    out.resize(deflateBound(&s.deflater, body.size()));
+    s.deflater.next_in = bytes(body);
+    s.deflater.avail_in = static_cast<uInt>(body.size());
+    s.deflater.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    s.deflater.avail_out = static_cast<uInt>(out.size());
+    if (deflate(&s.deflater, Z_FINISH) != Z_STREAM_END) {
+        return false;
+    }
+    out.resize(out.size() - s.deflater.avail_out);
+    // Lohnt sich erst ab einem Achtel Ersparnis (READ muss dafür entpacken)
+    return out.size() <= body.size() - body.size() / 8;
+}
+
+bool BodyCompressor::decompress(string_view packed, string &out) {
+    Streams &s = streams();
+    if (!s.inflateReady || inflateReset(&s.inflater) != Z_OK) {
+        return false;
+    }
+    out.resize(INFLATE_CHUNK);
+    size_t produced = 0;
+    s.inflater.next_in = bytes(packed);
+    s.inflater.avail_in = static_cast<uInt>(packed.size());
+    while (true) {
+        if (produced == out.size()) {
+            if (out.size() >= MAX_SIZE) {
+                return false; // so große Bodies werden nie komprimiert gespeichert
+            }
+            out.resize(min(out.size() * 2, MAX_SIZE));
+        }
+        s.inflater.next_out = reinterpret_cast<Bytef *>(&out[produced]);
+        s.inflater.avail_out = static_cast<uInt>(out.size() - produced);
+        int ret = inflate(&s.inflater, Z_NO_FLUSH);
+        produced = out.size() - s.inflater.avail_out;
+        if (ret == Z_NEED_DICT) {
+            // Prüft die Kennung im Kopf: ein fremdes Wörterbuch wird abgelehnt
+            if (inflateSetDictionary(&s.inflater, bytes(DICTIONARY), DICTIONARY_SIZE) != Z_OK) {
+                return false;
+            }
+            continue;
+        }
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+        if (ret != Z_OK && !(ret == Z_BUF_ERROR && s.inflater.avail_out == 0)) {
+            return false; // defekt oder abgeschnitten
+        }
+    }
+    out.resize(produced);
+    return true;
+}
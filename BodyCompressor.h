@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/// Kompression der Nachrichten-Bodies im Spool (Option -Z). zlib-Format (deflate mit
+/// Prüfsumme) mit einem fest eingebauten Wörterbuch häufiger Mail-Floskeln, damit auch
+/// kurze Bodies etwas sparen. Die Kennung des Wörterbuchs steht im zlib-Kopf; ein
+/// geändertes Wörterbuch fällt beim Entpacken auf, statt falsche Bytes zu liefern.
+/// Es darf deshalb nie verändert, nur durch ein neues mit eigener Kennung ersetzt werden.
+/// Thread-sicher: jeder Thread benutzt eigene zlib-Ströme.
+class BodyCompressor {
+public:
+    static constexpr size_t MIN_SIZE = 128;               ///< kleinere Bodies bleiben roh
+    static constexpr size_t MAX_SIZE = size_t{1} << 20;   ///< größere bleiben roh (sendfile)
+
+    /// Komprimiert einen Body, wenn es sich lohnt.
+    /// @param body Klartext.
+    /// @param out Ausgabe: komprimierter Body (nur bei true gültig).
+    /// @return false, wenn der Body zu klein oder zu groß ist, kaum kleiner würde oder
+    ///         zlib scheitert; er wird dann roh gespeichert.
+    static bool compress(std::string_view body, std::string &out);
+
+    /// Entpackt einen mit compress() erzeugten Body.
+    /// @param packed Komprimierte Bytes.
+    /// @param out Ausgabe: Klartext.
+    /// @return false bei defekten Daten, fremdem Wörterbuch oder mehr als MAX_SIZE Bytes.
+    static bool decompress(std::string_view packed, std::string &out);
+};
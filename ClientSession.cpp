@@ -3,19 +3,137 @@
 #include "BlacklistManager.h"
 #include "LdapAuthenticator.h"
 #include "MailStore.h"
+#include "ServerStats.h"
+#include "WireCompressor.h"
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <charconv>
+#include <cstdint>
 #include <cstdlib>
 #include <cerrno>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <vector>
 
 namespace {
-    constexpr size_t MAX_SUBJECT = 80; // maximale Betrefflänge
+    constexpr size_t MAX_SUBJECT = 80;       // maximale Betrefflänge
+    constexpr size_t COALESCE_LIMIT = 4096;  // kleine Antworten werden zusammenkopiert
+    constexpr size_t MAX_IOV = 64;           // Segmente pro sendmsg()
+    constexpr size_t FILE_CHUNK = 65536;     // Stückgröße, wenn ein Dateisegment gelesen werden muss
+    constexpr size_t FIELD_HEADER = 4;       // Längenpräfix im Binärmodus (Big Endian)
+    constexpr size_t MAX_BATCH_READ = 256;   // MREAD: Nachrichten pro Batch (je ein offener fd)
+    constexpr size_t MAX_BATCH_DELETE = 65536; // MDEL: Nummern pro Batch
+    constexpr size_t MAX_RECIPIENTS = 64;    // SEND: Empfänger pro Nachricht
+    constexpr size_t MAX_SEND_LINES = 4;     // SEND: Kommando, Empfänger, Betreff, Terminator
+    constexpr size_t MAX_LIST_PAGE = 1000;   // LIST <offset> <limit> / LIST SINCE: Einträge pro Seite
+    constexpr size_t MAX_WAIT = 900;         // WAIT: maximale Wartezeit in Sekunden
+
+    // Längenpräfix eines Binärfelds anhängen
+    void appendLength(std::string &out, size_t len) {
+        char header[FIELD_HEADER] = {static_cast<char>(len >> 24), static_cast<char>(len >> 16),
+                                     static_cast<char>(len >> 8), static_cast<char>(len)};
+        out.append(header, FIELD_HEADER);
+    }
+
+    // Nicht-negative Zahl ohne weitere Zeichen lesen
+    bool parseCount(std::string_view text, size_t &value) {
+        auto r = std::from_chars(text.data(), text.data() + text.size(), value);
+        return !text.empty() && r.ec == std::errc() && r.ptr == text.data() + text.size();
+    }
+
+    // Nummernliste wie "3,5,9-20" in aufsteigende, eindeutige Nummern umwandeln
+    // @return false bei Syntaxfehler, Nummer <= 0 oder mehr als maxCount Nummern
+    bool parseNumberList(std::string_view spec, size_t maxCount, std::vector<int> &ids) {
+        ids.clear();
+        while (!spec.empty()) {
+            size_t comma = spec.find(',');
+            std::string_view item = spec.substr(0, comma);
+            spec.remove_prefix(comma == std::string_view::npos ? spec.size() : comma + 1);
+            if (item.empty()) {
+                continue;
+            }
+
+            size_t dash = item.find('-');
+            std::string_view fromText = item.substr(0, dash);
+            std::string_view toText = dash == std::string_view::npos ? fromText : item.substr(dash + 1);
+            int from = 0;
+            int to = 0;
+            auto r1 = std::from_chars(fromText.data(), fromText.data() + fromText.size(), from);
+            auto r2 = std::from_chars(toText.data(), toText.data() + toText.size(), to);
+            if (r1.ec != std::errc() || r1.ptr != fromText.data() + fromText.size() ||
+                r2.ec != std::errc() || r2.ptr != toText.data() + toText.size() ||
+                from <= 0 || to < from) {
+                return false;
+            }
+            if (static_cast<size_t>(to - from) >= maxCount - std::min(ids.size(), maxCount)) {
+                return false; // Bereich sprengt das Batch-Limit
+            }
+            // 64-Bit-Zähler: bei to == INT_MAX liefe ++id über
+            for (int64_t id = from; id <= to; ++id) {
+                ids.push_back(static_cast<int>(id));
+            }
+        }
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        return !ids.empty();
+    }
+
+    // Beginnt im Text eine Zeile mit "."? Dann braucht READ im Textmodus Punkt-Stuffing
+    // @param lineStart true, wenn text selbst am Zeilenanfang beginnt
+    bool needsStuffing(std::string_view text, bool lineStart) {
+        return (lineStart && !text.empty() && text[0] == '.') ||
+               text.find("\n.") != std::string_view::npos;
+    }
+
+    // Text mit Punkt-Stuffing anhängen: jede Zeile, die mit "." beginnt, bekommt einen
+    // zweiten Punkt, damit ein Text-Client sie nicht für das Body-Ende hält
+    // @param lineStart true, wenn text selbst am Zeilenanfang beginnt
+    void appendStuffed(std::string &out, std::string_view text, bool lineStart) {
+        if (lineStart && !text.empty() && text[0] == '.') {
+            out += '.';
+        }
+        size_t pos = 0;
+        for (size_t nl = text.find("\n."); nl != std::string_view::npos;
+             nl = text.find("\n.", nl + 1)) {
+            out.append(text.substr(pos, nl + 1 - pos));
+            out += '.';
+            pos = nl + 1;
+        }
+        out.append(text.substr(pos));
+    }
+
+    // Empfängerliste wie "alice,bob" zerlegen; doppelte Namen zählen einmal, die
+    // Reihenfolge bleibt. Die Namen selbst prüft der MailStore
+    // @return false bei leerer Liste, leerem Namen oder mehr als maxCount Empfängern
+    bool parseRecipients(std::string_view spec, size_t maxCount,
+                         std::vector<std::string> &receivers) {
+        receivers.clear();
+        while (true) {
+            size_t comma = spec.find(',');
+            std::string_view name = spec.substr(0, comma);
+            if (name.empty()) {
+                return false; // "a,,b", "a," oder ",a": vermutlich ein vergessener Name
+            }
+            if (std::find(receivers.begin(), receivers.end(), name) == receivers.end()) {
+                if (receivers.size() == maxCount) {
+                    return false;
+                }
+                receivers.emplace_back(name);
+            }
+            if (comma == std::string_view::npos) {
+                return true;
+            }
+            spec.remove_prefix(comma + 1);
+        }
+    }
 }
 
 using namespace std;
@@ -24,69 +142,690 @@ ClientSession::ClientSession(int socketFD,
                              string clientIp,
                              MailStore &store,
                              BlacklistManager &blacklist,
-                             LdapAuthenticator &authenticator)
+                             LdapAuthenticator &authenticator,
+                             const SessionLimits &limits,
+                             ServerStats &stats,
+                             DiskStage *disk)
     : sockfd_(socketFD),
       clientIp_(move(clientIp)),
       store_(store),
       blacklist_(blacklist),
-      authenticator_(authenticator) {}
+      authenticator_(authenticator),
+      limits_(limits),
+      stats_(stats),
+      disk_(disk),
+      phaseStart_(Clock::now()),
+      framer_(limits.maxLine > 0 ? limits.maxLine : LineFramer::DEFAULT_MAX_LINE) {}
+
+ClientSession::~ClientSession() {
+    if (waiting_) {
+        store_.removeWaiter(username_, waitToken_);
+    }
+    if (storing_) {
+        lock_guard<mutex> lock(storing_->mtx); // danach ruft der Disk-Worker wake nicht mehr
+        storing_->wake = nullptr;
+    }
+    if (notifyFd_ >= 0) {
+        close(notifyFd_);
+    }
+    dropOutput();
+}
 
-// Schickt eine beliebige Menge an Bytes über den Socket
-bool ClientSession::sendAll(const string &data) const {
-    const char *buf = data.c_str();
-    size_t total = 0;
-    size_t len = data.size();
+// Antwort an die Ausgabe-Queue hängen; gesendet wird gesammelt, nachdem alle
+// vorliegenden (ggf. gepipelinten) Kommandos abgearbeitet sind
+void ClientSession::reply(string data) {
+    // Nach COMPRESS: Antwort als Frame(s), größere über den deflate-Strom der Session.
+    // Steht noch ein unkodiertes Segment (Datei) davor, wird erst dort vorne kodiert,
+    // damit der Strom die Reihenfolge der Antworten behält
+    if (compressor_ && deferred_ > 0) {
+        OutSegment seg;
+        seg.data = move(data);
+        seg.deferred = true;
+        ++deferred_;
+        outQueue_.push_back(move(seg));
+        return;
+    }
+    if (compressor_) {
+        data = encodeOutput(data);
+    }
+
+    // Kleine Antworten in das letzte Segment kopieren, große als eigenes Segment übernehmen;
+    // nicht in eines, das ein laufender Sendeauftrag gerade liest
+    if (!outputPinned_ && !outQueue_.empty() && outQueue_.back().fd < 0 &&
+        !outQueue_.back().shared &&
+        data.size() < COALESCE_LIMIT &&
+        outQueue_.back().data.size() + data.size() <= COALESCE_LIMIT) {
+        outQueue_.back().data += data;
+        return;
+    }
+    OutSegment seg;
+    seg.data = move(data);
+    outQueue_.push_back(move(seg));
+}
+
+// Ein Antwortfeld im aktuellen Protokollmodus kodieren:
+// Text → Zeile mit \n, binär → 4-Byte-Länge (Big Endian) + Bytes
+void ClientSession::encodeField(string &out, string_view field) const {
+    encodeField(out, field, binary_);
+}
 
-    // Solange weiterschicken, bis alles raus ist
-    while (total < len) {
-        ssize_t n = send(sockfd_, buf + total, len - total, 0);
+// Wie oben, aber ohne Session (Aufträge der Disk-Stufe kodieren ihre Antwort selbst)
+void ClientSession::encodeField(string &out, string_view field, bool binary) {
+    if (binary) {
+        appendLength(out, field.size());
+        out.append(field);
+    } else {
+        out.append(field);
+        out += '\n';
+    }
+}
+
+void ClientSession::replyField(string_view field) {
+    string out;
+    encodeField(out, field);
+    reply(move(out));
+}
+
+// Dateiausschnitt an die Ausgabe-Queue hängen; die Session übernimmt den fd.
+// Komprimiert muss der Inhalt durch den deflate-Strom, mit stuff braucht er Punkt-Stuffing:
+// statt sendfile() liest encodeFront() ihn dann Stück für Stück, sobald er vorne steht
+void ClientSession::replyFile(int fd, off_t offset, size_t length, bool stuff) {
+    if (length == 0) {
+        close(fd);
+        return;
+    }
+    OutSegment seg;
+    seg.fd = fd;
+    seg.offset = offset;
+    seg.length = length;
+    seg.stuff = stuff;
+    if (compressor_ || stuff) {
+        seg.deferred = true;
+        ++deferred_;
+    }
+    outQueue_.push_back(move(seg));
+}
+
+// Klartext durch den deflate-Strom der Session schicken
+string ClientSession::encodeOutput(string_view plain) {
+    string framed;
+    compressor_->encode(plain, framed);
+    stats_.compressPlain += plain.size();
+    stats_.compressWire += framed.size();
+    return framed;
+}
+
+// Zurückgestellte Segmente kodieren, sobald sie vorne stehen (nach COMPRESS bzw. Body
+// mit Punkt-Stuffing). Ein Dateisegment gibt dabei je ein Stück ab; gepuffert ist so nie
+// mehr als FILE_CHUNK Klartext eines Bodys. Läuft nur, wenn kein Segment gerade gesendet wird
+// @return false, wenn die Datei unlesbar ist (Ausgabe verworfen, Session endet)
+bool ClientSession::encodeFront() {
+    if (outQueue_.empty() || !outQueue_.front().deferred) {
+        return true;
+    }
+    OutSegment &front = outQueue_.front();
+    if (front.fd < 0) {
+        front.data = encodeOutput(front.data);
+        front.deferred = false;
+        --deferred_;
+        return true;
+    }
+    string chunk(min(FILE_CHUNK, front.length), '\0');
+    ssize_t n = pread(front.fd, chunk.data(), chunk.size(), front.offset);
+    if (n <= 0) {
+        dropOutput(); // Datei unlesbar → Antwort unvollständig, Verbindung beenden
+        quit_ = true;
+        return false;
+    }
+    chunk.resize(static_cast<size_t>(n));
+    if (front.stuff) {
+        string stuffed;
+        appendStuffed(stuffed, chunk, front.lineStart);
+        front.lineStart = chunk.back() == '\n';
+        chunk.swap(stuffed);
+    }
+    front.offset += n;
+    front.length -= static_cast<size_t>(n);
+    if (front.length == 0) {
+        close(front.fd);
+        outQueue_.pop_front();
+        --deferred_;
+    }
+    OutSegment seg;
+    seg.data = compressor_ ? encodeOutput(chunk) : move(chunk);
+    outQueue_.push_front(move(seg));
+    return true;
+}
+
+// Body einer geöffneten Nachricht ausgeben: aus der Datei oder aus dem BodyCache.
+// Im Textmodus mit Punkt-Stuffing (der Client entfernt den zusätzlichen Punkt wieder),
+// im Binärmodus byte-genau
+void ClientSession::replyBody(const MessageBody &body) {
+    if (!body.data) {
+        replyFile(body.fd, body.offset, body.length, !binary_);
+        return;
+    }
+    if (!binary_ && needsStuffing(*body.data, true)) {
+        string stuffed;
+        appendStuffed(stuffed, *body.data, true);
+        reply(move(stuffed));
+        return;
+    }
+    if (compressor_) {
+        reply(*body.data);
+        return;
+    }
+    if (body.data->empty()) {
+        return;
+    }
+    OutSegment seg;
+    seg.shared = body.data;
+    outQueue_.push_back(move(seg));
+}
+
+// Verwirft alle ausstehenden Antworten und schließt offene Dateien
+void ClientSession::dropOutput() {
+    for (const OutSegment &seg : outQueue_) {
+        if (seg.fd >= 0) {
+            close(seg.fd);
+        }
+    }
+    outQueue_.clear();
+    outOffset_ = 0;
+    deferred_ = 0;
+}
+
+bool ClientSession::hasPendingOutput() const {
+    return !outQueue_.empty();
+}
+
+size_t ClientSession::outputIov(struct iovec *iov, size_t maxIov) {
+    if (!encodeFront()) {
+        return 0;
+    }
+    outputPinned_ = true;
+    size_t count = 0;
+    for (const OutSegment &seg : outQueue_) {
+        if (count == maxIov || seg.deferred) {
+            break;
+        }
+        size_t skip = count == 0 ? outOffset_ : 0;
+        if (seg.fd >= 0) {
+            if (count > 0) {
+                break; // Datei erst, wenn sie vorne steht
+            }
+            // Ohne sendfile-Opcode im Ring: ein Stück der Datei in den Puffer lesen
+            fileChunk_.resize(min(FILE_CHUNK, seg.length - skip));
+            ssize_t n = pread(seg.fd, fileChunk_.data(), fileChunk_.size(),
+                              seg.offset + static_cast<off_t>(skip));
+            if (n <= 0) {
+                dropOutput(); // Datei unlesbar → Antwort unvollständig, Verbindung beenden
+                quit_ = true;
+                return 0;
+            }
+            iov[0].iov_base = fileChunk_.data();
+            iov[0].iov_len = static_cast<size_t>(n);
+            return 1;
+        }
+        const string &bytes = seg.bytes();
+        iov[count].iov_base = const_cast<char *>(bytes.data() + skip);
+        iov[count].iov_len = bytes.size() - skip;
+        ++count;
+    }
+    return count;
+}
+
+void ClientSession::outputSent(size_t len) {
+    outputPinned_ = false;
+    while (len > 0 && !outQueue_.empty()) {
+        OutSegment &front = outQueue_.front();
+        size_t rest = front.size() - outOffset_;
+        if (len < rest) {
+            outOffset_ += len;
+            return;
+        }
+        len -= rest;
+        if (front.fd >= 0) {
+            close(front.fd);
+        }
+        outQueue_.pop_front();
+        outOffset_ = 0;
+    }
+    if (outQueue_.empty()) {
+        updatePhase(false); // Antwort komplett → Kommando erledigt
+    }
+}
+
+bool ClientSession::finished() const {
+    return quit_ && !hasPendingOutput();
+}
+
+// Sendet die Queue mit sendmsg() (ein Syscall für mehrere Antworten);
+// Dateisegmente gehen per sendfile() direkt aus dem Page-Cache in den Socket
+// @return 1 = alles gesendet, 0 = Socket voll (nur mit MSG_DONTWAIT), -1 = Fehler
+int ClientSession::writeOutput(int flags) {
+    iovec iov[MAX_IOV];
+    while (hasPendingOutput()) {
+        if (!encodeFront()) {
+            return -1;
+        }
+        ssize_t n;
+        const OutSegment &front = outQueue_.front();
+        if (front.fd >= 0) {
+            // Im Reaktor-Modus ist der Socket selbst nicht-blockierend
+            off_t off = front.offset + static_cast<off_t>(outOffset_);
+            n = sendfile(sockfd_, front.fd, &off, front.length - outOffset_);
+        } else {
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = outputIov(iov, MAX_IOV);
+            n = sendmsg(sockfd_, &msg, flags | MSG_NOSIGNAL);
+            outputPinned_ = false; // synchron: der Kernel hat die Daten schon übernommen
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
         if (n <= 0) {
-            return false;
+            return -1;
+        }
+        outputSent(static_cast<size_t>(n));
+    }
+    return 1;
+}
+
+// Schickt die komplette Ausgabe-Queue über den (blockierenden) Socket
+bool ClientSession::flushBlocking() {
+    return writeOutput(0) == 1;
+}
+
+// Schickt so viel wie möglich, ohne zu blockieren (Reaktor-Modus);
+// der Rest folgt, sobald der Socket wieder schreibbar ist
+bool ClientSession::flushNonBlocking() {
+    return writeOutput(MSG_DONTWAIT) >= 0;
+}
+
+ClientSession::Clock::time_point ClientSession::deadline() const {
+    if (waiting_) {
+        return waitUntil_; // WAIT ersetzt Leerlauf- und Kommando-Frist
+    }
+    int timeout = busy_ ? limits_.commandTimeout : limits_.idleTimeout;
+    if (timeout <= 0) {
+        return Clock::time_point::max();
+    }
+    return phaseStart_ + chrono::seconds(timeout);
+}
+
+bool ClientSession::expire() {
+    if (waiting_) {
+        finishWait(); // WAIT ohne neue Post: leere Antwort, Session läuft weiter
+        return true;
+    }
+    ++(busy_ ? stats_.commandTimeouts : stats_.idleTimeouts);
+    pending_ = Command::None;
+    args_.clear();
+    body_.clear();
+    quit_ = true;
+
+    // Eigenes Segment statt reply(): nichts an einem evtl. gerade gesendeten Segment ändern
+    string err;
+    encodeField(err, "ERR");
+    OutSegment seg;
+    if (compressor_ && deferred_ > 0) {
+        seg.data = move(err); // hinter noch unkodierten Segmenten, siehe reply()
+        seg.deferred = true;
+        ++deferred_;
+    } else if (compressor_) {
+        seg.data = encodeOutput(err);
+    } else {
+        seg.data = move(err);
+    }
+    outQueue_.push_back(move(seg));
+    return false;
+}
+
+// Leerlauf- bzw. Kommandophase neu bestimmen. Die Kommando-Frist läuft ab dem ersten
+// Byte eines Kommandos bis seine Antwort gesendet ist; jedes fertige Kommando startet
+// sie neu, damit auch lange Pipelines nur pro Kommando begrenzt sind
+void ClientSession::updatePhase(bool commandDone) {
+    bool busy = pending_ != Command::None || fieldPending_ || framer_.buffered() > 0 ||
+                hasPendingOutput() || storing_;
+    if (busy != busy_ || commandDone) {
+        busy_ = busy;
+        phaseStart_ = Clock::now();
+    }
+}
+
+// Nach COMPRESS: Frames in beide Richtungen. Die Bestätigung geht noch unkomprimiert
+// raus; bereits gepufferte Bytes hinter dem Kommando sind schon Frames
+void ClientSession::enableCompression() {
+    if (compressor_) {
+        replyField("ERR"); // der laufende deflate-Strom lässt sich nicht neu starten
+        return;
+    }
+    auto compressor = make_unique<WireCompressor>();
+    if (!compressor->ok()) {
+        replyField("ERR");
+        return;
+    }
+    replyField("OK");
+    compressor_ = move(compressor);
+
+    string_view rest;
+    if (framer_.buffered() > 0 && framer_.take(framer_.buffered(), rest)) {
+        string frames(rest);
+        decodeInput(frames.data(), frames.size());
+    }
+}
+
+// Empfangene Frames entpacken und den Klartext an den Framer geben. Die Grenzen der
+// Session gelten für den Klartext: gepuffert wird höchstens ein vollständiges SEND, auch
+// wenn wenige komprimierte Bytes zu beliebig vielen entpacken würden
+// @return false bei ungültigen Frames (Session wird mit ERR beendet)
+bool ClientSession::decodeInput(const char *data, size_t len) {
+    string plain;
+    size_t limit = numeric_limits<size_t>::max();
+    if (limits_.maxBody > 0) {
+        size_t command = limits_.maxBody + MAX_SEND_LINES * limits_.maxLine;
+        limit = command - min(command, framer_.buffered());
+    }
+    if (!compressor_->decode(data, len, plain, limit)) {
+        if (plain.size() > limit) {
+            ++stats_.bodyTooLarge;
         }
-        total += static_cast<size_t>(n);
+        replyField("ERR");
+        quit_ = true;
+        return false;
     }
+    framer_.append(plain.data(), plain.size());
     return true;
 }
 
-// Liest eine Zeile (\n-terminiert) vom Socket
-bool ClientSession::recvLine(string &line) const {
-    line.clear();
-    char c;
+// Einmal vom Socket lesen; mit COMPRESS über einen Zwischenpuffer und den Decoder
+// @return wie recv(): gelesene Bytes, 0 bei EOF, -1 bei Fehler (ungültige Frames
+// beenden die Session über quit_, damit das ERR noch gesendet wird)
+ssize_t ClientSession::readInput(int flags) {
+    if (!compressor_) {
+        return framer_.fill(sockfd_, flags);
+    }
+    char buf[16384];
+    ssize_t n = recv(sockfd_, buf, sizeof(buf), flags);
+    if (n > 0) {
+        decodeInput(buf, static_cast<size_t>(n)); // bei Fehler: ERR vorgemerkt, quit_ gesetzt
+    }
+    return n;
+}
 
-    while (true) {
-        ssize_t n = recv(sockfd_, &c, 1, 0);
-        if (n <= 0) {
+// Nächstes Feld im Binärmodus: erst 4-Byte-Länge, dann genau so viele Bytes Inhalt
+// @return false, wenn das Feld noch unvollständig ist oder die Grenze überschreitet
+bool ClientSession::nextField(string_view &field) {
+    if (!fieldPending_) {
+        string_view header;
+        if (!framer_.take(FIELD_HEADER, header)) {
             return false;
         }
+        const auto *b = reinterpret_cast<const unsigned char *>(header.data());
+        fieldLen_ = (size_t{b[0]} << 24) | (size_t{b[1]} << 16) | (size_t{b[2]} << 8) | b[3];
+        fieldPending_ = true;
 
-        if (c == '\n') {
-            break;
+        // Größe steht vorab fest: zu große Felder gar nicht erst puffern
+        bool isBody = pending_ == Command::Send && args_.size() == 2;
+        size_t limit = isBody ? limits_.maxBody : limits_.maxLine;
+        if (limit > 0 && fieldLen_ > limit) {
+            ++(isBody ? stats_.bodyTooLarge : stats_.lineTooLong);
+            pending_ = Command::None;
+            args_.clear();
+            replyField("ERR");
+            quit_ = true;
+            return false;
+        }
+    }
+    if (!framer_.take(fieldLen_, field)) {
+        return false; // Platz für das ganze Feld ist reserviert
+    }
+    fieldPending_ = false;
+    return true;
+}
+
+// Holt alle vollständigen Zeilen bzw. Felder aus dem Framer und füttert den Automaten
+void ClientSession::processInput() {
+    string_view line;
+    bool commandDone = false;
+    // Während WAIT bzw. eines Disk-Auftrags bleiben weitere Kommandos gepuffert
+    while (!quit_ && !waiting()) {
+        if (binary_) {
+            if (!nextField(line)) {
+                break;
+            }
+            handleField(line);
+        } else {
+            LineFramer::Status st = framer_.next(line);
+            if (st == LineFramer::Status::NeedMore) {
+                break; // Zeile noch unvollständig → auf weitere Daten warten
+            }
+            if (st == LineFramer::Status::TooLong) {
+                // Zeile ohne Ende: nicht weiter puffern, sondern Verbindung beenden
+                ++stats_.lineTooLong;
+                replyField("ERR");
+                quit_ = true;
+                break;
+            }
+            handleLine(line);
         }
-        line.push_back(c);
+        commandDone = commandDone || pending_ == Command::None;
     }
+    updatePhase(commandDone);
+}
+
+// Eine vollständige Zeile je nach aktuellem Zustand verarbeiten
+void ClientSession::handleLine(string_view line) {
+    switch (pending_) {
+    case Command::None:
+        startCommand(line);
+        return;
+
+    case Command::Send:
+        // Erst Empfänger & Betreff, danach Body bis "." allein steht
+        if (args_.size() < 2) {
+            args_.emplace_back(line);
+        } else if (LineFramer::isTerminator(line)) {
+            execute();
+        } else if (limits_.maxBody > 0 && body_.size() + line.size() + 1 > limits_.maxBody) {
+            // Body zu groß: nicht weiter puffern, sondern Verbindung beenden
+            ++stats_.bodyTooLarge;
+            pending_ = Command::None;
+            args_.clear();
+            body_.clear();
+            replyField("ERR");
+            quit_ = true;
+        } else {
+            body_.append(line);
+            body_ += '\n';
+        }
+        return;
 
-    // Entferne \r falls vorhanden (Windows-Style)
-    if (!line.empty() && line.back() == '\r') {
-        line.pop_back();
+    case Command::Login:
+        args_.emplace_back(line);
+        if (args_.size() == 2) { // Username, Passwort
+            execute();
+        }
+        return;
+
+    case Command::Read:
+    case Command::Delete:
+    case Command::MultiRead:
+    case Command::MultiDelete:
+        args_.emplace_back(line); // Nachrichtennummer bzw. Nummernliste
+        execute();
+        return;
     }
+}
 
-    return true;
+// Ein vollständiges Feld im Binärmodus verarbeiten; wie handleLine(), nur ist der
+// SEND-Body ein einzelnes Feld statt Zeilen bis "."
+void ClientSession::handleField(string_view field) {
+    if (pending_ == Command::Send && args_.size() == 2) {
+        body_.assign(field);
+        execute();
+        return;
+    }
+    handleLine(field);
+}
+
+// Kommandozeile auswerten; Kommandos mit Argumenten warten auf weitere Zeilen
+void ClientSession::startCommand(string_view cmd) {
+    if (cmd == "LOGIN") {
+        pending_ = Command::Login;
+    } else if (cmd == "SEND" || cmd == "READ" || cmd == "DEL" || cmd == "MREAD" || cmd == "MDEL") {
+        // Ohne Login sofortiger Fehler, Argumente werden dann nicht erwartet
+        if (!authenticated_) {
+            replyField("ERR");
+            return;
+        }
+        pending_ = cmd == "SEND"  ? Command::Send
+                 : cmd == "READ"  ? Command::Read
+                 : cmd == "DEL"   ? Command::Delete
+                 : cmd == "MREAD" ? Command::MultiRead
+                                  : Command::MultiDelete;
+    } else if (cmd == "LIST" || cmd.substr(0, 5) == "LIST ") {
+        Clock::time_point started = Clock::now();
+        handleList(cmd.substr(4));
+        if (storing_) {
+            storingStat_ = StatCommand::List;
+            storingSince_ = started;
+        } else {
+            recordTiming(StatCommand::List, started);
+        }
+    } else if (cmd == "QUIT") {
+        quit_ = true;
+    } else if (cmd == "PROTO BIN") {
+        // Bestätigung noch im Textformat, alle folgenden Felder mit Längenpräfix
+        replyField("OK");
+        binary_ = true;
+    } else if (cmd == "COMPRESS") {
+        enableCompression();
+    } else if (cmd.substr(0, 5) == "WAIT ") {
+        handleWait(cmd.substr(5));
+    } else {
+        replyField("ERR");
+    }
 }
 
-// LOGIN-Befehl: User & Passwort lesen und authentifizieren
-bool ClientSession::handleLogin() {
-    string user;
-    string pass;
+// Alle Zeilen des Kommandos liegen vor → Handler aufrufen und Zustand zurücksetzen
+void ClientSession::execute() {
+    Command cmd = pending_;
+    vector<string> args = move(args_);
+    string body = move(body_);
+    pending_ = Command::None;
+    args_.clear();
+    body_.clear();
 
-    // Erwartet 2 Zeilen: Username, Passwort
-    if (!recvLine(user) || !recvLine(pass)) {
-        return false;
+    Clock::time_point started = Clock::now();
+    StatCommand stat;
+    switch (cmd) {
+    case Command::Login:
+        handleLogin(args[0], args[1]);
+        stat = StatCommand::Login;
+        break;
+    case Command::Send:
+        handleSend(args[0], move(args[1]), move(body));
+        stat = StatCommand::Send;
+        break;
+    case Command::Read:
+        handleRead(args[0]);
+        stat = StatCommand::Read;
+        break;
+    case Command::Delete:
+        handleDelete(args[0]);
+        stat = StatCommand::Delete;
+        break;
+    case Command::MultiRead:
+        handleMultiRead(args[0]);
+        stat = StatCommand::MultiRead;
+        break;
+    case Command::MultiDelete:
+        handleMultiDelete(args[0]);
+        stat = StatCommand::MultiDelete;
+        break;
+    case Command::None:
+    default:
+        return;
     }
+    if (storing_) {
+        storingStat_ = stat; // Laufzeit erst, wenn die Disk-Stufe fertig ist
+        storingSince_ = started;
+        return;
+    }
+    recordTiming(stat, started);
+}
 
+// Plattenzugriff eines Kommandos ausführen: mit Disk-Stufe als Auftrag (die Session parkt
+// bis zum Abschluss), sonst direkt. work liefert die kodierte Antwort
+void ClientSession::submitStore(const string &mailbox, DiskStage::Work work) {
+    if (!disk_) {
+        reply(work());
+        return;
+    }
+    if (!wakeHandler_ && notifyFd_ < 0) {
+        notifyFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+    storing_ = disk_->submit(mailbox, move(work), [this]() { wake(); });
+}
+
+// Abgeschlossenen Auftrag der Disk-Stufe beantworten und weitere Kommandos abarbeiten
+void ClientSession::finishStore() {
+    string response;
+    {
+        lock_guard<mutex> lock(storing_->mtx);
+        if (!storing_->done) {
+            return;
+        }
+        response = move(storing_->response);
+    }
+    storing_.reset();
+    if (quit_) {
+        return; // Frist inzwischen abgelaufen, ERR ist schon unterwegs
+    }
+    if (waitLookup_) {
+        waitLookup_ = false;
+        if (waiting_) {
+            noteExisting(response);
+            onNotify();
+        } else {
+            processInput(); // WAIT ist inzwischen per Frist beantwortet
+        }
+        return;
+    }
+    reply(move(response));
+    recordTiming(storingStat_, storingSince_);
+    processInput();
+}
+
+// Wartende Session wecken (aus einem fremden Thread): über den Loop oder den eigenen eventfd
+void ClientSession::wake() {
+    if (wakeHandler_) {
+        wakeHandler_();
+    } else if (notifyFd_ >= 0) {
+        uint64_t one = 1;
+        ssize_t ignored = write(notifyFd_, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+// Laufzeit eines Handlers (inkl. Aufbereiten/Komprimieren der Antwort) erfassen
+void ClientSession::recordTiming(StatCommand cmd, Clock::time_point started) {
+    auto micros = chrono::duration_cast<chrono::microseconds>(Clock::now() - started).count();
+    stats_.recordCommand(cmd, static_cast<uint64_t>(micros));
+}
+
+// LOGIN-Befehl: User & Passwort authentifizieren
+void ClientSession::handleLogin(const string &user, const string &pass) {
     // Falls IP geblacklistet → sofortiger Fehler
     if (blacklist_.isBlacklisted(clientIp_)) {
-        sendAll("ERR\n");
-        return true;
+        replyField("ERR");
+        return;
     }
 
     // LDAP-Auth
@@ -94,162 +833,424 @@ bool ClientSession::handleLogin() {
         authenticated_ = true;
         username_ = user;
         blacklist_.recordSuccess(clientIp_, user);
-        sendAll("OK\n");
+        replyField("OK");
     } else {
         bool banned = blacklist_.recordFailure(clientIp_, user);
-        sendAll("ERR\n");
+        replyField("ERR");
         if (banned) {
             cerr << "IP " << clientIp_ << " gesperrt nach Fehlversuchen" << endl;
         }
     }
-    return true;
 }
 
 // SEND-Befehl: Nachricht absenden
-void ClientSession::handleSend() {
+void ClientSession::handleSend(const string &receiver, string subject, string body) {
+    // Betreff ggf. kürzen
+    if (subject.size() > MAX_SUBJECT) {
+        subject = subject.substr(0, MAX_SUBJECT);
+    }
+    // Im Binärmodus kann der Betreff Zeilenumbrüche enthalten; die .msg-Datei
+    // speichert ihn aber als eine Zeile
+    size_t nl = subject.find_first_of("\r\n");
+    if (nl != string::npos) {
+        subject.resize(nl);
+    }
+
+    // Mehrere Empfänger durch Komma getrennt: der Body wird einmal hochgeladen und im
+    // Datei-Layout auch nur einmal geschrieben
+    vector<string> receivers;
+    if (!parseRecipients(receiver, MAX_RECIPIENTS, receivers)) {
+        replyField("ERR");
+        return;
+    }
+
+    // Nachricht speichern (Aufträge an dasselbe erste Postfach sammelt die Disk-Stufe).
+    // Im durable-Modus nicht: nacheinander in einem Worker wartete jedes SEND seinen
+    // eigenen Gruppen-Commit ab, parallel teilen sie sich einen
+    string mailbox = store_.durable() ? string() : receivers[0];
+    submitStore(mailbox, [&store = store_, sender = username_, receivers = move(receivers),
+                          subject = move(subject), body = move(body), binary = binary_]() {
+        string resp;
+        encodeField(resp, store.storeMessage(sender, receivers, subject, body) ? "OK" : "ERR",
+                    binary);
+        return resp;
+    });
+}
+
+// LIST-Befehl: Liste aller Betreffzeilen senden
+void ClientSession::handleList(string_view query) {
     if (!authenticated_) {
-        sendAll("ERR\n");
+        replyField("ERR");
         return;
     }
+    if (!query.empty()) {
+        handleListPage(query.substr(1));
+        return;
+    }
+
+    submitStore(username_, [&store = store_, username = username_, binary = binary_]() {
+        vector<string> subjects;
+        store.listMessages(username, subjects);
 
-    string receiver;
-    string subject;
+        // Anzahl + jede Zeile
+        string resp;
+        encodeField(resp, to_string(subjects.size()), binary);
+        for (const auto &s : subjects) {
+            encodeField(resp, s, binary);
+        }
+        return resp;
+    });
+}
 
-    // Empfänger & Betreff lesen
-    if (!recvLine(receiver) || !recvLine(subject)) {
+// Seitenweises LIST: "LIST <offset> <limit>" oder "LIST SINCE <id>".
+// Antwort: Anzahl, dann pro Nachricht "<id> <betreff>"; Seiten sind auf
+// MAX_LIST_PAGE Einträge begrenzt, bei SINCE dient die letzte Nummer als neuer Cursor
+void ClientSession::handleListPage(string_view query) {
+    size_t space = query.find(' ');
+    string_view first = query.substr(0, space);
+    string_view second = space == string_view::npos ? string_view() : query.substr(space + 1);
+
+    size_t sinceId = 0;
+    size_t offset = 0;
+    size_t limit = MAX_LIST_PAGE;
+    bool valid = first == "SINCE" ? parseCount(second, sinceId) &&
+                                        sinceId <= static_cast<size_t>(numeric_limits<int>::max())
+                                  : parseCount(first, offset) && parseCount(second, limit);
+    if (!valid) {
+        replyField("ERR");
         return;
     }
 
-    // Betreff ggf. kürzen
-    if (subject.size() > MAX_SUBJECT) {
-        subject = subject.substr(0, MAX_SUBJECT);
+    submitStore(username_, [&store = store_, username = username_, sinceId, offset,
+                            limit = min(limit, MAX_LIST_PAGE), binary = binary_]() {
+        vector<MessageSummary> messages;
+        store.listMessages(username, static_cast<int>(sinceId), offset, limit, messages);
+
+        string resp;
+        encodeField(resp, to_string(messages.size()), binary);
+        for (const MessageSummary &msg : messages) {
+            encodeField(resp, to_string(msg.id) + " " + msg.subject, binary);
+        }
+        return resp;
+    });
+}
+
+// WAIT-Befehl: "WAIT <sekunden> [<seit-id>]". Parkt die Session, bis eine Nachricht an
+// den Benutzer zugestellt wird oder die Zeit abläuft; Antwort: Anzahl und neue Nummern.
+// Mit <seit-id> wird sofort geantwortet, wenn schon neuere Nachrichten vorliegen
+void ClientSession::handleWait(string_view args) {
+    size_t space = args.find(' ');
+    size_t seconds = 0;
+    size_t sinceId = 0;
+    bool valid = parseCount(args.substr(0, space), seconds) && seconds > 0 && seconds <= MAX_WAIT &&
+                 (space == string_view::npos ||
+                  (parseCount(args.substr(space + 1), sinceId) &&
+                   sinceId <= static_cast<size_t>(numeric_limits<int>::max())));
+    if (!authenticated_ || !valid) {
+        replyField("ERR");
+        return;
     }
 
-    // Body lesen, bis "." allein steht
-    string body;
-    while (true) {
-        string line;
-        if (!recvLine(line)) {
-            return;
+    // Blockierender Betrieb: eigener eventfd zum Wecken von poll(), kein zusätzlicher Thread.
+    // Vor addWaiter() anlegen, ab dann kann der speichernde Thread wake() aufrufen
+    if (!wakeHandler_ && notifyFd_ < 0) {
+        notifyFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    // Erst anmelden, dann nachsehen: so geht keine Zustellung dazwischen verloren
+    waitToken_ = store_.addWaiter(username_, [this](int msgNumber) {
+        {
+            lock_guard<mutex> lock(notifyMtx_);
+            notifiedIds_.push_back(msgNumber);
         }
-        if (line == ".") {
-            break;
+        wake();
+    });
+    waiting_ = true;
+    waitUntil_ = Clock::now() + chrono::seconds(seconds);
+
+    if (space != string_view::npos) {
+        // Vorhandene Nachrichten wie LIST SINCE über die Disk-Stufe suchen (Index-Neuaufbau
+        // oder Laden ins Cache nicht im Loop-Thread); finishStore() trägt sie ein
+        DiskStage::Work lookup = [&store = store_, username = username_, sinceId]() {
+            vector<MessageSummary> existing;
+            store.listMessages(username, static_cast<int>(sinceId), 0, MAX_LIST_PAGE, existing);
+            string ids;
+            for (const MessageSummary &msg : existing) {
+                ids += to_string(msg.id);
+                ids += ' ';
+            }
+            return ids;
+        };
+        if (disk_) {
+            waitLookup_ = true;
+            submitStore(username_, move(lookup));
+            return;
         }
-        body += line + "\n";
+        noteExisting(lookup());
     }
+    onNotify();
+}
 
-    // Nachricht speichern
-    bool ok = store_.storeMessage(username_, receiver, subject, body);
-    sendAll(ok ? "OK\n" : "ERR\n");
+// Ergebnis der Suche von WAIT <seit-id> ("<id> <id> ...") wie Zustellungen vormerken
+void ClientSession::noteExisting(const string &ids) {
+    lock_guard<mutex> lock(notifyMtx_);
+    for (size_t pos = 0; pos < ids.size();) {
+        size_t end = ids.find(' ', pos);
+        notifiedIds_.push_back(atoi(ids.c_str() + pos));
+        pos = end == string::npos ? ids.size() : end + 1;
+    }
 }
 
-// LIST-Befehl: Liste aller Betreffzeilen senden
-void ClientSession::handleList() {
-    if (!authenticated_) {
-        sendAll("ERR\n");
+// Wartende Session: liegen Benachrichtigungen vor, WAIT beantworten
+void ClientSession::onNotify() {
+    if (storing_) {
+        finishStore();
+        return;
+    }
+    if (!waiting_) {
         return;
     }
+    bool ready;
+    {
+        lock_guard<mutex> lock(notifyMtx_);
+        ready = !notifiedIds_.empty();
+    }
+    if (ready) {
+        finishWait();
+    }
+}
 
-    vector<string> subjects;
-    store_.listMessages(username_, subjects);
+// WAIT beenden: abmelden, gesammelte Nummern senden und gepufferte Kommandos fortsetzen
+void ClientSession::finishWait() {
+    store_.removeWaiter(username_, waitToken_);
+    waiting_ = false;
 
-    // Anzahl + jede Zeile
-    string resp = to_string(subjects.size()) + "\n";
-    for (const auto &s : subjects) {
-        resp += s + "\n";
+    vector<int> ids;
+    {
+        lock_guard<mutex> lock(notifyMtx_);
+        ids.swap(notifiedIds_);
     }
-    sendAll(resp);
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+
+    string resp;
+    encodeField(resp, to_string(ids.size()));
+    for (int id : ids) {
+        encodeField(resp, to_string(id));
+    }
+    reply(move(resp));
+    processInput();
 }
 
 // READ-Befehl: eine Nachricht vollständig ausgeben
-void ClientSession::handleRead() {
-    if (!authenticated_) {
-        sendAll("ERR\n");
+void ClientSession::handleRead(const string &msgNumStr) {
+    int msgNum = atoi(msgNumStr.c_str());
+    string sender, receiver, subject;
+    MessageBody body;
+
+    // Nur Kopfzeilen lesen, der Body bleibt in der Datei
+    if (!store_.openMessage(username_, msgNum, sender, receiver, subject, body)) {
+        replyField("ERR");
         return;
     }
 
-    string msgNumStr;
-    if (!recvLine(msgNumStr)) {
+    // Ausgabeformat: Kopf aus dem Speicher, Body direkt aus der .msg-Datei (oder dem Cache)
+    string head;
+    encodeField(head, "OK");
+    encodeField(head, sender);
+    encodeField(head, receiver);
+    encodeField(head, subject);
+    if (binary_) {
+        // Body als ein Feld: Länge ist bekannt, kein Terminator und kein Durchsuchen
+        appendLength(head, body.length);
+        reply(move(head));
+        replyBody(body);
         return;
     }
+    reply(move(head));
+    replyBody(body);
+    reply(body.endsWithNewline ? ".\n" : "\n.\n");
+}
 
-    int msgNum = atoi(msgNumStr.c_str());
-    string sender, receiver, subject, body;
-
-    // Nachricht aus dem Store holen
-    if (!store_.readMessage(username_, msgNum, sender, receiver, subject, body)) {
-        sendAll("ERR\n");
+// MREAD-Befehl: mehrere Nachrichten in einer Antwort. Format: Anzahl, dann pro
+// Nachricht Nummer, Sender, Empfänger, Betreff und Body (Text: bis ".")
+void ClientSession::handleMultiRead(const string &spec) {
+    vector<int> ids;
+    vector<OpenedMessage> messages;
+    if (!parseNumberList(spec, MAX_BATCH_READ, ids) ||
+        !store_.openMessages(username_, ids, messages)) {
+        replyField("ERR");
         return;
     }
 
-    // Ausgabeformat
-    string resp = "OK\n";
-    resp += sender + "\n";
-    resp += receiver + "\n";
-    resp += subject + "\n";
-    if (!body.empty()) {
-        resp += body;
-        if (resp.back() != '\n') {
-            resp += "\n";
+    string head;
+    encodeField(head, to_string(messages.size()));
+    for (OpenedMessage &msg : messages) {
+        encodeField(head, to_string(msg.id));
+        encodeField(head, msg.sender);
+        encodeField(head, msg.receiver);
+        encodeField(head, msg.subject);
+        if (binary_) {
+            appendLength(head, msg.body.length);
+        }
+        reply(move(head));
+        head.clear();
+        replyBody(msg.body);
+        if (!binary_) {
+            head = msg.body.endsWithNewline ? ".\n" : "\n.\n";
         }
     }
-    resp += ".\n";
-
-    sendAll(resp);
+    if (!head.empty()) {
+        reply(move(head));
+    }
 }
 
 // DEL-Befehl: Nachricht löschen
-void ClientSession::handleDelete() {
-    if (!authenticated_) {
-        sendAll("ERR\n");
-        return;
-    }
+void ClientSession::handleDelete(const string &msgNumStr) {
+    int msgNum = atoi(msgNumStr.c_str());
+    submitStore(username_, [&store = store_, username = username_, msgNum, binary = binary_]() {
+        string resp;
+        encodeField(resp, store.deleteMessage(username, msgNum) ? "OK" : "ERR", binary);
+        return resp;
+    });
+}
 
-    string msgNumStr;
-    if (!recvLine(msgNumStr)) {
+// MDEL-Befehl: mehrere Nachrichten löschen, Antwort ist die Anzahl gelöschter Nachrichten
+void ClientSession::handleMultiDelete(const string &spec) {
+    vector<int> ids;
+    if (!parseNumberList(spec, MAX_BATCH_DELETE, ids)) {
+        replyField("ERR");
         return;
     }
-
-    int msgNum = atoi(msgNumStr.c_str());
-    bool ok = store_.deleteMessage(username_, msgNum);
-    sendAll(ok ? "OK\n" : "ERR\n");
+    submitStore(username_, [&store = store_, username = username_, ids = move(ids),
+                            binary = binary_]() {
+        size_t deleted = 0;
+        string resp;
+        encodeField(resp, store.deleteMessages(username, ids, deleted) ? to_string(deleted) : "ERR",
+                    binary);
+        return resp;
+    });
 }
 
-// Haupt-Loop der Session
-void ClientSession::run() {
+// Blacklist-Prüfung beim Verbindungsaufbau
+bool ClientSession::start() {
     // Sofortiger Block falls IP gesperrt
     if (blacklist_.isBlacklisted(clientIp_)) {
-        sendAll("ERR\n");
+        replyField("ERR");
+        quit_ = true;
+        return false;
+    }
+    return true;
+}
+
+// Haupt-Loop der Session (blockierender Modus, ein Thread pro Verbindung)
+void ClientSession::run() {
+    if (!start()) {
+        flushBlocking();
         close(sockfd_);
         return;
     }
 
-    while (true) {
-        string cmd;
-        if (!recvLine(cmd)) {
-            break;
-        }
+    // Senden darf höchstens so lange blockieren, wie ein Kommando dauern darf
+    if (limits_.commandTimeout > 0) {
+        timeval tv{limits_.commandTimeout, 0};
+        setsockopt(sockfd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
 
-        // Kommandos
-        if (cmd == "LOGIN") {
-            if (!handleLogin()) {
+    while (!quit_) {
+        // Auf Daten warten, höchstens bis zur aktuellen Frist
+        int waitMs = -1;
+        Clock::time_point until = deadline();
+        if (until != Clock::time_point::max()) {
+            auto left = chrono::duration_cast<chrono::milliseconds>(until - Clock::now()).count();
+            waitMs = left > 0 ? static_cast<int>(left) + 1 : 0;
+        }
+        // Während WAIT nur auf die Benachrichtigung warten; der Socket meldet dann
+        // nur noch Verbindungsabbrüche (POLLRDHUP/POLLHUP/POLLERR)
+        pollfd pfds[2] = {{sockfd_, static_cast<short>(waiting() ? POLLRDHUP : POLLIN), 0},
+                          {notifyFd_, POLLIN, 0}};
+        int ready = poll(pfds, notifyFd_ >= 0 ? 2 : 1, waitMs);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready == 0) {
+            if (!expire()) {
+                writeOutput(MSG_DONTWAIT); // ERR nur, wenn es sofort in den Socket passt
                 break;
             }
-        } else if (cmd == "SEND") {
-            handleSend();
-        } else if (cmd == "LIST") {
-            handleList();
-        } else if (cmd == "READ") {
-            handleRead();
-        } else if (cmd == "DEL") {
-            handleDelete();
-        } else if (cmd == "QUIT") {
+        } else if (ready > 0 && (pfds[1].revents & POLLIN)) {
+            uint64_t count;
+            ssize_t ignored = read(notifyFd_, &count, sizeof(count));
+            (void)ignored;
+            onNotify();
+        } else if (ready > 0 && waiting()) {
+            break; // Client hat während WAIT aufgelegt
+        } else if (ready < 0 || readInput(0) <= 0) {
+            // Große Blöcke lesen statt Byte für Byte
             break;
         } else {
-            sendAll("ERR\n");
+            // Alle vollständigen Kommandos abarbeiten
+            processInput();
+        }
+
+        // Antworten senden
+        int sent = writeOutput(0);
+        if (sent == 0) {
+            ++stats_.commandTimeouts; // SO_SNDTIMEO: Client liest die Antwort nicht ab
+        }
+        if (sent != 1) {
+            break;
         }
     }
 
     // Verbindung sauber schließen
     close(sockfd_);
 }
+
+// Reaktor-Modus: Socket ist lesbar
+bool ClientSession::onReadable() {
+    bool peerClosed = false;
+
+    // Nicht-blockierend lesen, bis der Kernel-Puffer leer ist; dazwischen Zeilen
+    // verarbeiten, damit der Puffer nicht über die maximale Zeilenlänge wächst.
+    // Während WAIT bleibt der Rest im Socket, bis die Antwort raus ist
+    while (!quit_ && !waiting()) {
+        ssize_t n = readInput(MSG_DONTWAIT);
+        if (n > 0) {
+            processInput();
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        peerClosed = true; // EOF oder Fehler
+        break;
+    }
+
+    processInput();
+    if (!flushNonBlocking() || peerClosed) {
+        return false;
+    }
+    return !finished();
+}
+
+// Completion-basierter Betrieb: Bytes kommen bereits gelesen vom Loop
+void ClientSession::onData(const char *data, size_t len) {
+    if (compressor_) {
+        decodeInput(data, len);
+    } else {
+        framer_.append(data, len);
+    }
+    processInput();
+}
+
+// Reaktor-Modus: Socket ist wieder schreibbar
+bool ClientSession::onWritable() {
+    if (!flushNonBlocking()) {
+        return false;
+    }
+    return !finished();
+}
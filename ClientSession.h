@@ -1,47 +1,250 @@
 #pragma once
 
+#include "DiskStage.h"
+#include "LineFramer.h"
+#include "ServerStats.h"
+#include "SessionLimits.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
 
 class MailStore;
+struct MessageBody;
 class BlacklistManager;
 class LdapAuthenticator;
+class WireCompressor;
 
 /// Klasse, die eine einzelne Client-Verbindung repräsentiert und alle Befehle abwickelt.
 /// Verwaltet den Login-Status, liest Befehle und ruft die benötigten Services auf.
+/// Die Session ist ein Zustandsautomat: eingelesene Bytes werden gepuffert und ein
+/// Kommando wird erst ausgeführt, wenn alle seine Zeilen vorliegen. Dadurch kann sie
+/// blockierend in einem eigenen Thread (run) oder von einem Event-Loop betrieben werden.
+/// Nach "PROTO BIN" werden Anfragen und Antworten als Felder mit 4-Byte-Längenpräfix
+/// statt als Zeilen übertragen; die Kommandos selbst bleiben gleich. Nach "COMPRESS"
+/// läuft der Datenstrom in beiden Richtungen durch einen WireCompressor.
+/// Mit DiskStage (Event-Loop-Betrieb) gehen SEND, DEL, MDEL und LIST an deren Disk-Worker;
+/// die Session parkt wie bei WAIT, bis der Auftrag abgeschlossen ist.
 class ClientSession {
 public:
+    using Clock = std::chrono::steady_clock;
+
     /// Erstellt eine Session für einen akzeptierten Socket.
     /// @param socketFD File-Descriptor der Client-Verbindung.
-    /// @param clientIp Textuelle IPv4-Adresse des Clients.
+    /// @param clientIp Textuelle IPv4-Adresse des Clients bzw. "uid:<n>" bei AF_UNIX.
     /// @param store Gemeinsamer MailStore.
     /// @param blacklist Gemeinsame Blacklist-Verwaltung.
     /// @param authenticator LDAP-Authentifikator.
+    /// @param limits Zeit- und Größenlimits der Session.
+    /// @param stats Gemeinsame Serverzähler (Limit-Treffer).
+    /// @param disk I/O-Stufe für Plattenzugriffe (nullptr = im eigenen Thread ausführen).
     ClientSession(int socketFD,
                   std::string clientIp,
                   MailStore &store,
                   BlacklistManager &blacklist,
-                  LdapAuthenticator &authenticator);
+                  LdapAuthenticator &authenticator,
+                  const SessionLimits &limits,
+                  ServerStats &stats,
+                  DiskStage *disk = nullptr);
 
-    /// Startet die Verarbeitungsschleife für den Client.
+    /// Schließt noch offene Nachrichtendateien aus der Ausgabe-Queue. Ein noch laufender
+    /// Auftrag der Disk-Stufe wird zu Ende ausgeführt, weckt die Session aber nicht mehr.
+    ~ClientSession();
+
+    /// Startet die blockierende Verarbeitungsschleife für den Client.
     void run();
 
+    /// Prüft beim Verbindungsaufbau die Blacklist und stellt ggf. ein ERR in die Ausgabe.
+    /// @return false, wenn die Verbindung nach dem Senden geschlossen werden soll.
+    bool start();
+
+    /// Reaktor-Modus: liest alle verfügbaren Bytes vom nicht-blockierenden Socket,
+    /// führt vollständige Kommandos aus und sendet so viel Antwort wie möglich.
+    /// @return false, wenn die Session beendet ist und geschlossen werden soll.
+    bool onReadable();
+
+    /// Reaktor-Modus: sendet ausstehende Antwortdaten weiter.
+    /// @return false, wenn die Session beendet ist und geschlossen werden soll.
+    bool onWritable();
+
+    /// @return true, solange Antwortdaten auf das Senden warten.
+    bool hasPendingOutput() const;
+
+    /// Completion-basierter Betrieb (io_uring): empfangene Bytes übergeben und
+    /// alle dadurch vollständigen Kommandos ausführen.
+    /// @param data Empfangene Bytes.
+    /// @param len Anzahl der Bytes.
+    void onData(const char *data, size_t len);
+
+    /// Beschreibt die noch nicht gesendeten Antwortdaten als iovec-Liste (für sendmsg).
+    /// Steht ein Dateisegment (READ-Body) vorne, wird ein Stück davon in einen
+    /// Zwischenpuffer gelesen; dahinterliegende Segmente folgen im nächsten Aufruf.
+    /// Die Einträge bleiben gültig, bis outputSent() oder onData() aufgerufen wird;
+    /// Antworten, die bis dahin fertig werden (Wecken durch WAIT oder die Disk-Stufe),
+    /// werden nur angehängt.
+    /// @param iov Ausgabe-Array.
+    /// @param maxIov Größe des Arrays.
+    /// @return Anzahl der belegten Einträge.
+    size_t outputIov(struct iovec *iov, size_t maxIov);
+
+    /// Markiert Antwortdaten als gesendet.
+    /// @param len Anzahl der tatsächlich gesendeten Bytes.
+    void outputSent(size_t len);
+
+    /// @return true, wenn die Session beendet ist (QUIT/Sperre) und alles gesendet wurde.
+    bool finished() const;
+
+    /// Frist der Session: Leerlauf-Timeout zwischen Kommandos bzw. Kommando-Frist, solange
+    /// ein Kommando eingelesen, ausgeführt oder seine Antwort gesendet wird.
+    /// @return Ablaufzeitpunkt, Clock::time_point::max() ohne aktives Limit.
+    Clock::time_point deadline() const;
+
+    /// Frist abgelaufen: zählt den Treffer, stellt ERR in die Ausgabe und beendet die Session.
+    /// Bereits vorhandene Ausgabesegmente bleiben unberührt, da ein laufender
+    /// Sendeauftrag (io_uring) sie noch referenzieren kann. Bei einem laufenden WAIT
+    /// wird stattdessen nur dessen (leere) Antwort in die Ausgabe gestellt.
+    /// @return true, wenn die Session weiterläuft (abgelaufenes WAIT).
+    bool expire();
+
+    /// Event-Loop-Betrieb: Rückruf, mit dem eine wartende Session (WAIT oder Auftrag der
+    /// Disk-Stufe) ihren Loop weckt. Er wird aus einem fremden Thread aufgerufen und muss
+    /// thread-sicher sein; der Loop ruft daraufhin onNotify() auf. Ohne Rückruf (blockierender Betrieb)
+    /// weckt die Session sich über einen eigenen eventfd.
+    /// @param handler Weckfunktion des Loops.
+    void setWakeHandler(std::function<void()> handler) { wakeHandler_ = std::move(handler); }
+
+    /// Beantwortet ein laufendes WAIT, falls inzwischen neue Post zugestellt wurde, bzw.
+    /// einen abgeschlossenen Auftrag der Disk-Stufe, und arbeitet danach weitere
+    /// gepufferte Kommandos ab.
+    void onNotify();
+
+    /// @return true, solange die Session in WAIT oder auf einen Auftrag der Disk-Stufe
+    ///         wartet (keine Eingabe lesen).
+    bool waiting() const { return waiting_ || storing_; }
+
+    /// @return true, solange die Session in WAIT geparkt ist (ohne Auftrag der Disk-Stufe).
+    bool inWait() const { return waiting_; }
+
+    /// @return File-Descriptor der Client-Verbindung.
+    int fd() const { return sockfd_; }
+
 private:
+    /// Kommando, dessen Argumentzeilen gerade gesammelt werden.
+    enum class Command { None, Login, Send, Read, Delete, MultiRead, MultiDelete };
+
     int sockfd_;
     std::string clientIp_;
     MailStore &store_;
     BlacklistManager &blacklist_;
     LdapAuthenticator &authenticator_;
+    SessionLimits limits_;
+    ServerStats &stats_;
+    DiskStage *disk_;
 
     bool authenticated_ = false;
     std::string username_;
 
-    bool sendAll(const std::string &data) const;
-    bool recvLine(std::string &line) const;
+    // Parser-Zustand, bleibt zwischen zwei Leseereignissen erhalten
+    Command pending_ = Command::None;
+    std::vector<std::string> args_;
+    std::string body_;
+    bool quit_ = false;
+
+    // Binärmodus (nach PROTO BIN): Felder mit 4-Byte-Längenpräfix statt Zeilen
+    bool binary_ = false;
+    bool fieldPending_ = false; // Längenpräfix gelesen, Inhalt fehlt noch
+    size_t fieldLen_ = 0;
+
+    std::unique_ptr<WireCompressor> compressor_; // gesetzt nach COMPRESS
+
+    // WAIT: Registrierung im MailStore und gesammelte Nummern (aus fremden Threads befüllt)
+    bool waiting_ = false;
+    Clock::time_point waitUntil_;
+    uint64_t waitToken_ = 0;
+    std::mutex notifyMtx_;
+    std::vector<int> notifiedIds_;
+    std::function<void()> wakeHandler_;
+    int notifyFd_ = -1; // eventfd im blockierenden Betrieb
+
+    // Laufender Auftrag der Disk-Stufe; Laufzeit wird bei dessen Abschluss erfasst
+    std::shared_ptr<DiskStage::Completion> storing_;
+    bool waitLookup_ = false; // storing_ ist die Suche von WAIT <seit-id>
+    StatCommand storingStat_ = StatCommand::Send;
+    Clock::time_point storingSince_;
+
+    // Fristen: Beginn der aktuellen Leerlauf- bzw. Kommandophase
+    bool busy_ = false;
+    Clock::time_point phaseStart_;
+
+    /// Teil der Ausgabe: entweder Bytes im Speicher oder ein Ausschnitt einer Datei,
+    /// der per sendfile() ohne Umweg über den Userspace gesendet wird.
+    struct OutSegment {
+        std::string data;
+        int fd = -1;       // >= 0: Dateisegment, data bleibt leer
+        off_t offset = 0;
+        size_t length = 0;
+        std::shared_ptr<const std::string> shared; // Body aus dem BodyCache, ohne Kopie
+        bool deferred = false; // noch Klartext bzw. Datei, kodiert wird vorne (encodeFront)
+        bool stuff = false;    // Dateisegment im Textmodus: Punkt-Stuffing beim Lesen
+        bool lineStart = true; // mit stuff: das nächste Stück beginnt eine Zeile
+
+        const std::string &bytes() const { return shared ? *shared : data; }
+        size_t size() const { return fd >= 0 ? length : bytes().size(); }
+    };
+
+    LineFramer framer_;
+    std::deque<OutSegment> outQueue_; // Antworten aller ausgeführten Kommandos, in Reihenfolge
+    size_t outOffset_ = 0;            // bereits gesendete Bytes des ersten Segments
+    bool outputPinned_ = false;       // outputIov() hat Segmente herausgegeben
+    std::string fileChunk_;           // Zwischenpuffer für Dateisegmente in outputIov()
+    size_t deferred_ = 0;             // Segmente mit deferred in der Queue
+
+    void reply(std::string data);
+    void encodeField(std::string &out, std::string_view field) const;
+    static void encodeField(std::string &out, std::string_view field, bool binary);
+    void replyField(std::string_view field);
+    void replyFile(int fd, off_t offset, size_t length, bool stuff);
+    void replyBody(const MessageBody &body);
+    std::string encodeOutput(std::string_view plain);
+    bool encodeFront();
+    void dropOutput();
+    int writeOutput(int flags);
+    bool flushBlocking();
+    bool flushNonBlocking();
+
+    void updatePhase(bool commandDone);
+    void enableCompression();
+    bool decodeInput(const char *data, size_t len);
+    ssize_t readInput(int flags);
+    void recordTiming(StatCommand cmd, Clock::time_point started);
+
+    void processInput();
+    bool nextField(std::string_view &field);
+    void handleLine(std::string_view line);
+    void handleField(std::string_view field);
+    void startCommand(std::string_view cmd);
+    void execute();
+    void submitStore(const std::string &mailbox, DiskStage::Work work);
+    void finishStore();
+    void wake();
 
-    bool handleLogin();
-    void handleSend();
-    void handleList();
-    void handleRead();
-    void handleDelete();
+    void handleLogin(const std::string &user, const std::string &pass);
+    void handleSend(const std::string &receiver, std::string subject, std::string body);
+    void handleList(std::string_view query);
+    void handleListPage(std::string_view query);
+    void handleWait(std::string_view args);
+    void finishWait();
+    void noteExisting(const std::string &ids);
+    void handleRead(const std::string &msgNumStr);
+    void handleDelete(const std::string &msgNumStr);
+    void handleMultiRead(const std::string &spec);
+    void handleMultiDelete(const std::string &spec);
 };
@@ -0,0 +1,140 @@
+#include "DiskStage.h"
+#include "ServerStats.h"
+
+namespace {
+    constexpr size_t MAX_BATCH = 32; // Aufträge eines Postfachs pro Durchgang
+}
+
+using namespace std;
+
+DiskStage::DiskStage(size_t workers, size_t queueDepth, ServerStats &stats)
+    : queueDepth_(queueDepth > 0 ? queueDepth : 1), stats_(stats) {
+    if (workers == 0) {
+        workers = 1;
+    }
+    for (size_t i = 0; i < workers; ++i) {
+        threads_.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+DiskStage::~DiskStage() {
+    {
+        lock_guard<mutex> lock(mtx_);
+        stopping_ = true;
+    }
+    workCv_.notify_all();
+    for (auto &t : threads_) {
+        t.join();
+    }
+}
+
+shared_ptr<DiskStage::Completion> DiskStage::submit(const string &mailbox, Work work,
+                                                    function<void()> wake) {
+    auto completion = make_shared<Completion>();
+    completion->wake = move(wake);
+    {
+        unique_lock<mutex> lock(mtx_);
+        if (!stopping_) {
+            ++stats_.diskJobs;
+            // Gegendruck ohne den Loop-Thread anzuhalten: bei voller Queue wartet der
+            // Auftrag dahinter, seine Session bleibt bis zum Abschluss geparkt
+            if (queue_.size() >= queueDepth_ || !overflow_.empty()) {
+                ++stats_.diskQueueFull;
+                overflow_.push_back(Job{mailbox, move(work), completion});
+                return completion;
+            }
+            queue_.push_back(Job{mailbox, move(work), completion});
+            lock.unlock();
+            workCv_.notify_one();
+            return completion;
+        }
+    }
+    // Beim Beenden nimmt die Queue nichts mehr an: direkt im Aufrufer ausführen
+    complete(*completion, work());
+    return completion;
+}
+
+size_t DiskStage::queued() const {
+    lock_guard<mutex> lock(mtx_);
+    return queue_.size() + overflow_.size();
+}
+
+// Wartende Aufträge nachrücken lassen, soweit die Queue Platz hat (unter mtx_)
+// @return true, wenn Aufträge nachgerückt sind
+bool DiskStage::admitOverflow() {
+    bool admitted = false;
+    while (!overflow_.empty() && queue_.size() < queueDepth_) {
+        queue_.push_back(move(overflow_.front()));
+        overflow_.pop_front();
+        admitted = true;
+    }
+    return admitted;
+}
+
+// Ältester Auftrag eines Postfachs, an dem gerade kein Worker arbeitet (unter mtx_)
+deque<DiskStage::Job>::iterator DiskStage::nextRunnable() {
+    for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+        if (busy_.count(it->mailbox) == 0) {
+            return it;
+        }
+    }
+    return queue_.end();
+}
+
+void DiskStage::workerLoop() {
+    unique_lock<mutex> lock(mtx_);
+    while (true) {
+        auto first = nextRunnable();
+        if (first == queue_.end()) {
+            if (stopping_ && queue_.empty() && overflow_.empty()) {
+                return;
+            }
+            workCv_.wait(lock);
+            continue;
+        }
+
+        // Alle wartenden Aufträge dieses Postfachs mitnehmen, in ihrer Reihenfolge;
+        // ein Auftrag ohne Postfach läuft allein
+        string mailbox = first->mailbox;
+        vector<Job> batch;
+        if (mailbox.empty()) {
+            batch.push_back(move(*first));
+            queue_.erase(first);
+        } else {
+            for (auto it = first; it != queue_.end() && batch.size() < MAX_BATCH;) {
+                if (it->mailbox == mailbox) {
+                    batch.push_back(move(*it));
+                    it = queue_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            busy_.insert(mailbox);
+        }
+        bool admitted = admitOverflow();
+        ++stats_.diskBatches;
+        lock.unlock();
+        if (admitted) {
+            workCv_.notify_all(); // nachgerückte Aufträge für die anderen Worker
+        }
+
+        for (Job &job : batch) {
+            complete(*job.completion, job.work());
+        }
+
+        lock.lock();
+        if (!mailbox.empty()) {
+            busy_.erase(mailbox);
+            workCv_.notify_all(); // übersprungene Aufträge dieses Postfachs sind jetzt frei
+        }
+    }
+}
+
+void DiskStage::complete(Completion &completion, string response) {
+    lock_guard<mutex> lock(completion.mtx);
+    completion.response = move(response);
+    completion.done = true;
+    if (completion.wake) {
+        completion.wake();
+    }
+}
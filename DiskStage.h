@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+struct ServerStats;
+
+/// Eigene I/O-Stufe für die Plattenzugriffe der Sessions im Reaktor- und io_uring-Modus:
+/// SEND, DEL, MDEL und LIST laufen nicht im Loop-Thread, sondern werden in eine
+/// begrenzte Queue gestellt und von wenigen Disk-Workern abgearbeitet. Die Session
+/// parkt bis zum Abschluss; der Worker weckt sie über ihren Loop.
+/// Aufträge desselben Postfachs nimmt ein Worker gesammelt und der Reihe nach; solange
+/// er daran arbeitet, ziehen die anderen Worker an ihnen vorbei Aufträge anderer
+/// Postfächer vor, statt auf dessen Sperre zu warten. Ist die Queue voll, blockiert
+/// submit() nicht (der Aufrufer ist ein Loop-Thread): der Auftrag wartet außerhalb der
+/// Queue, bis ein Worker Platz schafft, und seine Session bleibt so lange geparkt und
+/// liest ihren Socket nicht weiter. Jede Session hat höchstens einen Auftrag offen.
+class DiskStage {
+public:
+    /// Ergebnis eines Auftrags. Der Worker setzt response und done und ruft danach wake
+    /// auf; beides unter mtx. Eine Session, die vorher endet, löscht wake unter mtx.
+    struct Completion {
+        std::mutex mtx;
+        bool done = false;
+        std::string response;       ///< fertig kodierte (unkomprimierte) Antwort
+        std::function<void()> wake; ///< weckt die wartende Session
+    };
+
+    /// Arbeit eines Auftrags; läuft im Disk-Worker und liefert die Antwort.
+    /// Darf die Session nicht anfassen, sie kann inzwischen beendet sein.
+    using Work = std::function<std::string()>;
+
+    /// @param workers Anzahl der Disk-Worker.
+    /// @param queueDepth Maximale Anzahl wartender Aufträge.
+    /// @param stats Zähler für Aufträge, Sammelläufe und volle Queue.
+    DiskStage(size_t workers, size_t queueDepth, ServerStats &stats);
+
+    /// Arbeitet die restlichen Aufträge ab und beendet die Worker.
+    ~DiskStage();
+
+    DiskStage(const DiskStage &) = delete;
+    DiskStage &operator=(const DiskStage &) = delete;
+
+    /// Stellt einen Auftrag in die Queue; ist sie voll, wartet er dahinter, bis ein
+    /// Worker Platz schafft. Blockiert nie.
+    /// @param mailbox Postfach, auf das der Auftrag zugreift (Sammeln und Reihenfolge);
+    ///        leer = ohne Zuordnung, läuft einzeln und parallel zu allen anderen.
+    /// @param work Auszuführende Arbeit.
+    /// @param wake Weckfunktion der Session; muss thread-sicher und kurz sein.
+    /// @return Abschluss des Auftrags.
+    std::shared_ptr<Completion> submit(const std::string &mailbox, Work work,
+                                       std::function<void()> wake);
+
+    /// @return Anzahl der aktuell wartenden Aufträge (auch hinter der vollen Queue).
+    size_t queued() const;
+
+    size_t workers() const { return threads_.size(); }
+    size_t queueDepth() const { return queueDepth_; }
+
+private:
+    struct Job {
+        std::string mailbox;
+        Work work;
+        std::shared_ptr<Completion> completion;
+    };
+
+    size_t queueDepth_;
+    ServerStats &stats_;
+    std::vector<std::thread> threads_;
+
+    mutable std::mutex mtx_;
+    std::condition_variable workCv_; // neue Aufträge oder ein Postfach wurde frei
+    std::deque<Job> queue_;
+    std::deque<Job> overflow_; // warten auf Platz in queue_, in Ankunftsreihenfolge
+    std::unordered_set<std::string> busy_; // Postfächer, an denen ein Worker arbeitet
+    bool stopping_ = false;
+
+    void workerLoop();
+    std::deque<Job>::iterator nextRunnable();
+    bool admitOverflow();
+    static void complete(Completion &completion, std::string response);
+};
@@ -0,0 +1,300 @@
+#include "EventLoop.h"
+
+#include "ClientSession.h"
+#include "ServerStats.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+    constexpr int MAX_EVENTS = 128; // Events pro epoll_wait()
+}
+
+using namespace std;
+
+EventLoop::EventLoop(ServerStats &stats) : stats_(stats) {}
+
+EventLoop::~EventLoop() {
+    stop();
+    if (epollFd_ >= 0) {
+        close(epollFd_);
+    }
+    if (wakeFd_ >= 0) {
+        close(wakeFd_);
+    }
+}
+
+bool EventLoop::start() {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) {
+        perror("epoll_create1");
+        return false;
+    }
+
+    // eventfd weckt den Loop, wenn der Accept-Thread neue Sessions übergibt
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd_ < 0) {
+        perror("eventfd");
+        return false;
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeFd_;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev) < 0) {
+        perror("epoll_ctl");
+        return false;
+    }
+
+    thread_ = thread([this]() { loop(); });
+    return true;
+}
+
+void EventLoop::stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    stopping_ = true;
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd_, &one, sizeof(one));
+    (void)ignored;
+    thread_.join();
+}
+
+void EventLoop::addSession(unique_ptr<ClientSession> session) {
+    // Schon beim Einreihen zählen: sonst sieht drainSessions() eine gerade angenommene
+    // Verbindung, die der Loop noch nicht übernommen hat, nicht und beendet den Prozess
+    ++stats_.activeSessions;
+    {
+        lock_guard<mutex> lock(mtx_);
+        incoming_.push_back(move(session));
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd_, &one, sizeof(one));
+    (void)ignored;
+}
+
+// Übergebene Sessions in epoll aufnehmen (läuft im Loop-Thread)
+void EventLoop::adoptIncoming() {
+    vector<unique_ptr<ClientSession>> batch;
+    {
+        lock_guard<mutex> lock(mtx_);
+        batch.swap(incoming_);
+    }
+
+    for (auto &session : batch) {
+        int fd = session->fd();
+        bool keep = session->start();
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            close(fd);
+            --stats_.activeSessions;
+            continue;
+        }
+        ClientSession &added = *session;
+        added.setWakeHandler([this, fd]() { notify(fd); });
+        sessions_[fd] = move(session);
+        schedule(added);
+
+        // Gesperrte IP: ERR senden und danach schließen
+        if (!keep) {
+            if (!sessions_[fd]->onWritable()) {
+                closeSession(fd);
+            } else {
+                updateInterest(*sessions_[fd]);
+            }
+        }
+    }
+}
+
+// Neue Post für eine wartende Session (aus dem speichernden Thread)
+void EventLoop::notify(int fd) {
+    {
+        lock_guard<mutex> lock(mtx_);
+        notified_.push_back(fd);
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd_, &one, sizeof(one));
+    (void)ignored;
+}
+
+// Geweckte Sessions beantworten ihr WAIT (läuft im Loop-Thread). Ein fd kann inzwischen
+// zu einer neuen Session gehören; die wartet dann nicht und onNotify() tut nichts
+void EventLoop::processNotified() {
+    vector<int> batch;
+    {
+        lock_guard<mutex> lock(mtx_);
+        batch.swap(notified_);
+    }
+
+    for (int fd : batch) {
+        auto it = sessions_.find(fd);
+        if (it == sessions_.end()) {
+            continue;
+        }
+        ClientSession &session = *it->second;
+        session.onNotify();
+        if (!session.onWritable()) {
+            closeSession(fd);
+        } else {
+            updateInterest(session);
+            schedule(session);
+        }
+    }
+}
+
+// EPOLLOUT nur beobachten, solange tatsächlich Antwortdaten ausstehen; während WAIT
+// kein EPOLLIN, damit weitere Kommandos erst nach der WAIT-Antwort gelesen werden.
+// EPOLLRDHUP bleibt, damit ein Client, der während WAIT auflegt, nicht bis zur Frist parkt
+void EventLoop::updateInterest(ClientSession &session) {
+    epoll_event ev{};
+    ev.events = session.waiting() ? EPOLLRDHUP : EPOLLIN | EPOLLRDHUP;
+    if (session.hasPendingOutput()) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.fd = session.fd();
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, session.fd(), &ev);
+}
+
+void EventLoop::closeSession(int fd) {
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    if (sessions_.erase(fd) > 0) {
+        --stats_.activeSessions;
+    }
+}
+
+// Frist einer Session in den Heap eintragen (ohne aktives Limit nicht nötig)
+void EventLoop::schedule(ClientSession &session) {
+    ClientSession::Clock::time_point at = session.deadline();
+    if (at != ClientSession::Clock::time_point::max()) {
+        timers_.push({at, session.fd()});
+    }
+}
+
+// Millisekunden bis zur frühesten Frist, -1 wenn keine ansteht
+int EventLoop::nextTimeout() const {
+    if (timers_.empty()) {
+        return -1;
+    }
+    auto left = chrono::duration_cast<chrono::milliseconds>(
+        timers_.top().at - ClientSession::Clock::now()).count();
+    return left > 0 ? static_cast<int>(left) + 1 : 0;
+}
+
+// Fällige Heap-Einträge prüfen. Einträge sind nur Erinnerungen: hat sich die Frist einer
+// Session inzwischen verschoben, wird sie neu eingetragen; geschlossene Sessions fallen heraus
+void EventLoop::expireSessions() {
+    ClientSession::Clock::time_point now = ClientSession::Clock::now();
+    while (!timers_.empty() && timers_.top().at <= now) {
+        int fd = timers_.top().fd;
+        timers_.pop();
+
+        auto it = sessions_.find(fd);
+        if (it == sessions_.end()) {
+            continue;
+        }
+        ClientSession &session = *it->second;
+        if (session.deadline() > now) {
+            schedule(session);
+            continue;
+        }
+
+        // Abgelaufenes WAIT: leere Antwort senden, Session läuft weiter
+        if (session.expire()) {
+            if (!session.onWritable()) {
+                closeSession(fd);
+            } else {
+                updateInterest(session);
+                schedule(session);
+            }
+            continue;
+        }
+
+        // ERR nur, wenn es sofort in den Socket passt; danach in jedem Fall schließen
+        session.onWritable();
+        closeSession(fd);
+    }
+}
+
+// Haupt-Loop: auf Bereitschaft warten und die betroffenen Sessions weiterlaufen lassen
+void EventLoop::loop() {
+    epoll_event events[MAX_EVENTS];
+
+    while (!stopping_) {
+        int n = epoll_wait(epollFd_, events, MAX_EVENTS, nextTimeout());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+
+            if (fd == wakeFd_) {
+                uint64_t cnt;
+                ssize_t ignored = read(wakeFd_, &cnt, sizeof(cnt));
+                (void)ignored;
+                adoptIncoming();
+                processNotified();
+                continue;
+            }
+
+            auto it = sessions_.find(fd);
+            if (it == sessions_.end()) {
+                continue;
+            }
+            ClientSession &session = *it->second;
+            ClientSession::Clock::time_point before = session.deadline();
+
+            bool alive = true;
+            if (session.inWait() && (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                alive = false; // Client hat während WAIT aufgelegt
+            } else if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                alive = session.onReadable();
+            }
+            if (alive && (events[i].events & EPOLLOUT)) {
+                alive = session.onWritable();
+            }
+
+            if (!alive) {
+                closeSession(fd);
+            } else {
+                updateInterest(session);
+                // Vorgezogene Frist (z.B. Kommando- statt Leerlauf-Timeout) neu eintragen;
+                // spätere Fristen erkennt expireSessions() beim alten Eintrag
+                if (session.deadline() < before) {
+                    schedule(session);
+                }
+            }
+        }
+
+        expireSessions();
+    }
+
+    // Beim Stoppen alle verbliebenen Verbindungen schließen
+    for (auto &entry : sessions_) {
+        close(entry.first);
+        --stats_.activeSessions;
+    }
+    sessions_.clear();
+
+    // Auch noch nicht übernommene Verbindungen, die addSession() schon gezählt hat
+    lock_guard<mutex> lock(mtx_);
+    for (auto &session : incoming_) {
+        close(session->fd());
+        --stats_.activeSessions;
+    }
+    incoming_.clear();
+}
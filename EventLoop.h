@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class ClientSession;
+struct ServerStats;
+
+/// epoll-basierter Event-Loop für den Reaktor-Modus des Servers.
+/// Jeder Loop läuft in einem eigenen Thread und bedient beliebig viele
+/// nicht-blockierende Client-Sessions, statt pro Verbindung einen Thread zu belegen.
+/// Die Fristen aller Sessions eines Loops liegen in einem gemeinsamen Min-Heap, dessen
+/// frühester Eintrag den Timeout von epoll_wait() bestimmt (kein Timer pro Socket).
+class EventLoop {
+public:
+    /// @param stats Gemeinsame Serverzähler (aktive Sessions).
+    explicit EventLoop(ServerStats &stats);
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    /// Legt epoll- und Wakeup-Deskriptor an und startet den Loop-Thread.
+    /// @return true bei Erfolg.
+    bool start();
+
+    /// Übergibt eine neue Session an den Loop (thread-sicher, aus dem Accept-Thread).
+    /// Der Socket der Session muss bereits nicht-blockierend sein.
+    /// @param session Session, deren Besitz an den Loop übergeht.
+    void addSession(std::unique_ptr<ClientSession> session);
+
+    /// Beendet den Loop-Thread und schließt alle noch offenen Sessions.
+    void stop();
+
+private:
+    ServerStats &stats_;
+    int epollFd_ = -1;
+    int wakeFd_ = -1;
+    std::thread thread_;
+    std::atomic<bool> stopping_{false};
+
+    std::mutex mtx_;
+    std::vector<std::unique_ptr<ClientSession>> incoming_; // vom Accept-Thread übergeben
+    std::vector<int> notified_;                            // geweckte WAIT-Sessions (fd)
+
+    std::unordered_map<int, std::unique_ptr<ClientSession>> sessions_; // nur im Loop-Thread
+
+    /// Heap-Eintrag: spätestens zu diesem Zeitpunkt wird die Frist der Session geprüft.
+    struct Timer {
+        std::chrono::steady_clock::time_point at;
+        int fd;
+        bool operator>(const Timer &other) const { return at > other.at; }
+    };
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+
+    void loop();
+    void adoptIncoming();
+    void notify(int fd);
+    void processNotified();
+    void updateInterest(ClientSession &session);
+    void closeSession(int fd);
+    void schedule(ClientSession &session);
+    int nextTimeout() const;
+    void expireSessions();
+};
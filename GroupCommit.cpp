@@ -0,0 +1,71 @@
+#include "GroupCommit.h"
+#include "ServerStats.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+GroupCommit::GroupCommit(const string &dir, chrono::microseconds window, ServerStats &stats)
+    : window_(window), stats_(stats) {
+    dirFd_ = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd_ < 0) {
+        perror("open spool");
+    }
+}
+
+GroupCommit::~GroupCommit() {
+    if (dirFd_ >= 0) {
+        close(dirFd_);
+    }
+}
+
+bool GroupCommit::sync() {
+    if (dirFd_ < 0) {
+        return false;
+    }
+    auto start = chrono::steady_clock::now();
+    unique_lock<mutex> lock(mtx_);
+    uint64_t batch = openBatch_;
+    ++members_;
+    while (completed_ < batch) {
+        if (leading_) {
+            cv_.wait(lock);
+            continue;
+        }
+        // Anführer: erst weitere Mitglieder sammeln, dann für die ganze Gruppe synchronisieren
+        leading_ = true;
+        lock.unlock();
+        if (window_.count() > 0) {
+            this_thread::sleep_for(window_);
+        }
+        lock.lock();
+        uint64_t closing = openBatch_++;
+        size_t members = members_;
+        members_ = 0;
+        lock.unlock();
+
+        bool ok = syncfs(dirFd_) == 0;
+        if (!ok) {
+            perror("syncfs");
+        }
+        stats_.recordSyncBatch(members);
+
+        lock.lock();
+        completed_ = closing;
+        if (!ok) {
+            lastFailed_ = closing;
+        }
+        leading_ = false;
+        cv_.notify_all();
+    }
+    // Eine spätere gescheiterte Gruppe zählt mit: dann ist auch diese nicht sicher
+    bool ok = lastFailed_ < batch;
+    lock.unlock();
+
+    auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+    stats_.recordSyncWait(static_cast<uint64_t>(micros.count()));
+    return ok;
+}
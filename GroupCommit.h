@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+struct ServerStats;
+
+/// Gruppen-Commit für den durable-Modus des MailStore: statt eines fsync() pro
+/// Nachricht teilen sich gleichzeitig speichernde Threads einen syncfs() auf das
+/// Spool-Dateisystem. Wer sync() aufruft, während keiner synchronisiert, wird Anführer,
+/// wartet das Sammelfenster ab und synchronisiert für alle, die bis dahin dazukommen;
+/// wer während eines laufenden syncfs() kommt, gehört zur nächsten Gruppe.
+class GroupCommit {
+public:
+    /// @param dir Verzeichnis auf dem zu synchronisierenden Dateisystem (Spool).
+    /// @param window Sammelfenster des Anführers vor dem syncfs() (0 = sofort).
+    /// @param stats Zähler für Gruppen, deren Größe und die Wartezeiten.
+    GroupCommit(const std::string &dir, std::chrono::microseconds window, ServerStats &stats);
+    ~GroupCommit();
+
+    GroupCommit(const GroupCommit &) = delete;
+    GroupCommit &operator=(const GroupCommit &) = delete;
+
+    /// Blockiert, bis alles, was vor dem Aufruf geschrieben wurde (Daten und
+    /// Verzeichniseinträge), auf der Platte ist.
+    /// @return false, wenn das Verzeichnis nicht offen ist oder syncfs() scheiterte.
+    bool sync();
+
+private:
+    int dirFd_ = -1;
+    std::chrono::microseconds window_;
+    ServerStats &stats_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    uint64_t openBatch_ = 1;   // Gruppe, die gerade Mitglieder sammelt
+    uint64_t completed_ = 0;   // zuletzt abgeschlossene Gruppe
+    uint64_t lastFailed_ = 0;  // zuletzt gescheiterte Gruppe
+    size_t members_ = 0;       // Mitglieder der offenen Gruppe
+    bool leading_ = false;     // ein Anführer sammelt oder synchronisiert
+};
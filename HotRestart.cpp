@@ -0,0 +1,177 @@
+#include "HotRestart.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace {
+    constexpr const char *HANDOVER_ENV = "TWMAILER_HANDOVER_FD"; // fd des Socketpaars im neuen Prozess
+    constexpr size_t MAX_LISTENERS = 64;                         // mehr Acceptors gibt es nicht
+    constexpr const char READY_LINE[] = "READY\n";
+}
+
+using namespace std;
+
+HotRestart::~HotRestart() {
+    if (controlFd_ >= 0) {
+        close(controlFd_);
+    }
+}
+
+bool HotRestart::adoptListeners(vector<int> &listeners) {
+    const char *value = getenv(HANDOVER_ENV);
+    if (!value) {
+        return false;
+    }
+    int fd = atoi(value);
+    unsetenv(HANDOVER_ENV); // nicht an einen weiteren Neustart vererben
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    // Ein Byte Nutzdaten, die Listener stecken in der Control-Message
+    char byte;
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        perror("recvmsg(handover)");
+        close(fd);
+        return false;
+    }
+
+    for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const auto *fds = reinterpret_cast<const int *>(CMSG_DATA(c));
+        listeners.insert(listeners.end(), fds, fds + count);
+    }
+
+    if (listeners.empty()) {
+        close(fd);
+        return false;
+    }
+    controlFd_ = fd;
+    return true;
+}
+
+void HotRestart::notifyReady() {
+    if (controlFd_ < 0) {
+        return;
+    }
+    if (send(controlFd_, READY_LINE, sizeof(READY_LINE) - 1, MSG_NOSIGNAL) < 0) {
+        perror("send(handover)");
+    }
+    close(controlFd_);
+    controlFd_ = -1;
+}
+
+bool HotRestart::handOver(const vector<string> &args, const vector<int> &listeners, int timeoutSec) {
+    if (args.empty() || listeners.empty() || listeners.size() > MAX_LISTENERS) {
+        return false;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        perror("socketpair");
+        return false;
+    }
+
+    // argv und Umgebung vor fork() aufbauen: im Kind eines Prozesses mit
+    // mehreren Threads sind bis zum exec() nur async-signal-sichere Aufrufe erlaubt
+    vector<char *> argv;
+    for (const string &a : args) {
+        argv.push_back(const_cast<char *>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    string handoverVar = string(HANDOVER_ENV) + "=" + to_string(sv[1]);
+    size_t prefixLen = strlen(HANDOVER_ENV) + 1;
+    vector<char *> envp;
+    for (char **e = environ; *e; ++e) {
+        if (strncmp(*e, handoverVar.c_str(), prefixLen) != 0) {
+            envp.push_back(*e);
+        }
+    }
+    envp.push_back(const_cast<char *>(handoverVar.c_str()));
+    envp.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+    if (pid == 0) {
+        // Kind: nur das eigene Ende des Socketpaars überlebt exec()
+        fcntl(sv[1], F_SETFD, 0);
+        execve(argv[0], argv.data(), envp.data());
+        _exit(127);
+    }
+    close(sv[1]);
+
+    // Listener übergeben: ein Byte Nutzdaten plus alle fds als SCM_RIGHTS
+    char byte = 'L';
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * listeners.size());
+    cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * listeners.size());
+    memcpy(CMSG_DATA(c), listeners.data(), sizeof(int) * listeners.size());
+
+    bool ready = sendmsg(sv[0], &msg, MSG_NOSIGNAL) == 1;
+    if (!ready) {
+        perror("sendmsg(handover)");
+    }
+
+    // Auf "READY" warten; EOF bedeutet, dass der neue Prozess gescheitert ist
+    if (ready) {
+        pollfd pfd{sv[0], POLLIN, 0};
+        string line;
+        ready = false;
+        while (poll(&pfd, 1, timeoutSec * 1000) > 0) {
+            char buf[16];
+            ssize_t n = read(sv[0], buf, sizeof(buf));
+            if (n <= 0) {
+                break;
+            }
+            line.append(buf, static_cast<size_t>(n));
+            if (line.find('\n') != string::npos) {
+                ready = line == READY_LINE;
+                break;
+            }
+        }
+    }
+    close(sv[0]);
+
+    if (!ready) {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+    return ready;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/// Unterbrechungsfreier Neustart: Übergabe der Listening-Sockets an einen neu
+/// gestarteten Serverprozess.
+/// Der alte Prozess startet das (ggf. neue) Binary per fork()/exec() und schickt ihm die
+/// Listener über ein Unix-Socketpaar (SCM_RIGHTS). Der neue Prozess übernimmt sie statt
+/// selbst zu binden und meldet sich bereit; erst dann hört der alte Prozess auf anzunehmen.
+/// Der Port ist dadurch zu keinem Zeitpunkt geschlossen.
+class HotRestart {
+public:
+    HotRestart() = default;
+    ~HotRestart();
+
+    HotRestart(const HotRestart &) = delete;
+    HotRestart &operator=(const HotRestart &) = delete;
+
+    /// Neuer Prozess: übernimmt die Listener des Vorgängers, falls dieser Prozess
+    /// per Übergabe gestartet wurde (Umgebungsvariable gesetzt).
+    /// @param listeners Ausgabe: übernommene Listening-Sockets.
+    /// @return true, wenn Listener übernommen wurden; false bei normalem Start oder Fehler.
+    bool adoptListeners(std::vector<int> &listeners);
+
+    /// Neuer Prozess: meldet dem Vorgänger, dass Listener und Betriebsart laufen.
+    /// Ohne vorherige Übernahme passiert nichts.
+    void notifyReady();
+
+    /// Alter Prozess: startet args per fork()/exec(), übergibt die Listener und wartet
+    /// auf die Bereitschaftsmeldung.
+    /// @param args Kommandozeile des neuen Prozesses (args[0] = absoluter Programmpfad).
+    /// @param listeners Zu übergebende Listening-Sockets.
+    /// @param timeoutSec Maximale Wartezeit auf die Bereitschaftsmeldung.
+    /// @return true, wenn der neue Prozess bereit ist; bei false läuft der alte weiter.
+    static bool handOver(const std::vector<std::string> &args,
+                         const std::vector<int> &listeners,
+                         int timeoutSec);
+
+private:
+    int controlFd_ = -1; // Verbindung zum Vorgänger bis zur Bereitschaftsmeldung
+};
@@ -0,0 +1,124 @@
+#include "LineFramer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sys/socket.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+    constexpr size_t READ_CHUNK = 16384; // Mindestplatz für ein recv()
+    constexpr size_t TAKE_RESERVE = 1 << 20; // take(): höchstens so viel vorab reservieren
+}
+
+using namespace std;
+
+LineFramer::LineFramer(size_t maxLine) : maxLine_(maxLine) {}
+
+// Sucht '\n' blockweise: 32 bzw. 16 Bytes pro Vergleich, Rest per memchr
+const char *LineFramer::findNewline(const char *p, size_t n) {
+#if defined(__AVX2__)
+    const __m256i nl256 = _mm256_set1_epi8('\n');
+    while (n >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl256)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+        n -= 32;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i nl128 = _mm_set1_epi8('\n');
+    while (n >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl128)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+        n -= 16;
+    }
+#endif
+    return static_cast<const char *>(memchr(p, '\n', n));
+}
+
+// Platz für len weitere Bytes schaffen: erst nach vorne schieben, dann ggf. vergrößern
+char *LineFramer::reserve(size_t len) {
+    if (buf_.size() - end_ < len && start_ > 0) {
+        memmove(buf_.data(), buf_.data() + start_, end_ - start_);
+        end_ -= start_;
+        scanned_ -= start_;
+        start_ = 0;
+    }
+    if (buf_.size() - end_ < len) {
+        buf_.resize(end_ + len);
+    }
+    return buf_.data() + end_;
+}
+
+ssize_t LineFramer::fill(int fd, int flags) {
+    char *dst = reserve(READ_CHUNK);
+    ssize_t n = recv(fd, dst, buf_.size() - end_, flags);
+    if (n > 0) {
+        end_ += static_cast<size_t>(n);
+    }
+    return n;
+}
+
+void LineFramer::append(const char *data, size_t len) {
+    char *dst = reserve(len);
+    memcpy(dst, data, len);
+    end_ += len;
+}
+
+bool LineFramer::take(size_t n, string_view &block) {
+    size_t avail = end_ - start_;
+    if (avail < n) {
+        // Die Länge kommt vom Client: nur begrenzt vorab reservieren, der Rest wächst
+        // mit den tatsächlich empfangenen Daten
+        reserve(min(n - avail, TAKE_RESERVE));
+        return false;
+    }
+
+    block = string_view(buf_.data() + start_, n);
+    start_ += n;
+    scanned_ = max(scanned_, start_);
+    if (start_ == end_) {
+        start_ = end_ = scanned_ = 0; // Puffer leer → wieder vorne beginnen
+    }
+    return true;
+}
+
+LineFramer::Status LineFramer::next(string_view &line) {
+    if (scanned_ < start_) {
+        scanned_ = start_;
+    }
+
+    const char *nl = findNewline(buf_.data() + scanned_, end_ - scanned_);
+    if (!nl) {
+        scanned_ = end_; // beim nächsten Aufruf nur neue Bytes durchsuchen
+        return end_ - start_ > maxLine_ ? Status::TooLong : Status::NeedMore;
+    }
+
+    size_t lineEnd = static_cast<size_t>(nl - buf_.data());
+    if (lineEnd - start_ > maxLine_) {
+        return Status::TooLong;
+    }
+
+    size_t len = lineEnd - start_;
+    // Entferne \r falls vorhanden (Windows-Style)
+    if (len > 0 && buf_[lineEnd - 1] == '\r') {
+        --len;
+    }
+    line = string_view(buf_.data() + start_, len);
+
+    start_ = scanned_ = lineEnd + 1;
+    if (start_ == end_) {
+        start_ = end_ = scanned_ = 0; // Puffer leer → wieder vorne beginnen
+    }
+    return Status::Line;
+}
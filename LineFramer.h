@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+/// Gepufferter Zeilen-Framer für das textbasierte Protokoll, genutzt von Server und Client.
+/// Liest große Blöcke vom Socket in einen Puffer pro Verbindung und zerlegt ihn in
+/// \n-terminierte Zeilen. Die Suche nach dem Zeilenende läuft vektorisiert (SSE2/AVX2),
+/// die Zeilen werden als string_view direkt in den Puffer herausgegeben.
+class LineFramer {
+public:
+    /// Ergebnis von next().
+    enum class Status {
+        Line,     ///< eine vollständige Zeile wurde geliefert
+        NeedMore, ///< keine vollständige Zeile im Puffer
+        TooLong   ///< Zeile überschreitet die maximale Länge
+    };
+
+    static constexpr size_t DEFAULT_MAX_LINE = 64 * 1024;
+
+    /// @param maxLine Maximale Zeilenlänge in Bytes (ohne \n); begrenzt auch den Puffer.
+    explicit LineFramer(size_t maxLine = DEFAULT_MAX_LINE);
+
+    /// Liest einmal vom Socket in den Puffer.
+    /// @param fd Socket-Deskriptor.
+    /// @param flags Flags für recv(), z.B. MSG_DONTWAIT.
+    /// @return Anzahl gelesener Bytes, 0 bei EOF, -1 bei Fehler (errno gesetzt).
+    ssize_t fill(int fd, int flags = 0);
+
+    /// Hängt bereits empfangene Bytes an den Puffer an.
+    void append(const char *data, size_t len);
+
+    /// Liefert die nächste vollständige Zeile ohne \n und ohne abschließendes \r.
+    /// Die View bleibt gültig bis zum nächsten fill()/append().
+    /// @param line Ausgabe: die Zeile.
+    /// @return Status, siehe oben.
+    Status next(std::string_view &line);
+
+    /// Liefert genau n Bytes als Block (binärer Protokollmodus, Felder mit Längenpräfix).
+    /// Reichen die gepufferten Bytes nicht, wird Platz für den Block reserviert (höchstens
+    /// 1 MiB, die angekündigte Länge ist noch nicht belegt), damit die folgenden
+    /// fill()-Aufrufe ihn in wenigen großen Stücken lesen.
+    /// Die View bleibt gültig bis zum nächsten fill()/append().
+    /// @param n Größe des Blocks in Bytes.
+    /// @param block Ausgabe: der Block.
+    /// @return true, wenn der Block vollständig vorlag.
+    bool take(size_t n, std::string_view &block);
+
+    /// @return true, wenn die Zeile der Body-Terminator "." ist.
+    static bool isTerminator(std::string_view line) {
+        return line.size() == 1 && line[0] == '.';
+    }
+
+    /// @return Anzahl noch nicht ausgelieferter Bytes im Puffer.
+    size_t buffered() const { return end_ - start_; }
+
+    /// Sucht das erste '\n' im Bereich (vektorisiert, wo verfügbar).
+    /// @return Zeiger auf das '\n' oder nullptr.
+    static const char *findNewline(const char *p, size_t n);
+
+private:
+    std::vector<char> buf_;
+    size_t start_ = 0;   // Beginn der noch nicht ausgelieferten Daten
+    size_t end_ = 0;     // Ende der gültigen Daten
+    size_t scanned_ = 0; // bis hierhin ist sicher kein '\n' enthalten
+    size_t maxLine_;
+
+    char *reserve(size_t len);
+};
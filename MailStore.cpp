@@ -1,20 +1,74 @@
 #include "MailStore.h"
+#include "BodyCompressor.h"
+#include "MailboxIndex.h"
+#include "SegmentLog.h"
+#include "ServerStats.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <dirent.h>
+#include <fcntl.h>
+#include <functional>
+#include <signal.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 using namespace std;
+
 namespace {
-    // Hilfsfunktion: prüft, ob ein Pfad ein Verzeichnis ist
-    bool isDirectory(const string &path) {
+    constexpr const char *ID_COUNTER_NAME = "nextid"; // nächste Nachrichtennummer je Postfach
+    constexpr const char *TEMP_DIR_NAME = ".tmp"; // temporäre Dateien; kein gültiger Benutzername
+    constexpr int MAX_ID_PROBES = 16; // belegte Nummern in Folge, bevor neu gescannt wird
+    constexpr size_t MAX_KNOWN_IDS = 1024; // Zähler im Speicher je Stripe, darüber geleert
+
+    // Anhang an der Absenderzeile einer .msg-Datei mit komprimiertem Body. Benutzernamen
+    // enthalten kein Leerzeichen, ältere Dateien haben den Anhang also nie
+    constexpr const char *COMPRESSED_MARK = " z";
+    constexpr size_t COMPRESSED_MARK_SIZE = 2;
+
+    // Segment-Log kompaktieren, sobald gelöschte Nachrichten mindestens so viel Platz
+    // belegen wie gültige (und nicht wegen ein paar Bytes)
+    constexpr uint64_t COMPACT_MIN_DEAD_BYTES = 1 << 20;
+
+    bool needsCompaction(const LogPosition &end) {
+        return end.deadBytes >= COMPACT_MIN_DEAD_BYTES && end.deadBytes * 2 >= end.totalBytes;
+    }
+
+    // mtime einer Datei oder eines Verzeichnisses (Gültigkeit der Cache-Einträge); {} bei Fehler
+    timespec mtimeOf(const string &path) {
         struct stat st {};
-        return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        if (stat(path.c_str(), &st) < 0) {
+            return timespec{};
+        }
+        return st.st_mtim;
+    }
+
+    const IndexEntry *findEntry(const vector<IndexEntry> &entries, int id) {
+        auto it = lower_bound(entries.begin(), entries.end(), id,
+                              [](const IndexEntry &e, int value) { return e.id < value; });
+        return it != entries.end() && it->id == id ? &*it : nullptr;
+    }
+
+    // Bytes ab offset vollständig lesen (pread kann kürzer liefern)
+    bool readRange(int fd, off_t offset, string &out) {
+        size_t done = 0;
+        while (done < out.size()) {
+            ssize_t n = pread(fd, &out[done], out.size() - done, offset + static_cast<off_t>(done));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            done += static_cast<size_t>(n);
+        }
+        return true;
     }
-} 
+}
 
 // Username-Regeln: nicht leer, max 8 Zeichen, nur [a-z0-9]
 bool MailStore::isValidUsername(const string &u) {
@@ -30,8 +84,66 @@ bool MailStore::isValidUsername(const string &u) {
 }
 
 // Konstruktor: Basisverzeichnis setzen und sicherstellen, dass es existiert
-MailStore::MailStore(const string &baseDir) : baseDir_(baseDir) {
+MailStore::MailStore(const string &baseDir, StoreLayout layout, size_t cacheBudget,
+                     size_t bodyBudget, int syncWindowUs, bool compress, ServerStats &stats)
+    : baseDir_(baseDir), layout_(layout), compress_(compress), stats_(stats),
+      cache_(cacheBudget, stats),
+      bodies_(bodyBudget, stats) {
     mkdirIfNotExists(baseDir_);
+    if (syncWindowUs >= 0) {
+        commit_ = make_unique<GroupCommit>(baseDir_, chrono::microseconds(syncWindowUs), stats);
+    }
+    // Temporäre Dateien (nur Datei-Layout): durable-Modus und SEND an mehrere Empfänger
+    if (layout_ == StoreLayout::Files) {
+        string tempDir = baseDir_ + "/" + TEMP_DIR_NAME;
+        mkdirIfNotExists(tempDir);
+        removeStaleTempFiles(tempDir);
+    }
+    if (layout_ == StoreLayout::Segments) {
+        compactor_ = thread(&MailStore::runCompactor, this);
+    }
+}
+
+MailStore::~MailStore() {
+    {
+        lock_guard<mutex> lock(compactMtx_);
+        stopping_ = true;
+    }
+    compactCv_.notify_all();
+    if (compactor_.joinable()) {
+        compactor_.join();
+    }
+}
+
+// Übrig gebliebene temporäre Dateien abgestürzter Prozesse entfernen. Die Namen beginnen
+// mit der PID; Dateien eines noch laufenden Prozesses (Übergabe per SIGUSR2) bleiben
+void MailStore::removeStaleTempFiles(const string &tempDir) {
+    DIR *dir = opendir(tempDir.c_str());
+    if (!dir) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        pid_t pid = static_cast<pid_t>(atoi(entry->d_name));
+        if (pid <= 0 || (kill(pid, 0) < 0 && errno == ESRCH)) {
+            unlink((tempDir + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+}
+
+void MailStore::suspendCaches(chrono::steady_clock::time_point until) {
+    bodies_.suspend(until);
+    cache_.suspend(until);
+}
+
+// Stand eines Postfachs für den Cache: im Datei-Layout ändert jede neue oder gelöschte
+// .msg-Datei das Verzeichnis, im Segment-Layout jede Änderung den Index
+timespec MailStore::mailboxVersion(const string &userDir) const {
+    return mtimeOf(layout_ == StoreLayout::Files ? userDir : MailboxIndex::pathIn(userDir));
 }
 
 // Nachricht als Datei speichern: eine .msg Datei pro Mail
@@ -39,193 +151,1124 @@ bool MailStore::storeMessage(const string &sender,
                              const string &receiver,
                              const string &subject,
                              const string &body) {
-    // Sender/Empfänger validieren
-    if (!isValidUsername(receiver) || !isValidUsername(sender)) {
+    return storeMessage(sender, vector<string>{receiver}, subject, body);
+}
+
+// Nachricht an einen oder mehrere Empfänger speichern. Im Datei-Layout wird der Inhalt
+// dabei nur einmal geschrieben und per link() in jedes Postfach eingetragen
+bool MailStore::storeMessage(const string &sender,
+                             const vector<string> &receivers,
+                             const string &subject,
+                             const string &body) {
+    // Sender/Empfänger validieren (alle, bevor irgendetwas zugestellt wird)
+    if (receivers.empty() || !isValidUsername(sender)) {
+        return false;
+    }
+    for (const string &receiver : receivers) {
+        if (!isValidUsername(receiver)) {
+            return false;
+        }
+    }
+    // Frisch zugestellte Post wird meist gleich gelesen; alle Empfänger teilen sich
+    // denselben Eintrag
+    shared_ptr<const CachedMessage> message;
+    if (bodies_.fits(body.size())) {
+        message = make_shared<CachedMessage>(CachedMessage{sender, subject, body});
+    }
+
+    // Komprimieren, bevor eine Postfach-Sperre genommen wird; in die Postfächer kommen
+    // die komprimierten Bytes, in den BodyCache der Klartext
+    string packed;
+    bool compressed = compress_ && BodyCompressor::compress(body, packed);
+    const string &stored = compressed ? packed : body;
+    if (compress_) {
+        stats_.zipBodies += compressed ? 1 : 0;
+        stats_.zipPlain += body.size();
+        stats_.zipStored += stored.size();
+    }
+
+    vector<Delivery> deliveries(receivers.size());
+    if (layout_ == StoreLayout::Segments) {
+        // Jedes Postfach hat sein eigenes Log: ein Datensatz je Empfänger, aber nur ein
+        // Gruppen-Commit. Das Log wird nur angehängt: ein abgerissener Rest fällt beim
+        // Neuaufbau weg
+        for (size_t i = 0; i < receivers.size(); ++i) {
+            if (!storeSegmentMessage(sender, receivers[i], subject, stored, compressed,
+                                     deliveries[i])) {
+                rollBack(deliveries); // ganz oder gar nicht, siehe rollBack()
+                return false;
+            }
+        }
+        if (commit_ && !commit_->sync()) {
+            rollBack(deliveries);
+            return false;
+        }
+        publish(deliveries, message);
+        return true;
+    }
+
+    // Kopfzeile "Empfänger": bei mehreren die ganze Liste (wie ein To:-Header)
+    string header = receivers[0];
+    for (size_t i = 1; i < receivers.size(); ++i) {
+        header += "," + receivers[i];
+    }
+
+    // Temporäre Datei im durable-Modus: erst wenn der Inhalt auf der Platte ist, wird er
+    // unter seinem Namen sichtbar, nach einem Absturz gibt es die Nachricht dann ganz oder
+    // gar nicht. Bei mehreren Empfängern ist sie die gemeinsame Quelle der Links, die
+    // kein DEL eines Empfängers vorher entfernen kann
+    string tempPath;
+    if (commit_ || receivers.size() > 1) {
+        tempPath = baseDir_ + "/" + TEMP_DIR_NAME + "/" + to_string(getpid()) + "-"
+                   + to_string(++tempSeq_);
+        int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0 || !writeMessageFile(fd, sender, header, subject, stored, compressed) ||
+            (commit_ && !commit_->sync())) {
+            if (fd < 0) {
+                perror("open temp");
+            }
+            unlink(tempPath.c_str());
+            return false;
+        }
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < receivers.size(); ++i) {
+        if (!storeFileMessage(sender, receivers[i], header, subject, stored, compressed,
+                              tempPath, deliveries[i])) {
+            ok = false;
+            break;
+        }
+    }
+    if (ok && receivers.size() > 1) {
+        stats_.fanoutLinks += receivers.size() - 1;
+        stats_.fanoutSaved += (receivers.size() - 1) * stored.size();
+    }
+    if (!tempPath.empty()) {
+        // Die Links halten die Datei; neue Verzeichniseinträge: OK erst, wenn auch die
+        // Namen auf der Platte sind
+        unlink(tempPath.c_str());
+        ok = ok && (!commit_ || commit_->sync());
+    }
+    if (!ok) {
+        rollBack(deliveries);
         return false;
     }
+    publish(deliveries, message);
+    return true;
+}
+
+// Angelegte Nachrichten ankündigen: BodyCache und wartende WAIT-Sessions. Erst nach dem
+// Gruppen-Commit, damit niemand eine Nachricht liest, die ein Absturz noch löschen kann.
+// In den Cache nur, wenn seit dem Anlegen kein DEL auf die Sperre lief (wie cacheMessage())
+void MailStore::publish(const vector<Delivery> &deliveries,
+                        const shared_ptr<const CachedMessage> &message) {
+    for (const Delivery &delivery : deliveries) {
+        if (message) {
+            Stripe &stripe = stripeFor(delivery.receiver);
+            shared_lock<shared_mutex> lock(stripe.lock);
+            if (stripe.deletes.load() == delivery.deletes) {
+                bodies_.insert(delivery.receiver, delivery.id, message);
+            }
+        }
+        notifyWaiters(delivery.receiver, delivery.id);
+    }
+}
+
+// Schon angelegte Nachrichten wieder löschen, wenn SEND insgesamt mit ERR endet (ein
+// Empfänger gescheitert oder Gruppen-Commit fehlgeschlagen); sonst läge sie nach einer
+// Wiederholung des Clients doppelt in den Postfächern der übrigen
+void MailStore::rollBack(const vector<Delivery> &deliveries) {
+    for (const Delivery &delivery : deliveries) {
+        if (delivery.id > 0) {
+            deleteMessage(delivery.receiver, delivery.id);
+        }
+    }
+}
 
-    lock_guard<mutex> lock(mtx_);
+// Nachricht im Postfach eines Empfängers anlegen: ohne tempPath als neue Datei, sonst
+// als weiterer Link auf die fertig geschriebene temporäre Datei. body ist wie gespeichert
+// (komprimiert, wenn compressed)
+bool MailStore::storeFileMessage(const string &sender,
+                                 const string &receiver,
+                                 const string &header,
+                                 const string &subject,
+                                 const string &body,
+                                 bool compressed,
+                                 const string &tempPath,
+                                 Delivery &delivery) {
+    Stripe &stripe = stripeFor(receiver);
+    unique_lock<shared_mutex> lock(stripe.lock);
 
     // Benutzerverzeichnis anlegen (falls noch nicht vorhanden)
     string userDir = baseDir_ + "/" + receiver;
     mkdirIfNotExists(userDir);
 
-    // Nächste freie Message-ID ermitteln
-    int nextId = getNextMessageId(userDir);
-    if (nextId <= 0) {
-        return false;
+    // Index nur fortschreiben, wenn er vor dieser Nachricht aktuell war; sonst bleibt
+    // er veraltet und wird beim nächsten LIST neu aufgebaut
+    MailboxIndex index(userDir);
+    bool indexed = index.isFresh();
+    bool cached = cache_.contains(receiver);
+    timespec before = cached ? mailboxVersion(userDir) : timespec{};
+
+    // Nächste Message-ID reservieren und die Datei dazu anlegen, z.B. "base/receiver/1.msg";
+    // liegt der Inhalt schon in der temporären Datei, bekommt er nur seinen Namen
+    int nextId = 0;
+    if (!tempPath.empty()) {
+        if (!claimMessageId(stripe, receiver, userDir, nextId, [&](const string &filename) {
+                return link(tempPath.c_str(), filename.c_str()) == 0;
+            })) {
+            perror("link");
+            return false;
+        }
+    } else {
+        int fd = -1;
+        claimMessageId(stripe, receiver, userDir, nextId, [&](const string &filename) {
+            fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            return fd >= 0;
+        });
+        if (fd < 0 || !writeMessageFile(fd, sender, header, subject, body, compressed)) {
+            if (fd >= 0) {
+                unlink((userDir + "/" + to_string(nextId) + ".msg").c_str());
+            }
+            return false;
+        }
     }
 
-    // Dateiname z.B. "base/receiver/1.msg"
-    string filename = userDir + "/" + to_string(nextId) + ".msg";
-    FILE *f = fopen(filename.c_str(), "w");
+    IndexEntry entry;
+    entry.id = nextId;
+    entry.sender = sender;
+    entry.subject = subject;
+    entry.bodyOffset = sender.size() + (compressed ? COMPRESSED_MARK_SIZE : 0) + header.size()
+                       + subject.size() + 3;
+    entry.bodySize = body.size();
+    entry.compressed = compressed;
+    if (indexed) {
+        index.append(entry);
+    }
+    if (cached) {
+        cache_.add(receiver, before, mailboxVersion(userDir), move(entry));
+    }
+    delivery = Delivery{receiver, nextId, stripe.deletes.load()};
+    return true;
+}
+
+// Nachricht im Format der .msg-Dateien schreiben; schließt fd
+// 1: Sender (mit COMPRESSED_MARK, wenn der Body komprimiert ist)
+// 2: Empfänger
+// 3: Betreff
+// 4+: Body
+bool MailStore::writeMessageFile(int fd, const string &sender, const string &receiver,
+                                 const string &subject, const string &body, bool compressed) {
+    FILE *f = fdopen(fd, "w");
     if (!f) {
+        close(fd);
         return false;
     }
-
-    // Format:
-    // 1: Sender
-    // 2: Empfänger
-    // 3: Betreff
-    // 4+: Body
-    fprintf(f, "%s\n", sender.c_str());
+    fprintf(f, "%s%s\n", sender.c_str(), compressed ? COMPRESSED_MARK : "");
     fprintf(f, "%s\n", receiver.c_str());
     fprintf(f, "%s\n", subject.c_str());
 
-    if (!body.empty()) {
-        fprintf(f, "%s", body.c_str());
-        // Sicherstellen, dass der Body mit \n endet
-        if (body.back() != '\n') {
-            fprintf(f, "\n");
-        }
+    // Body unverändert schreiben (im Binärmodus auch ohne abschließendes \n oder mit
+    // Null-Bytes); die Textausgabe von READ ergänzt das \n bei Bedarf selbst
+    fwrite(body.data(), 1, body.size(), f);
+
+    bool ok = !ferror(f);
+    return fclose(f) == 0 && ok;
+}
+
+// Segment-Layout: Datensatz ans Log hängen, dann Index und Stand des Logs fortschreiben.
+// Die Nummer kommt wie im Datei-Layout aus dem Zähler, O_EXCL gibt es hier nicht; statt
+// dessen liegt sie mindestens hinter der höchsten Nummer im Index
+bool MailStore::storeSegmentMessage(const string &sender,
+                                    const string &receiver,
+                                    const string &subject,
+                                    const string &body,
+                                    bool compressed,
+                                    Delivery &delivery) {
+    Stripe &stripe = stripeFor(receiver);
+    unique_lock<shared_mutex> lock(stripe.lock);
+
+    string userDir = baseDir_ + "/" + receiver;
+    mkdirIfNotExists(userDir);
+
+    SegmentLog log(userDir);
+    MailboxIndex index(userDir);
+    if (!log.lock() || !loadSegmentIndex(log, index)) {
+        return false;
     }
+    bool cached = cache_.contains(receiver);
+    timespec before = cached ? mailboxVersion(userDir) : timespec{};
 
-    fclose(f);
+    int nextId = max(proposedId(stripe, receiver, userDir), index.lastId() + 1);
+
+    IndexEntry entry;
+    entry.id = nextId;
+    entry.sender = sender;
+    entry.subject = subject;
+    entry.compressed = compressed;
+    LogPosition end = index.position();
+    if (!log.append(end, entry, body)) {
+        return false;
+    }
+    // Scheitert der Index, ist er verworfen und wird beim nächsten Zugriff neu aufgebaut
+    if (index.append(entry)) {
+        index.setPosition(end);
+    }
+    rememberNextId(stripe, receiver, userDir, nextId + 1);
+
+    if (cached) {
+        cache_.add(receiver, before, mailboxVersion(userDir), move(entry));
+    }
+    delivery = Delivery{receiver, nextId, stripe.deletes.load()};
     return true;
 }
 
-// Liste der Betreffzeilen eines Users holen
+// Nummer vergeben und die .msg-Datei exklusiv anlegen (O_EXCL bzw. link()). Der Zähler
+// (proposedId()) ist nur ein Vorschlag: liegt er nach einem Absturz zurück oder hat ein
+// zweiter Prozess (Übergabe per SIGUSR2) die Nummer gerade vergeben, scheitert create mit
+// EEXIST und die nächste Nummer wird probiert
+bool MailStore::claimMessageId(Stripe &stripe, const string &username, const string &userDir,
+                               int &id, const function<bool(const string &filename)> &create) {
+    int next = proposedId(stripe, username, userDir);
+    if (next <= 0) {
+        next = getNextMessageId(userDir); // erster Zugriff ohne (gültigen) Zähler
+    }
+
+    for (int attempt = 0; attempt < 2 * MAX_ID_PROBES; ++attempt) {
+        string filename = userDir + "/" + to_string(next) + ".msg";
+        if (create(filename)) {
+            id = next;
+            rememberNextId(stripe, username, userDir, next + 1);
+            return true;
+        }
+        if (errno != EEXIST) {
+            return false;
+        }
+        ++next;
+        if (attempt + 1 == MAX_ID_PROBES) {
+            next = max(next, getNextMessageId(userDir)); // Zähler weit zurück → einmal scannen
+        }
+    }
+    return false;
+}
+
+// Nächste Nummer eines Postfachs: der größere Wert aus Speicher und Datei "nextid"; 0, wenn
+// beide fehlen. Die Datei wird bei jeder Vergabe gelesen (ein pread()): während einer
+// Übergabe per SIGUSR2 schreibt auch der zweite Prozess sie fort. Vergibt und löscht er eine
+// Nummer, gäbe der Zähler im Speicher sie sonst ein zweites Mal aus, und LIST SINCE bzw.
+// WAIT hinter dieser Nummer sähen die neue Nachricht nie
+int MailStore::proposedId(const Stripe &stripe, const string &username, const string &userDir) {
+    auto known = stripe.nextIds.find(username);
+    int next = readIdCounter(userDir);
+    return known != stripe.nextIds.end() ? max(next, known->second) : next;
+}
+
+// Gespeicherter Zähler eines Postfachs; 0, wenn er fehlt oder unlesbar ist
+int MailStore::readIdCounter(const string &userDir) {
+    string path = userDir + "/" + ID_COUNTER_NAME;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    char buf[16];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    buf[n] = '\0';
+    int value = atoi(buf);
+    return value > 0 ? value : 0;
+}
+
+// Zähler mit fester Breite überschreiben; ein halb geschriebener Wert wird beim
+// nächsten Start als ungültig erkannt oder per O_EXCL korrigiert
+void MailStore::writeIdCounter(const string &userDir, int next) {
+    string path = userDir + "/" + ID_COUNTER_NAME;
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    char buf[16];
+    int len = snprintf(buf, sizeof(buf), "%010d\n", next);
+    if (pwrite(fd, buf, static_cast<size_t>(len), 0) != len) {
+        perror("pwrite(nextid)");
+    }
+    close(fd);
+}
+
+// Zähler in Datei und Speicher fortschreiben. Der Speicher ist nur ein Cache vor der
+// Datei: wird er zu groß, wird er geleert und füllt sich mit den aktiven Postfächern neu
+void MailStore::rememberNextId(Stripe &stripe, const string &username, const string &userDir,
+                               int next) {
+    if (stripe.nextIds.size() >= MAX_KNOWN_IDS && stripe.nextIds.count(username) == 0) {
+        stripe.nextIds.clear();
+    }
+    stripe.nextIds[username] = next;
+    writeIdCounter(userDir, next);
+}
+
+uint64_t MailStore::addWaiter(const string &username, MailWaiter waiter) {
+    lock_guard<mutex> lock(waitMtx_);
+    uint64_t token = nextWaiter_++;
+    waiters_[username].emplace_back(token, move(waiter));
+    return token;
+}
+
+void MailStore::removeWaiter(const string &username, uint64_t token) {
+    lock_guard<mutex> lock(waitMtx_);
+    auto it = waiters_.find(username);
+    if (it == waiters_.end()) {
+        return;
+    }
+    auto &list = it->second;
+    list.erase(remove_if(list.begin(), list.end(),
+                         [token](const pair<uint64_t, MailWaiter> &w) { return w.first == token; }),
+               list.end());
+    if (list.empty()) {
+        waiters_.erase(it);
+    }
+}
+
+// Wartende des Empfängers wecken; unter waitMtx_, damit removeWaiter() danach
+// garantiert keinen laufenden Aufruf mehr übersieht
+void MailStore::notifyWaiters(const string &username, int msgNumber) {
+    lock_guard<mutex> lock(waitMtx_);
+    auto it = waiters_.find(username);
+    if (it == waiters_.end()) {
+        return;
+    }
+    for (auto &waiter : it->second) {
+        waiter.second(msgNumber);
+    }
+}
+
+// Liste der Betreffzeilen eines Users holen (ganzer Index als eine Seite)
 bool MailStore::listMessages(const string &username, vector<string> &subjects) {
     subjects.clear();
 
+    vector<MessageSummary> messages;
+    bool ok = listMessages(username, 0, 0, SIZE_MAX, messages);
+    subjects.reserve(messages.size());
+    for (MessageSummary &msg : messages) {
+        subjects.push_back(move(msg.subject));
+    }
+    return ok;
+}
+
+// Seitenweises Listing aus dem Postfach-Index; nur wenn er sich nicht aufbauen lässt
+// (z.B. Verzeichnis nicht beschreibbar), werden Dateinamen gescannt
+bool MailStore::listMessages(const string &username,
+                             int sinceId,
+                             size_t offset,
+                             size_t limit,
+                             vector<MessageSummary> &messages) {
+    messages.clear();
+
     if (!isValidUsername(username)) {
         return true; // Kein Fehler → einfach keine Mails
     }
 
-    lock_guard<mutex> lock(mtx_);
+    // Leser desselben Postfachs laufen parallel; nur ein Neuaufbau des Index schreibt
+    // und braucht die Sperre exklusiv
+    shared_mutex &mailboxLock = lockFor(username);
+    shared_lock<shared_mutex> reader(mailboxLock);
+    unique_lock<shared_mutex> writer(mailboxLock, defer_lock);
 
     string userDir = baseDir_ + "/" + username;
-    if (!isDirectory(userDir)) {
+    int dirFd = open(userDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) {
         return true; // User hat (noch) keinen Mail-Ordner
     }
 
-    DIR *dir = opendir(userDir.c_str());
-    if (!dir) {
+    shared_ptr<const vector<IndexEntry>> cached =
+        cache_.enabled() ? cache_.find(username, mailboxVersion(userDir)) : nullptr;
+    if (cached) {
+        pageEntries(*cached, sinceId, offset, limit, messages);
+        close(dirFd);
         return true;
     }
 
-    vector<int> ids;
-    struct dirent *entry;
+    MailboxIndex index(userDir);
+    SegmentLog log(userDir);
+    bool segments = layout_ == StoreLayout::Segments;
+    bool loaded = segments ? index.load(false) && log.isAt(index.position()) : index.load();
+    if (!loaded) {
+        reader.unlock();
+        writer.lock();
+        loaded = segments ? loadSegmentIndex(log, index) : loadIndex(dirFd, index);
+    }
+    if (!loaded && segments) {
+        // Ohne Index das ganze Log lesen (z.B. Verzeichnis nicht beschreibbar)
+        vector<IndexEntry> entries;
+        bool ok = scanSegments(userDir, entries);
+        pageEntries(entries, sinceId, offset, limit, messages);
+        close(dirFd);
+        return ok;
+    }
+    if (!loaded) {
+        bool ok = scanMessages(dirFd, sinceId, offset, limit, messages);
+        close(dirFd);
+        return ok;
+    }
 
-    // Alle *.msg Dateien einsammeln und IDs extrahieren
-    while ((entry = readdir(dir)) != nullptr) {
-        if (entry->d_type == DT_REG) { // reguläre Datei
-            string name = entry->d_name;
+    // Mit Cache das ganze Postfach einlesen und aufnehmen; die mtime erst danach
+    // bestimmen, da ein Neuaufbau des Index das Verzeichnis verändert
+    if (cache_.enabled()) {
+        vector<IndexEntry> entries;
+        readIndex(dirFd, index, entries);
+        pageEntries(entries, sinceId, offset, limit, messages);
+        cache_.insert(username, mailboxVersion(userDir), move(entries));
+        close(dirFd);
+        return true;
+    }
 
-            if (name.size() > 4 && name.substr(name.size() - 4) == ".msg") {
-                int id = atoi(name.substr(0, name.size() - 4).c_str());
-                if (id > 0) {
-                    ids.push_back(id);
-                }
-            }
+    size_t skipped = 0;
+    IndexEntry entry;
+    size_t i = sinceId < INT_MAX ? index.lowerBound(sinceId + 1) : index.records();
+    for (; i < index.records() && messages.size() < limit; ++i) {
+        if (!index.entry(i, entry) || skipped++ < offset) {
+            continue;
+        }
+        MessageSummary msg;
+        msg.id = entry.id;
+        msg.subject = move(entry.subject);
+        if (index.truncated(i) && !readSubject(dirFd, entry, msg.subject)) {
+            continue;
         }
+        messages.push_back(move(msg));
     }
-    closedir(dir);
+    close(dirFd);
+    return true;
+}
+
+// Alle gültigen Einträge des Index, gekürzte Betreffzeilen aus der Nachricht ergänzt
+void MailStore::readIndex(int dirFd, const MailboxIndex &index,
+                          vector<IndexEntry> &entries) const {
+    entries.reserve(index.records());
+    IndexEntry entry;
+    for (size_t i = 0; i < index.records(); ++i) {
+        if (!index.entry(i, entry)) {
+            continue;
+        }
+        if (index.truncated(i) && !readSubject(dirFd, entry, entry.subject)) {
+            continue;
+        }
+        entries.push_back(move(entry));
+    }
+}
+
+// Seite aus einer aufsteigend sortierten Eintragsliste
+void MailStore::pageEntries(const vector<IndexEntry> &entries, int sinceId, size_t offset,
+                            size_t limit, vector<MessageSummary> &messages) {
+    auto it = upper_bound(entries.begin(), entries.end(), sinceId,
+                          [](int id, const IndexEntry &e) { return id < e.id; });
+    size_t available = static_cast<size_t>(entries.end() - it);
+    if (offset >= available) {
+        return;
+    }
+    it += static_cast<ptrdiff_t>(offset);
+    size_t count = min(limit, available - offset);
+    messages.reserve(count);
+    for (size_t i = 0; i < count; ++i, ++it) {
+        messages.push_back(MessageSummary{it->id, it->subject});
+    }
+}
 
-    // Nachrichten IDs sortieren (aufsteigend)
+// Index abbilden; fehlt er oder ist er veraltet, aus den .msg-Dateien neu aufbauen
+// (Neuaufbau nur unter exklusiver Postfach-Sperre)
+bool MailStore::loadIndex(int dirFd, MailboxIndex &index) {
+    if (index.load()) {
+        return true;
+    }
+
+    vector<int> ids;
+    if (!scanIds(dirFd, 0, ids)) {
+        return false;
+    }
     sort(ids.begin(), ids.end());
 
-    // Für jede ID die Datei öffnen und nur den Betreff lesen
+    vector<IndexEntry> entries;
+    entries.reserve(ids.size());
     for (int id : ids) {
-        string filename = userDir + "/" + to_string(id) + ".msg";
-        FILE *f = fopen(filename.c_str(), "r");
-        if (!f) {
+        string name = to_string(id) + ".msg";
+        int fd = openat(dirFd, name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
             continue;
         }
+        IndexEntry entry;
+        string receiver;
+        MessageBody body;
+        if (!parseHeaders(fd, entry.sender, receiver, entry.subject, body)) {
+            continue; // parseHeaders() hat fd bereits geschlossen
+        }
+        close(body.fd);
+        entry.id = id;
+        entry.bodyOffset = static_cast<uint64_t>(body.offset);
+        entry.bodySize = body.length;
+        entry.compressed = body.compressed;
+        entries.push_back(move(entry));
+    }
+    return index.replace(entries) && index.load();
+}
 
-        char *line = nullptr;
-        size_t len = 0;
+// Segment-Layout: Index abbilden, wenn er bis zum Ende des Logs reicht; sonst das Log
+// unter flock durchlesen und den Index ersetzen (nur unter exklusiver Postfach-Sperre)
+bool MailStore::loadSegmentIndex(SegmentLog &log, MailboxIndex &index) {
+    if (index.load(false) && log.isAt(index.position())) {
+        return true;
+    }
+    vector<IndexEntry> entries;
+    LogPosition end;
+    if (!log.lock() || !log.scan(entries, end)) {
+        return false;
+    }
+    return index.replace(entries, end) && index.load(false);
+}
 
-        getline(&line, &len, f); // sender (ignoriert)
-        getline(&line, &len, f); // receiver (ignoriert)
-        ssize_t n = getline(&line, &len, f); // subject
+// Segment-Layout ohne Index: gültige Nachrichten direkt aus dem Log
+bool MailStore::scanSegments(const string &userDir, vector<IndexEntry> &entries) {
+    SegmentLog log(userDir);
+    LogPosition end;
+    log.lock(); // ohne Sperrdatei trotzdem lesen; abschneiden geht dann ohnehin nicht
+    return log.scan(entries, end);
+}
 
-        if (n > 0) {
-            string subject(line, static_cast<size_t>(n));
-            trimNewline(subject);
-            subjects.push_back(subject);
+// Alle Nummern > sinceId aus den Dateinamen des Postfachs (unsortiert)
+bool MailStore::scanIds(int dirFd, int sinceId, vector<int> &ids) {
+    int scanFd = dup(dirFd); // closedir() schließt den fd, dirFd wird noch gebraucht
+    DIR *dir = scanFd >= 0 ? fdopendir(scanFd) : nullptr;
+    if (!dir) {
+        if (scanFd >= 0) {
+            close(scanFd);
         }
+        return false;
+    }
 
-        if (line) {
-            free(line);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_type != DT_REG) {
+            continue;
         }
-        fclose(f);
+        string name = entry->d_name;
+        if (name.size() > 4 && name.substr(name.size() - 4) == ".msg") {
+            int id = atoi(name.substr(0, name.size() - 4).c_str());
+            if (id > sinceId) {
+                ids.push_back(id);
+            }
+        }
+    }
+    closedir(dir);
+    return true;
+}
+
+// Listing ohne Index: nur Dateinamen scannen, nur die Nachrichten der Seite öffnen
+bool MailStore::scanMessages(int dirFd, int sinceId, size_t offset, size_t limit,
+                             vector<MessageSummary> &messages) {
+    vector<int> ids;
+    if (!scanIds(dirFd, sinceId, ids)) {
+        return false;
     }
 
+    // Nur so weit sortieren, wie die Seite reicht
+    if (offset < ids.size()) {
+        size_t end = offset + min(limit, ids.size() - offset);
+        partial_sort(ids.begin(), ids.begin() + static_cast<ptrdiff_t>(end), ids.end());
+        for (size_t i = offset; i < end; ++i) {
+            MessageSummary msg;
+            msg.id = ids[i];
+            if (readSubject(dirFd, msg.id, msg.subject)) {
+                messages.push_back(move(msg));
+            }
+        }
+    }
     return true;
 }
 
-// Komplette Nachricht lesen (Sender, Empfänger, Betreff, Body)
+// Vollständiger Betreff zu einem gekürzten Indexeintrag, je nach Layout aus der .msg-Datei
+// oder aus dem Segment
+bool MailStore::readSubject(int dirFd, const IndexEntry &entry, string &subject) const {
+    if (layout_ == StoreLayout::Files) {
+        return readSubject(dirFd, entry.id, subject);
+    }
+    int fd = openat(dirFd, SegmentLog::fileName(entry.segment).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = SegmentLog::readSubject(fd, entry, subject);
+    close(fd);
+    return ok;
+}
+
+// Betreff (dritte Zeile) einer Nachricht relativ zum Postfach-fd lesen
+bool MailStore::readSubject(int dirFd, int id, string &subject) {
+    string name = to_string(id) + ".msg";
+    int fd = openat(dirFd, name.c_str(), O_RDONLY | O_CLOEXEC);
+    FILE *f = fd >= 0 ? fdopen(fd, "r") : nullptr;
+    if (!f) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    char *line = nullptr;
+    size_t len = 0;
+    getline(&line, &len, f); // sender (ignoriert)
+    getline(&line, &len, f); // receiver (ignoriert)
+    ssize_t n = getline(&line, &len, f); // subject
+    if (n > 0) {
+        subject.assign(line, static_cast<size_t>(n));
+        trimNewline(subject);
+    }
+    if (line) {
+        free(line);
+    }
+    fclose(f);
+    return n > 0;
+}
+
+// Komplette Nachricht lesen (Sender, Empfänger, Betreff, Body). Beide Layouts über
+// openMessage(): BodyCache und entpackte Bodies gelten so auch hier
 bool MailStore::readMessage(const string &username,
                             int msgNumber,
                             string &sender,
                             string &receiver,
                             string &subject,
                             string &body) {
+    body.clear();
+    MessageBody opened;
+    if (!openMessage(username, msgNumber, sender, receiver, subject, opened)) {
+        return false;
+    }
+    if (opened.data) {
+        body = *opened.data;
+        return true;
+    }
+    body.resize(opened.length);
+    bool ok = readRange(opened.fd, opened.offset, body);
+    close(opened.fd);
+    if (!ok) {
+        body.clear();
+    }
+    return ok;
+}
 
-    // Outputs vorab leeren
+// Nachricht zum Senden öffnen: nur Kopfzeilen parsen, Body bleibt in der Datei
+bool MailStore::openMessage(const string &username,
+                            int msgNumber,
+                            string &sender,
+                            string &receiver,
+                            string &subject,
+                            MessageBody &body) {
     sender.clear();
     receiver.clear();
     subject.clear();
-    body.clear();
+    body = MessageBody{};
 
     if (!isValidUsername(username) || msgNumber <= 0) {
         return false;
     }
+    if (shared_ptr<const CachedMessage> msg = bodies_.find(username, msgNumber)) {
+        sender = msg->sender;
+        receiver = username;
+        subject = msg->subject;
+        serveCached(move(msg), body);
+        return true;
+    }
 
-    lock_guard<mutex> lock(mtx_);
-
-    // Pfad zur konkreten Nachricht
-    string filename = baseDir_ + "/" + username + "/" + to_string(msgNumber) + ".msg";
-    FILE *f = fopen(filename.c_str(), "r");
-    if (!f) {
+    // Stand vor dem Öffnen: ein DEL danach darf die Nachricht nicht mehr im Cache finden
+    uint64_t deletes = stripeFor(username).deletes.load();
+    if (layout_ == StoreLayout::Segments) {
+        vector<OpenedMessage> opened;
+        if (!openSegmentMessages(username, {msgNumber}, opened) || opened.empty()) {
+            return false;
+        }
+        sender = move(opened[0].sender);
+        receiver = move(opened[0].receiver);
+        subject = move(opened[0].subject);
+        body = opened[0].body;
+    } else if (!openFileMessage(username, msgNumber, sender, receiver, subject, body)) {
         return false;
     }
+    cacheMessage(username, msgNumber, deletes, sender, subject, body);
+    return true;
+}
 
-    char *line = nullptr;
-    size_t len = 0;
-    ssize_t n;
+// Datei-Layout von openMessage(): Kopfzeilen aus dem Metadaten-Cache oder der Datei
+bool MailStore::openFileMessage(const string &username,
+                                int msgNumber,
+                                string &sender,
+                                string &receiver,
+                                string &subject,
+                                MessageBody &body) {
+    string userDir = baseDir_ + "/" + username;
+    string filename = userDir + "/" + to_string(msgNumber) + ".msg";
+    int fd;
+    IndexEntry cached;
+    bool hit = false;
+    {
+        // Nur das Öffnen geschieht unter der Sperre: eine fertig geschriebene
+        // .msg-Datei wird nie mehr verändert, ein DEL entfernt nur den Namen
+        shared_lock<shared_mutex> lock(lockFor(username));
+        shared_ptr<const vector<IndexEntry>> entries =
+            cache_.contains(username) ? cache_.find(username, mailboxVersion(userDir)) : nullptr;
+        if (entries) {
+            const IndexEntry *entry = findEntry(*entries, msgNumber);
+            if (!entry) {
+                return false; // Postfach ist gecacht und aktuell → Nachricht gibt es nicht
+            }
+            cached = *entry;
+            hit = true;
+        }
+        fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        return false;
+    }
 
-    // Zeile 1: Sender
-    n = getline(&line, &len, f);
-    if (n <= 0) {
-        fclose(f);
-        if (line) free(line);
+    if (hit) {
+        // Kopfzeilen aus dem Cache, die Datei liefert nur noch den Body
+        sender = move(cached.sender);
+        receiver = username;
+        subject = move(cached.subject);
+        describeBody(fd, cached, body);
+        return unpackBody(body);
+    }
+    // Geteilte Dateien tragen alle Empfänger; gemeldet wird wie aus dem Cache der Inhaber
+    if (!parseHeaders(fd, sender, receiver, subject, body)) {
         return false;
     }
-    sender.assign(line, static_cast<size_t>(n));
-    trimNewline(sender);
+    receiver = username;
+    return unpackBody(body);
+}
 
-    // Zeile 2: Empfänger
-    n = getline(&line, &len, f);
-    if (n <= 0) {
-        fclose(f);
-        if (line) free(line);
+// Gelesenen Body in den BodyCache aufnehmen und ab jetzt aus dem Speicher liefern.
+// Aufgenommen wird nur, wenn seit deletes kein DEL auf diese Sperre lief: sonst könnte
+// die Nachricht schon gelöscht sein und bliebe im Cache lesbar
+void MailStore::cacheMessage(const string &username, int msgNumber, uint64_t deletes,
+                             const string &sender, const string &subject, MessageBody &body) {
+    if (!bodies_.fits(body.length)) {
+        return; // großer Body → weiter per sendfile()
+    }
+    auto msg = make_shared<CachedMessage>();
+    msg->sender = sender;
+    msg->subject = subject;
+    if (body.data) {
+        msg->body = *body.data; // entpackter Body liegt schon im Speicher
+    } else {
+        msg->body.resize(body.length);
+        if (!readRange(body.fd, body.offset, msg->body)) {
+            return;
+        }
+        close(body.fd);
+    }
+    {
+        Stripe &stripe = stripeFor(username);
+        shared_lock<shared_mutex> lock(stripe.lock);
+        if (stripe.deletes.load() == deletes) {
+            bodies_.insert(username, msgNumber, msg);
+        }
+    }
+    serveCached(move(msg), body);
+}
+
+// Body eines Cache-Eintrags ausliefern; der Zeiger hält den Eintrag am Leben, auch wenn
+// er inzwischen verdrängt wurde
+void MailStore::serveCached(shared_ptr<const CachedMessage> msg, MessageBody &body) {
+    body = MessageBody{};
+    body.length = msg->body.size();
+    body.endsWithNewline = msg->body.empty() || msg->body.back() == '\n';
+    body.data = shared_ptr<const string>(msg, &msg->body);
+}
+
+// Gelöschte Nachrichten aus dem BodyCache entfernen (unter exklusiver Postfach-Sperre)
+void MailStore::forgetBodies(Stripe &stripe, const string &username, const vector<int> &ids) {
+    ++stripe.deletes;
+    bodies_.erase(username, ids);
+}
+
+// Mehrere Nachrichten öffnen: Treffer aus dem BodyCache, der Rest über das Layout
+bool MailStore::openMessages(const string &username,
+                             const vector<int> &msgNumbers,
+                             vector<OpenedMessage> &messages) {
+    messages.clear();
+    if (!isValidUsername(username)) {
         return false;
     }
-    receiver.assign(line, static_cast<size_t>(n));
-    trimNewline(receiver);
+    vector<OpenedMessage> hits;
+    vector<int> missing;
+    if (bodies_.enabled()) {
+        for (int id : msgNumbers) {
+            if (shared_ptr<const CachedMessage> msg = bodies_.find(username, id)) {
+                OpenedMessage hit;
+                hit.id = id;
+                hit.sender = msg->sender;
+                hit.receiver = username;
+                hit.subject = msg->subject;
+                serveCached(move(msg), hit.body);
+                hits.push_back(move(hit));
+            } else {
+                missing.push_back(id);
+            }
+        }
+    }
+    const vector<int> &wanted = bodies_.enabled() ? missing : msgNumbers;
+    vector<OpenedMessage> opened;
+    if (!wanted.empty()) {
+        if (layout_ == StoreLayout::Segments) {
+            openSegmentMessages(username, wanted, opened);
+        } else {
+            openFileMessages(username, wanted, opened);
+        }
+    }
+    if (hits.empty()) {
+        messages = move(opened);
+        return true;
+    }
 
-    // Zeile 3: Betreff
-    n = getline(&line, &len, f);
-    if (n <= 0) {
-        fclose(f);
-        if (line) free(line);
+    // Beide Teile sind aufsteigend sortiert
+    messages.reserve(hits.size() + opened.size());
+    size_t h = 0;
+    size_t o = 0;
+    while (h < hits.size() || o < opened.size()) {
+        if (o == opened.size() || (h < hits.size() && hits[h].id < opened[o].id)) {
+            messages.push_back(move(hits[h++]));
+        } else {
+            messages.push_back(move(opened[o++]));
+        }
+    }
+    return true;
+}
+
+// Datei-Layout von openMessages(): eine Sperre, ein Verzeichnisdurchlauf, openat()
+// relativ zum Postfach statt eines vollständigen Pfads pro Nachricht
+bool MailStore::openFileMessages(const string &username,
+                                 const vector<int> &msgNumbers,
+                                 vector<OpenedMessage> &messages) {
+    string userDir = baseDir_ + "/" + username;
+    vector<int> fds;
+    vector<int> ids;
+    vector<IndexEntry> cached; // bei Cache-Treffer: Metadaten passend zu ids
+    {
+        shared_lock<shared_mutex> lock(lockFor(username));
+        int dirFd = open(userDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) {
+            return true; // kein Postfach → keine Nachrichten
+        }
+        shared_ptr<const vector<IndexEntry>> entries =
+            cache_.contains(username) ? cache_.find(username, mailboxVersion(userDir)) : nullptr;
+        if (entries) {
+            // Vorhandene Nummern aus dem Cache statt per readdir()
+            for (int id : msgNumbers) {
+                if (const IndexEntry *entry = findEntry(*entries, id)) {
+                    ids.push_back(id);
+                    cached.push_back(*entry);
+                }
+            }
+        } else {
+            existingIds(dirFd, msgNumbers, ids);
+        }
+        for (int id : ids) {
+            string name = to_string(id) + ".msg";
+            fds.push_back(openat(dirFd, name.c_str(), O_RDONLY | O_CLOEXEC));
+        }
+        close(dirFd);
+    }
+
+    // Kopfzeilen außerhalb der Sperre lesen (fertige Dateien ändern sich nicht mehr)
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (fds[i] < 0) {
+            continue;
+        }
+        OpenedMessage msg;
+        msg.id = ids[i];
+        if (!cached.empty()) {
+            msg.sender = move(cached[i].sender);
+            msg.receiver = username;
+            msg.subject = move(cached[i].subject);
+            describeBody(fds[i], cached[i], msg.body);
+        } else if (parseHeaders(fds[i], msg.sender, msg.receiver, msg.subject, msg.body)) {
+            msg.receiver = username; // geteilte Dateien tragen alle Empfänger
+        } else {
+            continue;
+        }
+        if (unpackBody(msg.body)) {
+            messages.push_back(move(msg));
+        }
+    }
+    return true;
+}
+
+// Segment-Layout: Lage der Nachrichten aus Cache oder Index, ein fd pro Nachricht auf ihr
+// Segment. Gelesen wird außerhalb der Sperre; Datensätze werden nie überschrieben und
+// ein beim Kompaktieren entferntes Segment bleibt über den offenen fd lesbar
+bool MailStore::openSegmentMessages(const string &username,
+                                    const vector<int> &msgNumbers,
+                                    vector<OpenedMessage> &messages) {
+    string userDir = baseDir_ + "/" + username;
+    vector<IndexEntry> found;
+    vector<int> fds;
+    {
+        shared_mutex &mailboxLock = lockFor(username);
+        shared_lock<shared_mutex> reader(mailboxLock);
+        unique_lock<shared_mutex> writer(mailboxLock, defer_lock);
+
+        shared_ptr<const vector<IndexEntry>> entries =
+            cache_.contains(username) ? cache_.find(username, mailboxVersion(userDir)) : nullptr;
+        SegmentLog log(userDir);
+        if (entries) {
+            for (int id : msgNumbers) {
+                if (const IndexEntry *entry = findEntry(*entries, id)) {
+                    found.push_back(*entry);
+                }
+            }
+        } else {
+            MailboxIndex index(userDir);
+            bool loaded = index.load(false) && log.isAt(index.position());
+            if (!loaded) {
+                if (!log.exists()) {
+                    return true; // kein Postfach → keine Nachrichten
+                }
+                reader.unlock();
+                writer.lock();
+                loaded = loadSegmentIndex(log, index);
+            }
+            if (!loaded) {
+                vector<IndexEntry> all;
+                scanSegments(userDir, all);
+                for (int id : msgNumbers) {
+                    if (const IndexEntry *entry = findEntry(all, id)) {
+                        found.push_back(*entry);
+                    }
+                }
+            } else {
+                IndexEntry entry;
+                for (int id : msgNumbers) {
+                    size_t i = index.lowerBound(id);
+                    if (i < index.records() && index.entry(i, entry) && entry.id == id) {
+                        found.push_back(entry);
+                    }
+                }
+            }
+        }
+        for (const IndexEntry &entry : found) {
+            fds.push_back(log.open(entry.segment));
+        }
+    }
+
+    for (size_t i = 0; i < found.size(); ++i) {
+        if (fds[i] < 0) {
+            continue;
+        }
+        OpenedMessage msg;
+        msg.id = found[i].id;
+        // Im Index gekürzter Betreff → vollständig aus dem Datensatz
+        if (found[i].subjectSize > found[i].subject.size()
+            && !SegmentLog::readSubject(fds[i], found[i], found[i].subject)) {
+            close(fds[i]);
+            continue;
+        }
+        msg.sender = move(found[i].sender);
+        msg.receiver = username;
+        msg.subject = move(found[i].subject);
+        describeBody(fds[i], found[i], msg.body);
+        if (unpackBody(msg.body)) {
+            messages.push_back(move(msg));
+        }
+    }
+    return true;
+}
+
+// Kopfzeilen einer geöffneten .msg-Datei lesen und den Body als Dateiausschnitt
+// beschreiben; bei ungültiger Datei wird fd geschlossen
+bool MailStore::parseHeaders(int fd, string &sender, string &receiver, string &subject,
+                             MessageBody &body) {
+    struct stat st {};
+    if (fstat(fd, &st) < 0) {
+        close(fd);
         return false;
     }
-    subject.assign(line, static_cast<size_t>(n));
-    trimNewline(subject);
+    off_t size = st.st_size;
 
-    // Rest: Body (kann auch leer sein)
-    body.clear();
-    while ((n = getline(&line, &len, f)) > 0) {
-        body.append(line, static_cast<size_t>(n));
+    // Blockweise lesen, bis die drei Kopfzeilen vollständig sind
+    string *fields[3] = {&sender, &receiver, &subject};
+    int field = 0;
+    off_t pos = 0;
+    char buf[512];
+    while (field < 3) {
+        ssize_t n = pread(fd, buf, sizeof(buf), pos);
+        if (n <= 0) {
+            close(fd); // Datei endet vor dem Betreff → ungültige Nachricht
+            return false;
+        }
+        ssize_t i = 0;
+        while (i < n && field < 3) {
+            const char *nl = static_cast<const char *>(memchr(buf + i, '\n', static_cast<size_t>(n - i)));
+            size_t len = nl ? static_cast<size_t>(nl - (buf + i)) : static_cast<size_t>(n - i);
+            fields[field]->append(buf + i, len);
+            i += static_cast<ssize_t>(len);
+            if (nl) {
+                trimNewline(*fields[field]);
+                ++field;
+                ++i;
+            }
+        }
+        pos += i;
+    }
+    size_t markSize = COMPRESSED_MARK_SIZE;
+    if (sender.size() > markSize && sender.compare(sender.size() - markSize, markSize,
+                                                   COMPRESSED_MARK) == 0) {
+        sender.resize(sender.size() - markSize);
+        body.compressed = true;
     }
 
-    if (line) {
-        free(line);
+    body.fd = fd;
+    body.offset = pos;
+    body.length = static_cast<size_t>(size - pos);
+    if (body.length > 0 && !body.compressed) {
+        char last = '\n';
+        if (pread(fd, &last, 1, size - 1) == 1) {
+            body.endsWithNewline = last == '\n';
+        }
     }
-    fclose(f);
+    return true;
+}
+
+// Body-Ausschnitt aus gecachten Metadaten; nur das letzte Byte wird noch gelesen
+void MailStore::describeBody(int fd, const IndexEntry &entry, MessageBody &body) {
+    body.fd = fd;
+    body.offset = static_cast<off_t>(entry.bodyOffset);
+    body.length = static_cast<size_t>(entry.bodySize);
+    body.endsWithNewline = true;
+    body.compressed = entry.compressed;
+    if (body.length > 0 && !body.compressed) {
+        char last = '\n';
+        if (pread(fd, &last, 1, body.offset + static_cast<off_t>(body.length) - 1) == 1) {
+            body.endsWithNewline = last == '\n';
+        }
+    }
+}
+
+// Komprimierten Body lesen und entpackt aus dem Speicher liefern (außerhalb der Sperre,
+// die Datei ändert sich nicht mehr); schließt fd. Roher Body bleibt Dateiausschnitt
+bool MailStore::unpackBody(MessageBody &body) {
+    if (!body.compressed) {
+        return true;
+    }
+    string packed(body.length, '\0');
+    bool ok = readRange(body.fd, body.offset, packed);
+    close(body.fd);
+    auto plain = make_shared<string>();
+    if (!ok || !BodyCompressor::decompress(packed, *plain)) {
+        body = MessageBody{};
+        return false;
+    }
+    body = MessageBody{};
+    body.length = plain->size();
+    body.endsWithNewline = plain->empty() || plain->back() == '\n';
+    body.data = move(plain);
     return true;
 }
 
@@ -234,15 +1277,217 @@ bool MailStore::deleteMessage(const string &username, int msgNumber) {
     if (!isValidUsername(username) || msgNumber <= 0) {
         return false;
     }
+    if (layout_ == StoreLayout::Segments) {
+        size_t deleted = 0;
+        deleteSegmentMessages(username, {msgNumber}, deleted);
+        return deleted == 1;
+    }
+
+    Stripe &stripe = stripeFor(username);
+    unique_lock<shared_mutex> lock(stripe.lock);
 
-    lock_guard<mutex> lock(mtx_);
+    string userDir = baseDir_ + "/" + username;
+    MailboxIndex index(userDir);
+    bool indexed = index.load();
+    bool cached = cache_.contains(username);
+    timespec before = cached ? mailboxVersion(userDir) : timespec{};
 
-    string filename = baseDir_ + "/" + username + "/" + to_string(msgNumber) + ".msg";
+    string filename = userDir + "/" + to_string(msgNumber) + ".msg";
     int res = unlink(filename.c_str());
+    if (res == 0 && indexed) {
+        index.markDeleted(msgNumber);
+    }
+    if (res == 0 && cached) {
+        cache_.remove(username, before, mailboxVersion(userDir), {msgNumber});
+    }
+    if (res == 0) {
+        forgetBodies(stripe, username, {msgNumber});
+    }
 
     return (res == 0);
 }
 
+// Mehrere Nachrichten löschen: eine Sperre, ein Verzeichnisdurchlauf, unlinkat() nur
+// für tatsächlich vorhandene Nummern
+bool MailStore::deleteMessages(const string &username,
+                               const vector<int> &msgNumbers,
+                               size_t &deleted) {
+    deleted = 0;
+    if (!isValidUsername(username)) {
+        return false;
+    }
+    if (layout_ == StoreLayout::Segments) {
+        return deleteSegmentMessages(username, msgNumbers, deleted);
+    }
+
+    Stripe &stripe = stripeFor(username);
+    unique_lock<shared_mutex> lock(stripe.lock);
+
+    string userDir = baseDir_ + "/" + username;
+    int dirFd = open(userDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) {
+        return true;
+    }
+    MailboxIndex index(userDir);
+    bool indexed = index.load();
+    bool cached = cache_.contains(username);
+    timespec before = cached ? mailboxVersion(userDir) : timespec{};
+
+    vector<int> ids;
+    vector<int> removed;
+    existingIds(dirFd, msgNumbers, ids);
+    for (int id : ids) {
+        string name = to_string(id) + ".msg";
+        if (unlinkat(dirFd, name.c_str(), 0) == 0) {
+            removed.push_back(id);
+            indexed = indexed && index.markDeleted(id);
+        }
+    }
+    close(dirFd);
+    deleted = removed.size();
+    if (cached && !removed.empty()) {
+        cache_.remove(username, before, mailboxVersion(userDir), removed);
+    }
+    if (!removed.empty()) {
+        forgetBodies(stripe, username, removed);
+    }
+    return true;
+}
+
+// Segment-Layout: ein Löschdatensatz pro Nummer in einem write(), danach Löschmarken im
+// Index; der Platz wird erst vom Kompaktierungs-Thread zurückgewonnen
+bool MailStore::deleteSegmentMessages(const string &username,
+                                      const vector<int> &msgNumbers,
+                                      size_t &deleted) {
+    Stripe &stripe = stripeFor(username);
+    unique_lock<shared_mutex> lock(stripe.lock);
+
+    string userDir = baseDir_ + "/" + username;
+    SegmentLog log(userDir);
+    MailboxIndex index(userDir);
+    if (!log.exists() || !log.lock() || !loadSegmentIndex(log, index)) {
+        return true; // kein Postfach (oder nicht lesbar) → nichts gelöscht
+    }
+    bool cached = cache_.contains(username);
+    timespec before = cached ? mailboxVersion(userDir) : timespec{};
+
+    vector<int> ids;
+    LogPosition end = index.position();
+    uint64_t deadBytes = 0;
+    IndexEntry entry;
+    for (int id : msgNumbers) {
+        size_t i = index.lowerBound(id);
+        if (i < index.records() && index.entry(i, entry) && entry.id == id) {
+            ids.push_back(id);
+            deadBytes += SegmentLog::recordSize(entry);
+        }
+    }
+    if (ids.empty() || !log.appendTombstones(end, ids)) {
+        return true;
+    }
+    end.deadBytes += deadBytes;
+
+    bool indexed = true;
+    for (int id : ids) {
+        indexed = indexed && index.markDeleted(id);
+    }
+    if (indexed) {
+        index.setPosition(end);
+    }
+    deleted = ids.size();
+    if (cached) {
+        cache_.remove(username, before, mailboxVersion(userDir), ids);
+    }
+    forgetBodies(stripe, username, ids);
+    if (needsCompaction(end)) {
+        scheduleCompaction(username);
+    }
+    return true;
+}
+
+void MailStore::scheduleCompaction(const string &username) {
+    {
+        lock_guard<mutex> lock(compactMtx_);
+        if (find(compactQueue_.begin(), compactQueue_.end(), username) != compactQueue_.end()) {
+            return; // wartet schon
+        }
+        compactQueue_.push_back(username);
+    }
+    compactCv_.notify_one();
+}
+
+// Kompaktierungs-Thread: Postfächer nacheinander, bis der MailStore zerstört wird
+void MailStore::runCompactor() {
+    unique_lock<mutex> lock(compactMtx_);
+    while (true) {
+        compactCv_.wait(lock, [this] { return stopping_ || !compactQueue_.empty(); });
+        if (stopping_) {
+            return;
+        }
+        string username = move(compactQueue_.front());
+        compactQueue_.pop_front();
+        lock.unlock();
+        compactMailbox(username);
+        lock.lock();
+    }
+}
+
+// Gültige Nachrichten in neue Segmente kopieren, Index umstellen, alte Segmente löschen.
+// Läuft unter exklusiver Postfach-Sperre; ein Abbruch mittendrin hinterlässt höchstens
+// Kopien, die beim nächsten Neuaufbau des Index die Originale ersetzen
+void MailStore::compactMailbox(const string &username) {
+    unique_lock<shared_mutex> lock(lockFor(username));
+
+    string userDir = baseDir_ + "/" + username;
+    SegmentLog log(userDir);
+    MailboxIndex index(userDir);
+    if (!log.lock() || !loadSegmentIndex(log, index) || !needsCompaction(index.position())) {
+        return;
+    }
+
+    vector<IndexEntry> entries;
+    entries.reserve(index.records());
+    IndexEntry entry;
+    for (size_t i = 0; i < index.records(); ++i) {
+        if (index.entry(i, entry)) {
+            entries.push_back(move(entry));
+        }
+    }
+    LogPosition end = index.position();
+    uint32_t first = log.compact(entries, end);
+    if (first == 0 || !index.replace(entries, end)) {
+        return; // alte Segmente und Index bleiben gültig
+    }
+    log.removeBefore(first);
+    cache_.forget(username); // verweist noch auf die alten Segmente
+}
+
+// Ein Durchlauf über das Postfach: welche der gewünschten (sortierten) Nummern gibt es?
+// Große, dünn besetzte Bereiche wie "1-10000" kosten so keine Systemaufrufe pro Nummer
+bool MailStore::existingIds(int dirFd, const vector<int> &wanted, vector<int> &found) {
+    found.clear();
+    vector<int> ids;
+    if (!scanIds(dirFd, 0, ids)) {
+        return false;
+    }
+    for (int id : ids) {
+        if (binary_search(wanted.begin(), wanted.end(), id)) {
+            found.push_back(id);
+        }
+    }
+    sort(found.begin(), found.end());
+    return true;
+}
+
+// Sperre des Postfachs: Benutzer werden per Hash auf einen festen Satz Sperren verteilt
+MailStore::Stripe &MailStore::stripeFor(const string &username) const {
+    return stripes_[hash<string>{}(username) % LOCK_STRIPES];
+}
+
+shared_mutex &MailStore::lockFor(const string &username) const {
+    return stripeFor(username).lock;
+}
+
 // Entfernt trailing \n / \r aus einem String
 void MailStore::trimNewline(string &s) {
     while (!s.empty() && (s.back() == '\n' || s.back() == '\r')) {
@@ -258,7 +1503,7 @@ void MailStore::mkdirIfNotExists(const string &path) {
     }
 }
 
-// Ermittelt die nächste freie Message-ID im Nutzerverzeichnis
+// Ermittelt die nächste freie Message-ID per Verzeichnisscan (nur ohne gültigen Zähler)
 int MailStore::getNextMessageId(const string &userDir) {
     DIR *dir = opendir(userDir.c_str());
 
@@ -281,3 +1526,126 @@ int MailStore::getNextMessageId(const string &userDir) {
     // Nächste ID ist maxId + 1 (startet bei 1)
     return maxId + 1;
 }
+
+// Alle Postfächer des Spools nacheinander konvertieren; Fehler einzelner Postfächer
+// brechen den Lauf nicht ab
+bool MailStore::convertSpool(const string &baseDir, StoreLayout layout) {
+    DIR *dir = opendir(baseDir.c_str());
+    if (!dir) {
+        perror("opendir(spool)");
+        return false;
+    }
+    vector<string> users;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_type == DT_DIR && isValidUsername(entry->d_name)) {
+            users.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+
+    bool ok = true;
+    for (const string &username : users) {
+        string userDir = baseDir + "/" + username;
+        bool converted = layout == StoreLayout::Segments ? convertToSegments(userDir)
+                                                         : convertToFiles(userDir, username);
+        if (!converted) {
+            fprintf(stderr, "Postfach %s konnte nicht konvertiert werden\n", username.c_str());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// .msg-Dateien in aufsteigender Nummer ans Log hängen, Index aus dem Log aufbauen und
+// erst danach die Dateien löschen. Nach einem Abbruch stehen Nachrichten doppelt im Log;
+// beim Wiederholen gewinnt jeweils der spätere Datensatz
+bool MailStore::convertToSegments(const string &userDir) {
+    int dirFd = open(userDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) {
+        return false;
+    }
+    vector<int> ids;
+    SegmentLog log(userDir);
+    vector<IndexEntry> entries;
+    LogPosition end;
+    if (!scanIds(dirFd, 0, ids) || !log.lock() || !log.scan(entries, end)) {
+        close(dirFd);
+        return false;
+    }
+    sort(ids.begin(), ids.end());
+
+    bool ok = true;
+    for (int id : ids) {
+        string name = to_string(id) + ".msg";
+        int fd = openat(dirFd, name.c_str(), O_RDONLY | O_CLOEXEC);
+        IndexEntry msg;
+        string receiver;
+        MessageBody file;
+        if (fd < 0 || !parseHeaders(fd, msg.sender, receiver, msg.subject, file)) {
+            continue; // ungültige Datei bleibt liegen
+        }
+        IndexEntry location;
+        location.bodyOffset = static_cast<uint64_t>(file.offset);
+        location.bodySize = file.length;
+        string body;
+        msg.id = id;
+        msg.compressed = file.compressed; // Bytes werden unverändert übernommen
+        ok = SegmentLog::readBody(file.fd, location, body) && log.append(end, msg, body);
+        close(file.fd);
+        if (!ok) {
+            break;
+        }
+    }
+
+    MailboxIndex index(userDir);
+    ok = ok && log.scan(entries, end) && index.replace(entries, end);
+    if (ok) {
+        for (const IndexEntry &msg : entries) {
+            unlinkat(dirFd, (to_string(msg.id) + ".msg").c_str(), 0);
+        }
+        int last = entries.empty() ? 0 : entries.back().id;
+        writeIdCounter(userDir, max(readIdCounter(userDir), last + 1));
+    }
+    close(dirFd);
+    return ok;
+}
+
+// Gültige Nachrichten des Logs als .msg-Dateien schreiben, dann Segmente und Index löschen
+bool MailStore::convertToFiles(const string &userDir, const string &username) {
+    SegmentLog log(userDir);
+    if (!log.exists()) {
+        return true; // schon im Datei-Layout
+    }
+    vector<IndexEntry> entries;
+    LogPosition end;
+    if (!log.lock() || !log.scan(entries, end)) {
+        return false;
+    }
+
+    for (const IndexEntry &msg : entries) {
+        string body;
+        int segFd = log.open(msg.segment);
+        bool ok = segFd >= 0 && SegmentLog::readBody(segFd, msg, body);
+        if (segFd >= 0) {
+            close(segFd);
+        }
+        string filename = userDir + "/" + to_string(msg.id) + ".msg";
+        FILE *f = ok ? fopen(filename.c_str(), "w") : nullptr;
+        if (!f) {
+            return false;
+        }
+        fprintf(f, "%s%s\n%s\n%s\n", msg.sender.c_str(), msg.compressed ? COMPRESSED_MARK : "",
+                username.c_str(), msg.subject.c_str());
+        ok = fwrite(body.data(), 1, body.size(), f) == body.size();
+        if (fclose(f) != 0 || !ok) {
+            return false;
+        }
+    }
+
+    MailboxIndex(userDir).discard();
+    log.removeAll();
+    int last = entries.empty() ? 0 : entries.back().id;
+    writeIdCounter(userDir, max(readIdCounter(userDir), last + 1));
+    return true;
+}
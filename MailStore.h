@@ -1,18 +1,109 @@
 #pragma once
 
+#include "BodyCache.h"
+#include "GroupCommit.h"
+#include "MailboxCache.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+class SegmentLog;
+
+/// Ablage der Nachrichten im Spool-Verzeichnis.
+enum class StoreLayout {
+    Files,    ///< eine Datei "<id>.msg" pro Nachricht
+    Segments  ///< Segment-Log pro Postfach (SegmentLog) mit Hintergrund-Kompaktierung
+};
+
+/// Body einer geöffneten Nachricht: Ausschnitt einer Datei, der direkt
+/// (z.B. per sendfile) zum Client übertragen werden kann, oder Bytes aus dem BodyCache.
+struct MessageBody {
+    int fd = -1;                  ///< offene Datei, muss vom Aufrufer geschlossen werden
+    off_t offset = 0;             ///< Beginn des Bodys in der Datei
+    size_t length = 0;            ///< Länge des Bodys in Bytes
+    bool endsWithNewline = true;  ///< letztes Body-Byte ist ein '\n' (oder Body leer)
+    std::shared_ptr<const std::string> data; ///< Body im Speicher (dann fd = -1)
+    bool compressed = false;      ///< nur intern: Dateiausschnitt ist komprimiert (-Z)
+};
+
+/// Eine per openMessages() geöffnete Nachricht eines Batches.
+struct OpenedMessage {
+    int id = 0;                   ///< Nachrichtennummer
+    std::string sender;
+    std::string receiver;
+    std::string subject;
+    MessageBody body;             ///< Dateiausschnitt (fd schließen) oder Body im Speicher
+};
+
+/// Eintrag eines seitenweisen Listings: Nachrichtennummer und Betreff.
+struct MessageSummary {
+    int id = 0;
+    std::string subject;
+};
+
 /// Klasse zur Verwaltung der Mail-Speicherung im Dateisystem.
 /// Verantwortlich für das Anlegen, Auflisten, Lesen und Löschen von Nachrichten je Benutzer.
+/// Je nach StoreLayout liegt jede Nachricht in einer eigenen Datei oder alle Nachrichten
+/// eines Postfachs in dessen Segment-Log; nach außen (Nummern, Reihenfolge, Inhalt)
+/// verhalten sich beide gleich.
+/// Gesperrt wird pro Postfach (Lock-Striping über den Hash des Benutzernamens): Zugriffe
+/// auf verschiedene Benutzer laufen parallel, LIST/READ eines Postfachs teilen sich die
+/// Sperre und schließen nur SEND/DEL auf dasselbe Postfach aus.
+/// Häufig gelesene Nachrichten hält der BodyCache vollständig im Speicher.
+/// Mit compress werden neue Bodies per BodyCompressor komprimiert abgelegt; die
+/// Kopfzeilen bleiben Klartext und unkomprimierte Nachrichten bleiben lesbar.
 class MailStore {
 public:
     /// Erzeugt einen MailStore unterhalb des angegebenen Basisverzeichnisses.
     /// @param baseDir Verzeichnis, in dem alle Benutzerdaten abgelegt werden.
-    explicit MailStore(const std::string &baseDir);
+    /// @param layout Ablage der Nachrichten; Segments startet den Kompaktierungs-Thread.
+    /// @param cacheBudget Speicherbudget des Metadaten-Caches in Bytes (0 = aus).
+    /// @param bodyBudget Speicherbudget des BodyCache in Bytes (0 = aus).
+    /// @param syncWindowUs durable-Modus: Sammelfenster des Gruppen-Commits in µs
+    ///                     (-1 = aus, Nachrichten ohne fsync).
+    /// @param compress Neue Bodies komprimiert ablegen, wenn es sich lohnt.
+    /// @param stats Zähler für Treffer und Fehlschläge der Caches, den Gruppen-Commit
+    ///              und die Kompression.
+    MailStore(const std::string &baseDir, StoreLayout layout, size_t cacheBudget,
+              size_t bodyBudget, int syncWindowUs, bool compress, ServerStats &stats);
+
+    /// Beendet den Kompaktierungs-Thread (eine laufende Kompaktierung wird abgeschlossen).
+    ~MailStore();
+
+    MailStore(const MailStore &) = delete;
+    MailStore &operator=(const MailStore &) = delete;
 
-    /// Speichert eine Nachricht im Postfach des Empfängers.
+    /// Konvertiert alle Postfächer eines Spools in das angegebene Layout. Nummern und
+    /// Zähler bleiben erhalten; die alte Ablage wird erst nach dem vollständigen Schreiben
+    /// der neuen entfernt, ein abgebrochener Lauf kann daher wiederholt werden.
+    /// Nur bei gestopptem Server aufrufen.
+    /// @param baseDir Spool-Verzeichnis.
+    /// @param layout Ziel-Layout.
+    /// @return false, wenn ein Postfach nicht konvertiert werden konnte.
+    static bool convertSpool(const std::string &baseDir, StoreLayout layout);
+
+    /// Speichert eine Nachricht im Postfach des Empfängers. Die Nummer kommt aus einem
+    /// gespeicherten Zähler je Postfach (kein Verzeichnisscan); nach dem Löschen der
+    /// höchsten Nummer wird sie nicht erneut vergeben, solange der Zähler stimmt. Hinkt er
+    /// nach einem Absturz nach, kann die Nummer einer gelöschten Nachricht wiederkehren.
+    /// Im durable-Modus wird der Inhalt erst in eine temporäre Datei geschrieben und
+    /// synchronisiert, dann per link() unter seiner Nummer sichtbar; true kommt erst, wenn
+    /// auch der Verzeichniseintrag auf der Platte ist (Gruppen-Commit mit anderen SENDs).
+    /// BodyCache und WAIT-Sessions erfahren erst danach von der Nachricht; scheitert der
+    /// Gruppen-Commit, wird sie wieder gelöscht.
     /// @param sender Absenderkennung (aus der eingeloggten Sitzung).
     /// @param receiver Empfängername.
     /// @param subject Betreffzeile der Nachricht.
@@ -23,6 +114,24 @@ public:
                       const std::string &subject,
                       const std::string &body);
 
+    /// Speichert eine Nachricht für mehrere Empfänger. Im Datei-Layout wird der Inhalt
+    /// einmal in eine temporäre Datei geschrieben und per link() in jedes Postfach
+    /// eingetragen; alle Empfänger teilen sich die Datei, DEL entfernt nur den eigenen
+    /// Namen und der Platz wird mit dem letzten frei. Im Segment-Layout bekommt jedes
+    /// Log einen eigenen Datensatz. Die Kopfzeile "Empfänger" der Datei enthält die
+    /// ganze Liste; READ meldet als Empfänger immer den Postfachinhaber.
+    /// @param sender Absenderkennung (aus der eingeloggten Sitzung).
+    /// @param receivers Empfängernamen, ohne Duplikate.
+    /// @param subject Betreffzeile der Nachricht.
+    /// @param body Kompletter Nachrichtentext.
+    /// @return true, wenn alle Empfänger die Nachricht haben; false bei einem ungültigen
+    ///         Namen (dann bekommt sie keiner) oder einem Schreibfehler (dann fehlt sie
+    ///         ab dem betroffenen Empfänger).
+    bool storeMessage(const std::string &sender,
+                      const std::vector<std::string> &receivers,
+                      const std::string &subject,
+                      const std::string &body);
+
     /// Listet alle Betreffzeilen des Benutzers auf.
     /// @param username Benutzer, dessen Posteingang gelesen werden soll.
     /// @param subjects Ausgabevektor für die Betreffzeilen.
@@ -30,6 +139,22 @@ public:
     bool listMessages(const std::string &username,
                       std::vector<std::string> &subjects);
 
+    /// Listet einen Ausschnitt des Postfachs mit Nummern auf. Gelesen wird nur der
+    /// Postfach-Index (MailboxIndex); fehlt er oder ist er veraltet, wird er einmal aus
+    /// den .msg-Dateien bzw. dem Segment-Log neu aufgebaut. Ohne Index (z.B. Verzeichnis nicht beschreibbar)
+    /// werden nur die Dateinamen gescannt und die Nachrichten der Seite geöffnet.
+    /// @param username Benutzer, dessen Posteingang gelesen werden soll.
+    /// @param sinceId Nur Nachrichten mit größerer Nummer (0 = alle).
+    /// @param offset Anzahl zu überspringender Nachrichten (nach sinceId, aufsteigend).
+    /// @param limit Maximale Anzahl zurückgegebener Nachrichten.
+    /// @param messages Ausgabe: Nummern und Betreffzeilen, aufsteigend nach Nummer.
+    /// @return true, wenn das Listing erfolgreich erstellt werden konnte.
+    bool listMessages(const std::string &username,
+                      int sinceId,
+                      size_t offset,
+                      size_t limit,
+                      std::vector<MessageSummary> &messages);
+
     /// Liest eine einzelne Nachricht aus dem Postfach.
     /// @param username Benutzer, dessen Postfach durchsucht wird.
     /// @param msgNumber Nummer der Nachricht (1-basiert entsprechend Dateibenennung).
@@ -45,6 +170,40 @@ public:
                      std::string &subject,
                      std::string &body);
 
+    /// Öffnet eine Nachricht zum Senden, ohne den Body zu lesen.
+    /// Nur die drei Kopfzeilen werden geparst; der Body bleibt in der Datei und wird
+    /// als Dateiausschnitt zurückgegeben. Die Postfach-Sperre wird nur für open() gehalten.
+    /// Ein komprimierter Body wird außerhalb der Sperre entpackt und aus dem Speicher
+    /// geliefert.
+    /// Passt der Body in den BodyCache, wird er dort aufgenommen und aus dem Speicher
+    /// geliefert; bei einem Treffer wird gar keine Datei geöffnet.
+    /// @param username Benutzer, dessen Postfach durchsucht wird.
+    /// @param msgNumber Nummer der Nachricht.
+    /// @param sender Ausgabefeld für den Absender.
+    /// @param receiver Ausgabefeld für den Empfänger.
+    /// @param subject Ausgabefeld für den Betreff.
+    /// @param body Ausgabe: Dateiausschnitt des Bodys (fd muss geschlossen werden) oder
+    ///             Body im Speicher.
+    /// @return true, wenn die Nachricht geöffnet werden konnte.
+    bool openMessage(const std::string &username,
+                     int msgNumber,
+                     std::string &sender,
+                     std::string &receiver,
+                     std::string &subject,
+                     MessageBody &body);
+
+    /// Öffnet mehrere Nachrichten wie openMessage(), aber mit einer einzigen Sperre und
+    /// einem Durchlauf über das Postfachverzeichnis. Nicht vorhandene Nummern werden
+    /// übersprungen. Treffer im BodyCache werden genutzt, aufgenommen wird aber nichts:
+    /// ein Batch ist meist ein Export und soll die heißen Nachrichten nicht verdrängen.
+    /// @param username Benutzer, dessen Postfach durchsucht wird.
+    /// @param msgNumbers Gewünschte Nummern, aufsteigend sortiert und ohne Duplikate.
+    /// @param messages Ausgabe: geöffnete Nachrichten in aufsteigender Reihenfolge.
+    /// @return false bei ungültigem Benutzernamen.
+    bool openMessages(const std::string &username,
+                      const std::vector<int> &msgNumbers,
+                      std::vector<OpenedMessage> &messages);
+
     /// Löscht eine Nachricht dauerhaft.
     /// @param username Benutzer, dessen Nachricht entfernt werden soll.
     /// @param msgNumber Nummer der Nachricht.
@@ -52,12 +211,144 @@ public:
     bool deleteMessage(const std::string &username,
                        int msgNumber);
 
+    /// Löscht mehrere Nachrichten mit einer einzigen Sperre und einem Durchlauf über
+    /// das Postfachverzeichnis. Nicht vorhandene Nummern werden übersprungen.
+    /// @param username Benutzer, dessen Nachrichten entfernt werden sollen.
+    /// @param msgNumbers Zu löschende Nummern, aufsteigend sortiert und ohne Duplikate.
+    /// @param deleted Ausgabe: Anzahl tatsächlich gelöschter Nachrichten.
+    /// @return false bei ungültigem Benutzernamen.
+    bool deleteMessages(const std::string &username,
+                        const std::vector<int> &msgNumbers,
+                        size_t &deleted);
+
+    /// @return true im durable-Modus (SEND bestätigt erst nach dem Gruppen-Commit).
+    bool durable() const { return commit_ != nullptr; }
+
+    /// Setzt BodyCache und Metadaten-Cache aus, solange ein zweiter Prozess am selben
+    /// Spool arbeitet (Übergabe per SIGUSR2): dessen DEL würde einen Body hier nicht
+    /// entfernen, und seine Änderungen im selben mtime-Tick sähe der Metadaten-Cache nicht.
+    /// @param until Ende der Überlappung; time_point::max() für den abgebenden Prozess.
+    void suspendCaches(std::chrono::steady_clock::time_point until);
+
+    /// Benachrichtigung bei neuer Post (WAIT). Wird von storeMessage() aus dem
+    /// speichernden Thread aufgerufen und muss daher kurz und thread-sicher sein;
+    /// sie darf den MailStore nicht erneut aufrufen.
+    using MailWaiter = std::function<void(int msgNumber)>;
+
+    /// Meldet Interesse an neuen Nachrichten eines Benutzers an. Kein eigener Thread:
+    /// der Eintrag wird nur beim Zustellen an diesen Benutzer aufgerufen.
+    /// @param username Benutzer, auf dessen Post gewartet wird.
+    /// @param waiter Aufruf pro neu gespeicherter Nachricht.
+    /// @return Kennung für removeWaiter().
+    uint64_t addWaiter(const std::string &username, MailWaiter waiter);
+
+    /// Meldet einen Wartenden ab. Nach der Rückkehr läuft kein Aufruf mehr.
+    /// @param username Benutzer wie bei addWaiter().
+    /// @param token Kennung aus addWaiter().
+    void removeWaiter(const std::string &username, uint64_t token);
+
 private:
+    static constexpr size_t LOCK_STRIPES = 64;
+
+    // Postfach-Sperre und Nummernzähler der Benutzer, die auf diese Sperre fallen
+    struct Stripe {
+        std::shared_mutex lock;
+        std::unordered_map<std::string, int> nextIds; // nur unter exklusiver lock, begrenzt
+        std::atomic<uint64_t> deletes{0}; // Löschvorgänge, erhöht nur unter exklusiver lock
+    };
+
+    // Angelegte, aber noch nicht angekündigte Nachricht eines Empfängers (publish())
+    struct Delivery {
+        std::string receiver;
+        int id = 0;
+        uint64_t deletes = 0; // Stand von Stripe::deletes beim Anlegen
+    };
+
     std::string baseDir_;
-    mutable std::mutex mtx_;
+    StoreLayout layout_;
+    bool compress_;
+    ServerStats &stats_;
+    mutable Stripe stripes_[LOCK_STRIPES]; // siehe stripeFor()
+    MailboxCache cache_;
+    BodyCache bodies_;
+    std::unique_ptr<GroupCommit> commit_; // nur im durable-Modus
+    std::atomic<uint64_t> tempSeq_{0};    // Namen der temporären Dateien
+
+    // Postfächer mit viel totem Platz im Segment-Log, abgearbeitet von compactor_
+    std::mutex compactMtx_;
+    std::condition_variable compactCv_;
+    std::deque<std::string> compactQueue_;
+    bool stopping_ = false;
+    std::thread compactor_;
+
+    // Wartende Sessions je Benutzer (eigene Sperre, damit WAIT den Store nicht blockiert)
+    std::mutex waitMtx_;
+    std::unordered_map<std::string, std::vector<std::pair<uint64_t, MailWaiter>>> waiters_;
+    uint64_t nextWaiter_ = 1;
+
+    void notifyWaiters(const std::string &username, int msgNumber);
+    timespec mailboxVersion(const std::string &userDir) const;
+    bool readSubject(int dirFd, const IndexEntry &entry, std::string &subject) const;
+    bool openFileMessage(const std::string &username, int msgNumber, std::string &sender,
+                         std::string &receiver, std::string &subject, MessageBody &body);
+    bool openFileMessages(const std::string &username, const std::vector<int> &msgNumbers,
+                          std::vector<OpenedMessage> &messages);
+    void cacheMessage(const std::string &username, int msgNumber, uint64_t deletes,
+                      const std::string &sender, const std::string &subject, MessageBody &body);
+    void forgetBodies(Stripe &stripe, const std::string &username, const std::vector<int> &ids);
+    static void serveCached(std::shared_ptr<const CachedMessage> msg, MessageBody &body);
+    bool storeFileMessage(const std::string &sender, const std::string &receiver,
+                          const std::string &header, const std::string &subject,
+                          const std::string &body, bool compressed,
+                          const std::string &tempPath, Delivery &delivery);
+    bool storeSegmentMessage(const std::string &sender, const std::string &receiver,
+                             const std::string &subject, const std::string &body,
+                             bool compressed, Delivery &delivery);
+    void publish(const std::vector<Delivery> &deliveries,
+                 const std::shared_ptr<const CachedMessage> &message);
+    void rollBack(const std::vector<Delivery> &deliveries);
+    bool openSegmentMessages(const std::string &username, const std::vector<int> &msgNumbers,
+                             std::vector<OpenedMessage> &messages);
+    bool deleteSegmentMessages(const std::string &username, const std::vector<int> &msgNumbers,
+                               size_t &deleted);
+    void scheduleCompaction(const std::string &username);
+    void runCompactor();
+    void compactMailbox(const std::string &username);
+    Stripe &stripeFor(const std::string &username) const;
+    std::shared_mutex &lockFor(const std::string &username) const;
+    static bool claimMessageId(Stripe &stripe, const std::string &username,
+                               const std::string &userDir, int &id,
+                               const std::function<bool(const std::string &filename)> &create);
+    static bool writeMessageFile(int fd, const std::string &sender, const std::string &receiver,
+                                 const std::string &subject, const std::string &body,
+                                 bool compressed);
+    static void removeStaleTempFiles(const std::string &tempDir);
+    static int proposedId(const Stripe &stripe, const std::string &username,
+                          const std::string &userDir);
+    static int readIdCounter(const std::string &userDir);
+    static void writeIdCounter(const std::string &userDir, int next);
+    static void rememberNextId(Stripe &stripe, const std::string &username,
+                               const std::string &userDir, int next);
 
     static bool isValidUsername(const std::string &u);
     static void trimNewline(std::string &s);
     static void mkdirIfNotExists(const std::string &path);
     static int getNextMessageId(const std::string &userDir);
+    static bool existingIds(int dirFd, const std::vector<int> &wanted, std::vector<int> &found);
+    static bool readSubject(int dirFd, int id, std::string &subject);
+    static bool scanIds(int dirFd, int sinceId, std::vector<int> &ids);
+    static bool scanMessages(int dirFd, int sinceId, size_t offset, size_t limit,
+                             std::vector<MessageSummary> &messages);
+    static bool loadIndex(int dirFd, MailboxIndex &index);
+    static bool loadSegmentIndex(SegmentLog &log, MailboxIndex &index);
+    static bool scanSegments(const std::string &userDir, std::vector<IndexEntry> &entries);
+    static bool convertToSegments(const std::string &userDir);
+    static bool convertToFiles(const std::string &userDir, const std::string &username);
+    void readIndex(int dirFd, const MailboxIndex &index, std::vector<IndexEntry> &entries) const;
+    static void pageEntries(const std::vector<IndexEntry> &entries, int sinceId, size_t offset,
+                            size_t limit, std::vector<MessageSummary> &messages);
+    static void describeBody(int fd, const IndexEntry &entry, MessageBody &body);
+    static bool unpackBody(MessageBody &body);
+    static bool parseHeaders(int fd, std::string &sender, std::string &receiver,
+                             std::string &subject, MessageBody &body);
 };
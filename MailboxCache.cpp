@@ -0,0 +1,169 @@
+#include "MailboxCache.h"
+#include "ServerStats.h"
+
+#include <algorithm>
+
+namespace {
+    constexpr size_t MAILBOX_OVERHEAD = 128; // Map-Knoten, LRU-Knoten, Vektorkopf
+
+    size_t entryBytes(const IndexEntry &e) {
+        return sizeof(IndexEntry) + e.sender.size() + e.subject.size();
+    }
+
+    bool sameTime(const timespec &a, const timespec &b) {
+        return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+    }
+}
+
+using namespace std;
+
+MailboxCache::MailboxCache(size_t budget, ServerStats &stats) : budget_(budget), stats_(stats) {}
+
+bool MailboxCache::suspended() const {
+    int64_t until = suspendedUntil_.load(memory_order_relaxed);
+    return until != 0 && chrono::steady_clock::now().time_since_epoch().count() < until;
+}
+
+void MailboxCache::suspend(chrono::steady_clock::time_point until) {
+    suspendedUntil_.store(until.time_since_epoch().count(), memory_order_relaxed);
+    lock_guard<mutex> lock(mtx_);
+    while (!mailboxes_.empty()) {
+        erase(mailboxes_.begin());
+    }
+}
+
+bool MailboxCache::contains(const string &username) const {
+    lock_guard<mutex> lock(mtx_);
+    return mailboxes_.count(username) > 0;
+}
+
+shared_ptr<const vector<IndexEntry>> MailboxCache::find(const string &username,
+                                                        const timespec &dirMtime) {
+    if (!enabled()) {
+        return nullptr;
+    }
+    lock_guard<mutex> lock(mtx_);
+    auto it = mailboxes_.find(username);
+    if (it == mailboxes_.end() || !sameTime(it->second.dirMtime, dirMtime)) {
+        if (it != mailboxes_.end()) {
+            erase(it); // Verzeichnis wurde von außen verändert
+        }
+        ++stats_.cacheMisses;
+        return nullptr;
+    }
+    ++stats_.cacheHits;
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    return it->second.messages;
+}
+
+void MailboxCache::insert(const string &username, const timespec &dirMtime,
+                          vector<IndexEntry> messages) {
+    if (!enabled()) {
+        return;
+    }
+    size_t bytes = MAILBOX_OVERHEAD + username.size();
+    for (const IndexEntry &e : messages) {
+        bytes += entryBytes(e);
+    }
+    if (bytes > budget_) {
+        return; // passt nie hinein, andere Postfächer nicht umsonst verdrängen
+    }
+
+    lock_guard<mutex> lock(mtx_);
+    if (suspended()) {
+        return; // suspend() kam zwischen Lesen und Aufnahme
+    }
+    auto old = mailboxes_.find(username);
+    if (old != mailboxes_.end()) {
+        erase(old);
+    }
+
+    lru_.push_front(username);
+    Mailbox &box = mailboxes_[username];
+    box.messages = make_shared<vector<IndexEntry>>(move(messages));
+    box.dirMtime = dirMtime;
+    box.lru = lru_.begin();
+    resize(box, bytes);
+    evict();
+}
+
+// Gecachtes Postfach, sofern es vor der Änderung noch aktuell war; sonst verwerfen
+MailboxCache::Mailbox *MailboxCache::current(const string &username, const timespec &before) {
+    auto it = mailboxes_.find(username);
+    if (it == mailboxes_.end()) {
+        return nullptr;
+    }
+    if (!sameTime(it->second.dirMtime, before)) {
+        erase(it);
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void MailboxCache::add(const string &username, const timespec &before, const timespec &after,
+                       IndexEntry message) {
+    lock_guard<mutex> lock(mtx_);
+    Mailbox *box = current(username, before);
+    if (!box) {
+        return;
+    }
+    size_t bytes = box->bytes + entryBytes(message);
+    // Nummern werden aufsteigend vergeben; nach gelöschter Höchstnummer ggf. wieder dieselbe
+    auto &messages = *box->messages;
+    auto pos = upper_bound(messages.begin(), messages.end(), message.id,
+                           [](int id, const IndexEntry &e) { return id < e.id; });
+    messages.insert(pos, move(message));
+    box->dirMtime = after;
+    resize(*box, bytes);
+    evict();
+}
+
+void MailboxCache::remove(const string &username, const timespec &before, const timespec &after,
+                          const vector<int> &ids) {
+    lock_guard<mutex> lock(mtx_);
+    Mailbox *box = current(username, before);
+    if (!box) {
+        return;
+    }
+    size_t bytes = box->bytes;
+    auto &messages = *box->messages;
+    messages.erase(remove_if(messages.begin(), messages.end(),
+                             [&](const IndexEntry &e) {
+                                 if (!binary_search(ids.begin(), ids.end(), e.id)) {
+                                     return false;
+                                 }
+                                 bytes -= entryBytes(e);
+                                 return true;
+                             }),
+                   messages.end());
+    box->dirMtime = after;
+    resize(*box, bytes);
+}
+
+void MailboxCache::forget(const string &username) {
+    lock_guard<mutex> lock(mtx_);
+    auto it = mailboxes_.find(username);
+    if (it != mailboxes_.end()) {
+        erase(it);
+    }
+}
+
+void MailboxCache::erase(unordered_map<string, Mailbox>::iterator it) {
+    resize(it->second, 0);
+    lru_.erase(it->second.lru);
+    mailboxes_.erase(it);
+}
+
+void MailboxCache::resize(Mailbox &box, size_t bytes) {
+    used_ = used_ - box.bytes + bytes;
+    box.bytes = bytes;
+    stats_.cacheBytes = used_;
+}
+
+// Am längsten unbenutzte Postfächer verdrängen, bis das Budget wieder reicht
+void MailboxCache::evict() {
+    while (used_ > budget_ && !lru_.empty()) {
+        erase(mailboxes_.find(lru_.back()));
+        ++stats_.cacheEvictions;
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "MailboxIndex.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ServerStats;
+
+/// Prozessweiter Cache der Postfach-Metadaten (Nummern, Absender, Betreff, Lage des
+/// Bodys) für LIST und READ. Ein Postfach wird erst beim ersten LIST aufgenommen und
+/// danach von storeMessage()/deleteMessage() fortgeschrieben; wenig genutzte Postfächer
+/// fliegen nach LRU heraus, sobald das Speicherbudget überschritten ist.
+/// Ein Eintrag gilt nur, solange sich die mtime des Benutzerverzeichnisses (im
+/// Segment-Layout: des Postfach-Index) nicht ohne den MailStore geändert hat (z.B. durch
+/// eine von Hand abgelegte .msg-Datei). Die mtime hat nur die Auflösung eines Timer-Ticks;
+/// eine Änderung eines zweiten Prozesses im selben Tick bliebe unbemerkt, daher suspend()
+/// während einer Übergabe per SIGUSR2.
+/// Thread-sicher mit einer eigenen, nur kurz gehaltenen Sperre. Leser erhalten einen
+/// gemeinsam genutzten Schnappschuss; add()/remove() verändern ihn an Ort und Stelle und
+/// verlassen sich darauf, dass der MailStore Leser desselben Postfachs dabei per
+/// Postfach-Sperre ausschließt.
+class MailboxCache {
+public:
+    /// @param budget Speicherbudget in Bytes (0 = Cache aus).
+    /// @param stats Zähler für Treffer, Fehlschläge, Verdrängungen und Größe.
+    MailboxCache(size_t budget, ServerStats &stats);
+
+    /// @return true, wenn der Cache ein Budget hat und nicht ausgesetzt ist.
+    bool enabled() const { return budget_ > 0 && !suspended(); }
+
+    /// Leert den Cache und setzt ihn bis until aus (keine Treffer, keine Aufnahme).
+    /// @param until Ende der Pause; time_point::max() = für immer.
+    void suspend(std::chrono::steady_clock::time_point until);
+
+    /// @return true, wenn das Postfach gecacht ist (ohne Prüfung der Aktualität).
+    ///         Erlaubt es, den stat() auf das Verzeichnis für kalte Postfächer zu sparen.
+    bool contains(const std::string &username) const;
+
+    /// Sucht ein Postfach; zählt Treffer bzw. Fehlschlag.
+    /// @param username Benutzer.
+    /// @param dirMtime Aktuelle mtime des Benutzerverzeichnisses.
+    /// @return Nachrichten aufsteigend nach Nummer oder nullptr, wenn das Postfach nicht
+    ///         (mehr) gecacht ist. Bleibt auch nach einer Verdrängung gültig.
+    std::shared_ptr<const std::vector<IndexEntry>> find(const std::string &username,
+                                                        const timespec &dirMtime);
+
+    /// Nimmt ein vollständig gelesenes Postfach auf (ersetzt einen alten Eintrag).
+    /// Postfächer über dem gesamten Budget werden nicht aufgenommen.
+    /// @param username Benutzer.
+    /// @param dirMtime mtime des Verzeichnisses, zu der messages gelesen wurde.
+    /// @param messages Nachrichten aufsteigend nach Nummer.
+    void insert(const std::string &username, const timespec &dirMtime,
+                std::vector<IndexEntry> messages);
+
+    /// Trägt eine neu gespeicherte Nachricht ein, falls das Postfach gecacht ist.
+    /// @param before mtime des Verzeichnisses vor dem Speichern; weicht der Eintrag
+    ///        davon ab, wird er verworfen statt fortgeschrieben.
+    /// @param after mtime nach dem Speichern.
+    void add(const std::string &username, const timespec &before, const timespec &after,
+             IndexEntry message);
+
+    /// Verwirft ein Postfach, dessen Nachrichten umgezogen sind (Kompaktierung).
+    void forget(const std::string &username);
+
+    /// Entfernt gelöschte Nachrichten, falls das Postfach gecacht ist.
+    /// @param before mtime des Verzeichnisses vor dem Löschen (siehe add()).
+    /// @param after mtime nach dem Löschen.
+    /// @param ids Gelöschte Nummern, aufsteigend sortiert.
+    void remove(const std::string &username, const timespec &before, const timespec &after,
+                const std::vector<int> &ids);
+
+private:
+    struct Mailbox {
+        std::shared_ptr<std::vector<IndexEntry>> messages;
+        timespec dirMtime{};
+        size_t bytes = 0;
+        std::list<std::string>::iterator lru;
+    };
+
+    size_t budget_;
+    std::atomic<int64_t> suspendedUntil_{0}; // steady_clock-Ticks, 0 = nicht ausgesetzt
+    mutable std::mutex mtx_;
+    size_t used_ = 0;
+    ServerStats &stats_;
+    std::list<std::string> lru_; // vorne = zuletzt benutzt
+    std::unordered_map<std::string, Mailbox> mailboxes_;
+
+    bool suspended() const;
+    Mailbox *current(const std::string &username, const timespec &before);
+    void erase(std::unordered_map<std::string, Mailbox>::iterator it);
+    void resize(Mailbox &box, size_t bytes);
+    void evict();
+};
@@ -0,0 +1,362 @@
+#include "MailboxIndex.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    constexpr const char *INDEX_NAME = "mailbox.idx";
+    constexpr const char INDEX_MAGIC[4] = {'T', 'W', 'I', 'X'};
+    constexpr uint32_t INDEX_VERSION = 2;
+
+    // Kopf: Magic, Version, Anzahl Löschmarken (je 4 Byte), danach der Stand des
+    // Segment-Logs: jüngstes Segment (4), dessen Länge, Gesamtlänge, tote Bytes (je 8)
+    constexpr size_t HEADER_SIZE = 48;
+    constexpr size_t DELETED_COUNT_POS = 8;
+    constexpr size_t LOG_SEGMENT_POS = 12;
+    constexpr size_t LOG_SIZE_POS = 16;
+    constexpr size_t LOG_TOTAL_POS = 24;
+    constexpr size_t LOG_DEAD_POS = 32;
+    constexpr size_t LOG_END = 40;
+
+    // Eintrag: id, Flags, Längen, Body-Offset, Body-Länge, Absender, Segment,
+    // volle Betrefflänge, Betreff
+    constexpr size_t RECORD_SIZE = 128;
+    constexpr size_t ID_POS = 0;
+    constexpr size_t FLAGS_POS = 4;
+    constexpr size_t SENDER_LEN_POS = 5;
+    constexpr size_t SUBJECT_LEN_POS = 6;
+    constexpr size_t OFFSET_POS = 8;
+    constexpr size_t SIZE_POS = 16;
+    constexpr size_t SENDER_POS = 24;
+    constexpr size_t SENDER_MAX = 8;      // Benutzernamen haben höchstens 8 Zeichen
+    constexpr size_t SEGMENT_POS = 32;
+    constexpr size_t SUBJECT_SIZE_POS = 36;
+    constexpr size_t SUBJECT_POS = 40;
+    constexpr size_t SUBJECT_MAX = RECORD_SIZE - SUBJECT_POS;
+
+    constexpr unsigned char FLAG_DELETED = 1;
+    constexpr unsigned char FLAG_TRUNCATED = 2; // Betreff passt nicht in den Eintrag
+    constexpr unsigned char FLAG_COMPRESSED = 4; // Body komprimiert (bodySize = Länge auf Platte)
+
+    constexpr size_t COMPACT_MIN_RECORDS = 64;  // kleine Indizes nie umschreiben
+
+    void encodeRecord(const IndexEntry &entry, unsigned char *rec) {
+        memset(rec, 0, RECORD_SIZE);
+        int32_t id = entry.id;
+        memcpy(rec + ID_POS, &id, sizeof(id));
+        size_t senderLen = std::min(entry.sender.size(), SENDER_MAX);
+        // Bei einem aus dem Index gelesenen Eintrag ist subject schon gekürzt
+        uint32_t subjectSize = std::max<uint32_t>(entry.subjectSize,
+                                                  static_cast<uint32_t>(entry.subject.size()));
+        size_t subjectLen = std::min(entry.subject.size(), SUBJECT_MAX);
+        rec[FLAGS_POS] = (subjectSize > SUBJECT_MAX ? FLAG_TRUNCATED : 0)
+                         | (entry.compressed ? FLAG_COMPRESSED : 0);
+        rec[SENDER_LEN_POS] = static_cast<unsigned char>(senderLen);
+        rec[SUBJECT_LEN_POS] = static_cast<unsigned char>(subjectLen);
+        memcpy(rec + OFFSET_POS, &entry.bodyOffset, sizeof(entry.bodyOffset));
+        memcpy(rec + SIZE_POS, &entry.bodySize, sizeof(entry.bodySize));
+        memcpy(rec + SENDER_POS, entry.sender.data(), senderLen);
+        memcpy(rec + SEGMENT_POS, &entry.segment, sizeof(entry.segment));
+        memcpy(rec + SUBJECT_SIZE_POS, &subjectSize, sizeof(subjectSize));
+        memcpy(rec + SUBJECT_POS, entry.subject.data(), subjectLen);
+    }
+
+    void encodePosition(const LogPosition &end, char *fields) {
+        memcpy(fields, &end.segment, sizeof(end.segment));
+        memcpy(fields + (LOG_SIZE_POS - LOG_SEGMENT_POS), &end.size, sizeof(end.size));
+        memcpy(fields + (LOG_TOTAL_POS - LOG_SEGMENT_POS), &end.totalBytes, sizeof(end.totalBytes));
+        memcpy(fields + (LOG_DEAD_POS - LOG_SEGMENT_POS), &end.deadBytes, sizeof(end.deadBytes));
+    }
+
+    int32_t recordId(const unsigned char *rec) {
+        int32_t id;
+        memcpy(&id, rec + ID_POS, sizeof(id));
+        return id;
+    }
+
+    bool writeAll(int fd, const void *data, size_t len) {
+        const char *p = static_cast<const char *>(data);
+        while (len > 0) {
+            ssize_t n = write(fd, p, len);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool olderThan(const timespec &a, const timespec &b) {
+        return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+    }
+}
+
+using namespace std;
+
+MailboxIndex::MailboxIndex(string userDir)
+    : path_(userDir + "/" + INDEX_NAME), dir_(move(userDir)) {}
+
+MailboxIndex::~MailboxIndex() {
+    unload();
+}
+
+void MailboxIndex::unload() {
+    if (map_) {
+        munmap(map_, mapSize_);
+        map_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    mapSize_ = 0;
+    records_ = 0;
+}
+
+// Aktuell, solange das Verzeichnis seit der letzten Indexänderung nicht verändert wurde
+// (neue oder gelöschte .msg-Datei ändert die mtime des Verzeichnisses)
+bool MailboxIndex::isFresh() const {
+    struct stat dirSt {};
+    struct stat idxSt {};
+    if (stat(dir_.c_str(), &dirSt) < 0 || stat(path_.c_str(), &idxSt) < 0) {
+        return false;
+    }
+    return !olderThan(idxSt.st_mtim, dirSt.st_mtim);
+}
+
+string MailboxIndex::pathIn(const string &userDir) {
+    return userDir + "/" + INDEX_NAME;
+}
+
+bool MailboxIndex::load(bool checkDirectory) {
+    unload();
+    checkDirectory_ = checkDirectory;
+    if (checkDirectory && !isFresh()) {
+        return false;
+    }
+    fd_ = open(path_.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    struct stat st {};
+    char header[HEADER_SIZE];
+    if (fstat(fd_, &st) < 0 || st.st_size < static_cast<off_t>(HEADER_SIZE)
+        || (static_cast<size_t>(st.st_size) - HEADER_SIZE) % RECORD_SIZE != 0
+        || pread(fd_, header, HEADER_SIZE, 0) != static_cast<ssize_t>(HEADER_SIZE)) {
+        unload();
+        return false;
+    }
+    uint32_t version;
+    memcpy(&version, header + 4, sizeof(version));
+    if (memcmp(header, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || version != INDEX_VERSION) {
+        unload();
+        return false;
+    }
+
+    mapSize_ = static_cast<size_t>(st.st_size);
+    records_ = (mapSize_ - HEADER_SIZE) / RECORD_SIZE;
+    map_ = mmap(nullptr, mapSize_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (map_ == MAP_FAILED) {
+        map_ = nullptr;
+        perror("mmap(index)");
+        unload();
+        return false;
+    }
+    return true;
+}
+
+const unsigned char *MailboxIndex::record(size_t i) const {
+    return static_cast<const unsigned char *>(map_) + HEADER_SIZE + i * RECORD_SIZE;
+}
+
+int MailboxIndex::lastId() const {
+    return records_ > 0 ? recordId(record(records_ - 1)) : 0;
+}
+
+size_t MailboxIndex::lowerBound(int id) const {
+    size_t lo = 0;
+    size_t hi = records_;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (recordId(record(mid)) < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+bool MailboxIndex::entry(size_t i, IndexEntry &entry) const {
+    const unsigned char *rec = record(i);
+    if (rec[FLAGS_POS] & FLAG_DELETED) {
+        return false;
+    }
+    entry.id = recordId(rec);
+    entry.sender.assign(reinterpret_cast<const char *>(rec + SENDER_POS),
+                        min<size_t>(rec[SENDER_LEN_POS], SENDER_MAX));
+    entry.subject.assign(reinterpret_cast<const char *>(rec + SUBJECT_POS),
+                         min<size_t>(rec[SUBJECT_LEN_POS], SUBJECT_MAX));
+    memcpy(&entry.bodyOffset, rec + OFFSET_POS, sizeof(entry.bodyOffset));
+    memcpy(&entry.bodySize, rec + SIZE_POS, sizeof(entry.bodySize));
+    memcpy(&entry.segment, rec + SEGMENT_POS, sizeof(entry.segment));
+    memcpy(&entry.subjectSize, rec + SUBJECT_SIZE_POS, sizeof(entry.subjectSize));
+    entry.compressed = (rec[FLAGS_POS] & FLAG_COMPRESSED) != 0;
+    return true;
+}
+
+LogPosition MailboxIndex::position() const {
+    LogPosition end;
+    if (!map_) {
+        return end;
+    }
+    const char *header = static_cast<const char *>(map_);
+    memcpy(&end.segment, header + LOG_SEGMENT_POS, sizeof(end.segment));
+    memcpy(&end.size, header + LOG_SIZE_POS, sizeof(end.size));
+    memcpy(&end.totalBytes, header + LOG_TOTAL_POS, sizeof(end.totalBytes));
+    memcpy(&end.deadBytes, header + LOG_DEAD_POS, sizeof(end.deadBytes));
+    return end;
+}
+
+bool MailboxIndex::setPosition(const LogPosition &end) {
+    char fields[LOG_END - LOG_SEGMENT_POS];
+    encodePosition(end, fields);
+    int fd = fd_ >= 0 ? fd_ : open(path_.c_str(), O_WRONLY | O_CLOEXEC);
+    bool ok = fd >= 0 && pwrite(fd, fields, sizeof(fields), LOG_SEGMENT_POS)
+                             == static_cast<ssize_t>(sizeof(fields));
+    if (fd >= 0 && fd != fd_) {
+        close(fd);
+    }
+    if (!ok) {
+        discard();
+    }
+    return ok;
+}
+
+bool MailboxIndex::truncated(size_t i) const {
+    return (record(i)[FLAGS_POS] & FLAG_TRUNCATED) != 0;
+}
+
+// Ein write() mit O_APPEND pro Eintrag; die Abbildung eines vorherigen load() wird
+// verworfen, da sie den neuen Eintrag nicht enthält
+bool MailboxIndex::append(const IndexEntry &entry) {
+    unload();
+    unsigned char rec[RECORD_SIZE];
+    encodeRecord(entry, rec);
+
+    int fd = open(path_.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    // Die Sortierung trägt lowerBound(); eine wiederverwendete Nummer (gelöschte höchste
+    // Nachricht, nach einem Absturz nachhinkender Zähler) darf nur ein Neuaufbau einordnen
+    struct stat st;
+    unsigned char last[RECORD_SIZE];
+    if (fstat(fd, &st) < 0 ||
+        (static_cast<size_t>(st.st_size) > HEADER_SIZE &&
+         (pread(fd, last, RECORD_SIZE, st.st_size - static_cast<off_t>(RECORD_SIZE))
+              != static_cast<ssize_t>(RECORD_SIZE) ||
+          recordId(last) >= entry.id))) {
+        close(fd);
+        discard();
+        return false;
+    }
+
+    bool ok = writeAll(fd, rec, RECORD_SIZE);
+    close(fd);
+    if (!ok) {
+        discard(); // halber Eintrag → Index neu aufbauen lassen
+    }
+    return ok;
+}
+
+bool MailboxIndex::markDeleted(int id) {
+    if (!map_) {
+        return false;
+    }
+    // Bei wiederverwendeten Nummern steht die gültige Nachricht hinter alten Löschmarken
+    size_t pos = records_;
+    for (size_t i = lowerBound(id); i < records_ && recordId(record(i)) == id; ++i) {
+        if (!(record(i)[FLAGS_POS] & FLAG_DELETED)) {
+            pos = i;
+        }
+    }
+    if (pos == records_) {
+        discard(); // Datei existierte, stand aber nicht im Index
+        return false;
+    }
+
+    unsigned char flags = record(pos)[FLAGS_POS] | FLAG_DELETED;
+    uint32_t deletedCount;
+    memcpy(&deletedCount, static_cast<const char *>(map_) + DELETED_COUNT_POS, sizeof(deletedCount));
+    ++deletedCount;
+    off_t flagsPos = static_cast<off_t>(HEADER_SIZE + pos * RECORD_SIZE + FLAGS_POS);
+    if (pwrite(fd_, &flags, 1, flagsPos) != 1
+        || pwrite(fd_, &deletedCount, sizeof(deletedCount), DELETED_COUNT_POS)
+               != static_cast<ssize_t>(sizeof(deletedCount))) {
+        discard();
+        return false;
+    }
+
+    if (records_ >= COMPACT_MIN_RECORDS && deletedCount * 2 > records_) {
+        compact();
+    }
+    return true;
+}
+
+// Nur die gültigen Einträge neu schreiben (Stand des Logs bleibt); danach wieder abbilden
+bool MailboxIndex::compact() {
+    vector<IndexEntry> live;
+    IndexEntry e;
+    for (size_t i = 0; i < records_; ++i) {
+        if (entry(i, e)) {
+            live.push_back(e);
+        }
+    }
+    bool checkDirectory = checkDirectory_;
+    return replace(live, position()) && load(checkDirectory);
+}
+
+bool MailboxIndex::replace(const vector<IndexEntry> &entries, const LogPosition &end) {
+    unload();
+
+    string data(HEADER_SIZE + entries.size() * RECORD_SIZE, '\0');
+    memcpy(&data[0], INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    memcpy(&data[4], &INDEX_VERSION, sizeof(INDEX_VERSION));
+    encodePosition(end, &data[LOG_SEGMENT_POS]);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        encodeRecord(entries[i], reinterpret_cast<unsigned char *>(&data[HEADER_SIZE + i * RECORD_SIZE]));
+    }
+
+    string tmpPath = path_ + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    if (!writeAll(fd, data.data(), data.size()) || rename(tmpPath.c_str(), path_.c_str()) < 0) {
+        close(fd);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    // rename() hat das Verzeichnis verändert; der Index muss danach wieder jünger sein
+    futimens(fd, nullptr);
+    close(fd);
+    return true;
+}
+
+void MailboxIndex::discard() {
+    unload();
+    unlink(path_.c_str());
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Eintrag des Postfach-Index: alles, was LIST braucht, ohne die .msg-Datei zu öffnen.
+struct IndexEntry {
+    int id = 0;
+    std::string sender;
+    std::string subject;
+    uint64_t bodyOffset = 0; ///< Beginn des Bodys in der .msg- bzw. Segmentdatei
+    uint64_t bodySize = 0;   ///< Länge des Bodys in Bytes
+    uint32_t segment = 0;    ///< Segmentdatei der Nachricht (nur Segment-Layout)
+    uint32_t subjectSize = 0; ///< volle Länge des Betreffs (0 = subject.size())
+    bool compressed = false; ///< Body liegt komprimiert vor (BodyCompressor, Option -Z)
+};
+
+/// Stand des Segment-Logs, den der Index abdeckt (nur Segment-Layout, sonst leer).
+struct LogPosition {
+    uint32_t segment = 0;    ///< Nummer des jüngsten Segments (0 = noch keins)
+    uint64_t size = 0;       ///< dessen Länge in Bytes
+    uint64_t totalBytes = 0; ///< Länge aller Segmente zusammen
+    uint64_t deadBytes = 0;  ///< davon belegt durch gelöschte Nachrichten und Löschmarken
+};
+
+/// Kompakter Binärindex eines Postfachs (Datei "mailbox.idx" im Benutzerverzeichnis).
+/// Nach einem 48-Byte-Kopf folgen Einträge fester Größe (128 Byte), aufsteigend nach
+/// Nachrichtennummer. Neue Nachrichten werden angehängt, gelöschte nur als gelöscht
+/// markiert; überwiegen die Löschmarken, wird der Index kompakt neu geschrieben
+/// (temporäre Datei + rename). Gelesen wird per mmap().
+/// Der Index gilt als aktuell, solange das Verzeichnis nicht jünger ist als die
+/// Indexdatei: jede Änderung durch den MailStore berührt den Index nach der .msg-Datei.
+/// Im Segment-Layout merkt sich der Kopf stattdessen das Ende des Logs (position());
+/// der Index ist aktuell, solange das Log genau dort endet (SegmentLog::isAt()).
+/// Nicht thread-sicher; der MailStore liest nur unter geteilter und schreibt nur unter
+/// exklusiver Postfach-Sperre.
+class MailboxIndex {
+public:
+    /// @param userDir Benutzerverzeichnis, in dem der Index liegt.
+    explicit MailboxIndex(std::string userDir);
+    ~MailboxIndex();
+
+    MailboxIndex(const MailboxIndex &) = delete;
+    MailboxIndex &operator=(const MailboxIndex &) = delete;
+
+    /// @param userDir Benutzerverzeichnis.
+    /// @return Pfad der Indexdatei darin.
+    static std::string pathIn(const std::string &userDir);
+
+    /// @return true, wenn der Index existiert und nicht älter als das Verzeichnis ist.
+    bool isFresh() const;
+
+    /// Bildet den Index in den Speicher ab.
+    /// @param checkDirectory Aktualität per isFresh() prüfen (Datei-Layout); im
+    ///        Segment-Layout prüft der Aufrufer stattdessen position().
+    /// @return false, wenn er fehlt, veraltet oder beschädigt ist (→ neu aufbauen).
+    bool load(bool checkDirectory = true);
+
+    /// @return Im Kopf vermerkter Stand des Segment-Logs (nach load()).
+    LogPosition position() const;
+
+    /// Vermerkt einen neuen Stand des Segment-Logs im Kopf (nach append()/markDeleted()).
+    /// @return false bei Schreibfehler (der Index wird dann verworfen).
+    bool setPosition(const LogPosition &end);
+
+    /// @return Anzahl der Einträge inkl. gelöschter (nach load()).
+    size_t records() const { return records_; }
+
+    /// @return Höchste Nummer im Index, auch wenn gelöscht; 0 bei leerem Index (nach load()).
+    int lastId() const;
+
+    /// @return Position des ersten Eintrags mit Nummer >= id (nach load()).
+    size_t lowerBound(int id) const;
+
+    /// Liest einen Eintrag (nach load()).
+    /// @param i Position, 0 <= i < records().
+    /// @param entry Ausgabe.
+    /// @return false, wenn der Eintrag als gelöscht markiert ist.
+    bool entry(size_t i, IndexEntry &entry) const;
+
+    /// @return true, wenn der Betreff des Eintrags gekürzt gespeichert ist und aus der
+    ///         .msg-Datei gelesen werden muss (nach load()).
+    bool truncated(size_t i) const;
+
+    /// Hängt eine neue Nachricht an. Nur aufrufen, wenn der Index vor dem Anlegen der
+    /// .msg-Datei aktuell war.
+    /// @return false bei Schreibfehler oder wenn die Nummer nicht größer als alle
+    ///         bisherigen ist (der Index wird dann verworfen und neu aufgebaut).
+    bool append(const IndexEntry &entry);
+
+    /// Markiert eine Nachricht als gelöscht (nach load()).
+    /// @return false, wenn sie nicht im Index steht oder nicht geschrieben werden konnte;
+    ///         der Index wird dann verworfen und beim nächsten LIST neu aufgebaut.
+    bool markDeleted(int id);
+
+    /// Ersetzt den Index atomar durch die angegebenen Einträge.
+    /// @param entries Einträge, aufsteigend nach Nummer.
+    /// @param end Stand des Segment-Logs, den die Einträge abdecken.
+    /// @return false bei Schreibfehler (der alte Index bleibt dann unverändert).
+    bool replace(const std::vector<IndexEntry> &entries, const LogPosition &end = {});
+
+    /// Löscht die Indexdatei, damit sie beim nächsten Zugriff neu aufgebaut wird.
+    void discard();
+
+private:
+    std::string path_;
+    std::string dir_;
+    int fd_ = -1;
+    void *map_ = nullptr;
+    size_t mapSize_ = 0;
+    size_t records_ = 0;
+    bool checkDirectory_ = true;
+
+    void unload();
+    const unsigned char *record(size_t i) const;
+    bool compact();
+};
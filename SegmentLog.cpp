@@ -0,0 +1,403 @@
+#include "SegmentLog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    constexpr const char *LOCK_NAME = "segments.lock";
+    constexpr const char RECORD_MAGIC[4] = {'T', 'W', 'R', '1'};
+    constexpr char TYPE_MESSAGE = 'M';
+    constexpr char TYPE_COMPRESSED = 'Z'; // Nachricht mit komprimiertem Body
+    constexpr char TYPE_TOMBSTONE = 'T';
+
+    // Datensatzkopf: Magic, Typ, Absenderlänge, 2 reserviert, Nummer, Betrefflänge,
+    // Body-Länge; danach Absender, Betreff, Body
+    constexpr size_t HEADER_SIZE = 24;
+    constexpr size_t TYPE_POS = 4;
+    constexpr size_t SENDER_LEN_POS = 5;
+    constexpr size_t ID_POS = 8;
+    constexpr size_t SUBJECT_LEN_POS = 12;
+    constexpr size_t BODY_LEN_POS = 16;
+
+    constexpr uint64_t SEGMENT_MAX = uint64_t{64} << 20; // danach beginnt ein neues Segment
+
+    std::string encodeHeader(char type, int id, size_t senderLen, size_t subjectLen,
+                             uint64_t bodyLen) {
+        std::string header(HEADER_SIZE, '\0');
+        memcpy(&header[0], RECORD_MAGIC, sizeof(RECORD_MAGIC));
+        header[TYPE_POS] = type;
+        header[SENDER_LEN_POS] = static_cast<char>(senderLen);
+        int32_t id32 = id;
+        uint32_t subjectLen32 = static_cast<uint32_t>(subjectLen);
+        memcpy(&header[ID_POS], &id32, sizeof(id32));
+        memcpy(&header[SUBJECT_LEN_POS], &subjectLen32, sizeof(subjectLen32));
+        memcpy(&header[BODY_LEN_POS], &bodyLen, sizeof(bodyLen));
+        return header;
+    }
+
+    bool preadAll(int fd, char *buf, size_t len, off_t pos) {
+        while (len > 0) {
+            ssize_t n = pread(fd, buf, len, pos);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            buf += n;
+            len -= static_cast<size_t>(n);
+            pos += n;
+        }
+        return true;
+    }
+
+    uint64_t subjectSizeOf(const IndexEntry &entry) {
+        return std::max<uint64_t>(entry.subjectSize, entry.subject.size());
+    }
+
+    // Beginn des Datensatzes einer Nachricht im Segment
+    uint64_t recordStart(const IndexEntry &entry) {
+        return entry.bodyOffset - subjectSizeOf(entry) - entry.sender.size() - HEADER_SIZE;
+    }
+}
+
+using namespace std;
+
+SegmentLog::SegmentLog(string userDir) : dir_(move(userDir)) {}
+
+SegmentLog::~SegmentLog() {
+    if (lockFd_ >= 0) {
+        close(lockFd_); // gibt auch die flock-Sperre frei
+    }
+}
+
+bool SegmentLog::lock() {
+    if (lockFd_ >= 0) {
+        return true;
+    }
+    string path = dir_ + "/" + LOCK_NAME;
+    lockFd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lockFd_ < 0) {
+        return false;
+    }
+    while (flock(lockFd_, LOCK_EX) < 0) {
+        if (errno != EINTR) {
+            perror("flock(segments)");
+            close(lockFd_);
+            lockFd_ = -1;
+            return false;
+        }
+    }
+    return true;
+}
+
+string SegmentLog::fileName(uint32_t segment) {
+    return "seg-" + to_string(segment) + ".log";
+}
+
+string SegmentLog::segmentPath(uint32_t segment) const {
+    return dir_ + "/" + fileName(segment);
+}
+
+// Nummern aller Segmente, aufsteigend
+bool SegmentLog::segments(vector<uint32_t> &numbers) const {
+    DIR *dir = opendir(dir_.c_str());
+    if (!dir) {
+        return false;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        unsigned segment;
+        char tail;
+        if (sscanf(entry->d_name, "seg-%u.lo%c", &segment, &tail) == 2 && tail == 'g'
+            && segment > 0) {
+            numbers.push_back(segment);
+        }
+    }
+    closedir(dir);
+    sort(numbers.begin(), numbers.end());
+    return true;
+}
+
+bool SegmentLog::exists() const {
+    vector<uint32_t> numbers;
+    return segments(numbers) && !numbers.empty();
+}
+
+// Zwei stat(): das jüngste Segment hat die erwartete Länge und es gibt kein neueres
+bool SegmentLog::isAt(const LogPosition &end) const {
+    if (end.segment == 0) {
+        return !exists();
+    }
+    struct stat st {};
+    if (stat(segmentPath(end.segment).c_str(), &st) < 0
+        || static_cast<uint64_t>(st.st_size) != end.size) {
+        return false;
+    }
+    return stat(segmentPath(end.segment + 1).c_str(), &st) < 0 && errno == ENOENT;
+}
+
+int SegmentLog::open(uint32_t segment) const {
+    return ::open(segmentPath(segment).c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+// Ins nächste Segment wechseln, wenn der Datensatz das aktuelle zu groß machen würde
+void SegmentLog::roll(LogPosition &end, uint64_t bytes) {
+    if (end.segment == 0 || (end.size > 0 && end.size + bytes > SEGMENT_MAX)) {
+        ++end.segment;
+        end.size = 0;
+    }
+}
+
+// Datensätze an der bekannten Endposition schreiben; ein halber Datensatz wird wieder
+// abgeschnitten, damit das Segment auf end stehen bleibt
+bool SegmentLog::write(LogPosition &end, const string &records) {
+    int fd = ::open(segmentPath(end.segment).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("open(segment)");
+        return false;
+    }
+    const char *p = records.data();
+    size_t left = records.size();
+    off_t pos = static_cast<off_t>(end.size);
+    while (left > 0) {
+        ssize_t n = pwrite(fd, p, left, pos);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            perror("pwrite(segment)");
+            if (ftruncate(fd, static_cast<off_t>(end.size)) < 0) {
+                perror("ftruncate(segment)");
+            }
+            close(fd);
+            return false;
+        }
+        p += n;
+        left -= static_cast<size_t>(n);
+        pos += n;
+    }
+    close(fd);
+    end.size += records.size();
+    end.totalBytes += records.size();
+    return true;
+}
+
+bool SegmentLog::append(LogPosition &end, IndexEntry &entry, const string &body) {
+    string record = encodeHeader(entry.compressed ? TYPE_COMPRESSED : TYPE_MESSAGE, entry.id,
+                                 entry.sender.size(), entry.subject.size(), body.size());
+    record += entry.sender;
+    record += entry.subject;
+    size_t headerBytes = record.size();
+    record += body;
+
+    LogPosition next = end;
+    roll(next, record.size());
+    uint64_t start = next.size;
+    if (!write(next, record)) {
+        return false;
+    }
+    entry.segment = next.segment;
+    entry.bodyOffset = start + headerBytes;
+    entry.bodySize = body.size();
+    entry.subjectSize = static_cast<uint32_t>(entry.subject.size());
+    end = next;
+    return true;
+}
+
+bool SegmentLog::appendTombstones(LogPosition &end, const vector<int> &ids) {
+    string records;
+    for (int id : ids) {
+        records += encodeHeader(TYPE_TOMBSTONE, id, 0, 0, 0);
+    }
+    LogPosition next = end;
+    roll(next, records.size());
+    if (!write(next, records)) {
+        return false;
+    }
+    next.deadBytes += records.size(); // Löschmarken selbst sind nach dem Kompaktieren weg
+    end = next;
+    return true;
+}
+
+bool SegmentLog::scan(vector<IndexEntry> &entries, LogPosition &end) {
+    entries.clear();
+    end = LogPosition{};
+    vector<uint32_t> numbers;
+    if (!segments(numbers)) {
+        return false;
+    }
+
+    map<int, IndexEntry> live;
+    for (size_t i = 0; i < numbers.size(); ++i) {
+        uint64_t size = scanSegment(numbers[i], i + 1 == numbers.size(), live);
+        end.segment = numbers[i];
+        end.size = size;
+        end.totalBytes += size;
+    }
+
+    uint64_t liveBytes = 0;
+    entries.reserve(live.size());
+    for (auto &msg : live) {
+        liveBytes += recordSize(msg.second);
+        entries.push_back(move(msg.second));
+    }
+    end.deadBytes = end.totalBytes - liveBytes;
+    return true;
+}
+
+// Datensätze eines Segments in live einarbeiten; liefert die Länge des gültigen Teils
+uint64_t SegmentLog::scanSegment(uint32_t segment, bool last, map<int, IndexEntry> &live) {
+    int fd = ::open(segmentPath(segment).c_str(), last ? O_RDWR | O_CLOEXEC : O_RDONLY | O_CLOEXEC);
+    struct stat st {};
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+
+    uint64_t pos = 0;
+    char header[HEADER_SIZE];
+    while (size - pos >= HEADER_SIZE
+           && preadAll(fd, header, HEADER_SIZE, static_cast<off_t>(pos))
+           && memcmp(header, RECORD_MAGIC, sizeof(RECORD_MAGIC)) == 0) {
+        int32_t id;
+        uint32_t subjectLen;
+        uint64_t bodyLen;
+        memcpy(&id, header + ID_POS, sizeof(id));
+        memcpy(&subjectLen, header + SUBJECT_LEN_POS, sizeof(subjectLen));
+        memcpy(&bodyLen, header + BODY_LEN_POS, sizeof(bodyLen));
+        size_t senderLen = static_cast<unsigned char>(header[SENDER_LEN_POS]);
+        uint64_t payload = senderLen + subjectLen;
+        if (bodyLen > size || payload + bodyLen > size - pos - HEADER_SIZE) {
+            break; // abgerissen
+        }
+
+        if (header[TYPE_POS] == TYPE_MESSAGE || header[TYPE_POS] == TYPE_COMPRESSED) {
+            string text(payload, '\0');
+            if (!preadAll(fd, &text[0], payload, static_cast<off_t>(pos + HEADER_SIZE))) {
+                break;
+            }
+            IndexEntry &entry = live[id];
+            entry.id = id;
+            entry.sender = text.substr(0, senderLen);
+            entry.subject = text.substr(senderLen);
+            entry.subjectSize = subjectLen;
+            entry.segment = segment;
+            entry.bodyOffset = pos + HEADER_SIZE + payload;
+            entry.bodySize = bodyLen;
+            entry.compressed = header[TYPE_POS] == TYPE_COMPRESSED;
+        } else if (header[TYPE_POS] == TYPE_TOMBSTONE) {
+            live.erase(id);
+        } else {
+            break;
+        }
+        pos += HEADER_SIZE + payload + bodyLen;
+    }
+
+    if (pos < size) {
+        fprintf(stderr, "Segment %s: ungültiger Datensatz bei Offset %llu%s\n",
+                segmentPath(segment).c_str(), static_cast<unsigned long long>(pos),
+                last ? ", wird abgeschnitten" : "");
+        if (last && ftruncate(fd, static_cast<off_t>(pos)) < 0) {
+            perror("ftruncate(segment)");
+            pos = size; // Rest bleibt stehen; neue Datensätze kommen dahinter
+        }
+    }
+    close(fd);
+    return pos;
+}
+
+// Gültige Datensätze einzeln in neue Segmente kopieren; bei einem Fehler werden die
+// neuen Segmente wieder entfernt und die alten bleiben gültig
+uint32_t SegmentLog::compact(vector<IndexEntry> &entries, LogPosition &end) {
+    uint32_t first = end.segment + 1;
+    LogPosition next{first, 0, 0, 0};
+    // Auch ohne gültige Nachrichten ein (leeres) Segment anlegen, auf das isAt() zeigt
+    int created = ::open(segmentPath(first).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (created < 0) {
+        return 0;
+    }
+    close(created);
+
+    bool ok = true;
+    int srcFd = -1;
+    uint32_t srcSegment = 0;
+    string record;
+    for (IndexEntry &entry : entries) {
+        if (entry.segment != srcSegment) {
+            if (srcFd >= 0) {
+                close(srcFd);
+            }
+            srcSegment = entry.segment;
+            srcFd = open(srcSegment);
+        }
+        uint64_t start = recordStart(entry);
+        record.resize(static_cast<size_t>(recordSize(entry)));
+        if (srcFd < 0 || !preadAll(srcFd, &record[0], record.size(), static_cast<off_t>(start))) {
+            ok = false;
+            break;
+        }
+        roll(next, record.size());
+        uint64_t newStart = next.size;
+        if (!write(next, record)) {
+            ok = false;
+            break;
+        }
+        entry.segment = next.segment;
+        entry.bodyOffset = newStart + (entry.bodyOffset - start);
+    }
+    if (srcFd >= 0) {
+        close(srcFd);
+    }
+
+    if (!ok) {
+        for (uint32_t segment = first; segment <= next.segment; ++segment) {
+            unlink(segmentPath(segment).c_str());
+        }
+        return 0;
+    }
+    end = next;
+    return first;
+}
+
+void SegmentLog::removeBefore(uint32_t segment) {
+    vector<uint32_t> numbers;
+    segments(numbers);
+    for (uint32_t number : numbers) {
+        if (number < segment) {
+            unlink(segmentPath(number).c_str());
+        }
+    }
+}
+
+void SegmentLog::removeAll() {
+    removeBefore(UINT32_MAX);
+    unlink((dir_ + "/" + LOCK_NAME).c_str());
+}
+
+bool SegmentLog::readSubject(int fd, const IndexEntry &entry, string &subject) {
+    uint64_t size = subjectSizeOf(entry);
+    subject.assign(static_cast<size_t>(size), '\0');
+    return size == 0
+        || preadAll(fd, &subject[0], subject.size(), static_cast<off_t>(entry.bodyOffset - size));
+}
+
+bool SegmentLog::readBody(int fd, const IndexEntry &entry, string &body) {
+    body.assign(static_cast<size_t>(entry.bodySize), '\0');
+    return body.empty()
+        || preadAll(fd, &body[0], body.size(), static_cast<off_t>(entry.bodyOffset));
+}
+
+uint64_t SegmentLog::recordSize(const IndexEntry &entry) {
+    return HEADER_SIZE + entry.sender.size() + subjectSizeOf(entry) + entry.bodySize;
+}
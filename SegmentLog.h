@@ -0,0 +1,100 @@
+#pragma once
+
+#include "MailboxIndex.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/// Segment-Log eines Postfachs (Segment-Layout des MailStore): statt einer .msg-Datei pro
+/// Nachricht werden alle Nachrichten eines Benutzers an Segmentdateien "seg-<n>.log"
+/// angehängt. Jeder Datensatz besteht aus einem 24-Byte-Kopf (Magic, Typ, Längen, Nummer)
+/// und Absender, Betreff und Body; gelöscht wird durch einen angehängten Löschdatensatz.
+/// Wird ein Segment zu groß, beginnt das nächste. Wo welche Nachricht steht, hält der
+/// MailboxIndex fest; scan() baut den Bestand aus den Segmenten wieder auf und
+/// compact() schreibt nur die noch gültigen Nachrichten in neue Segmente um.
+/// Nicht thread-sicher; der MailStore schreibt nur unter exklusiver Postfach-Sperre und
+/// schützt sich mit lock() gegen Schreiber eines zweiten Prozesses (Übergabe per SIGUSR2).
+class SegmentLog {
+public:
+    /// @param userDir Benutzerverzeichnis, in dem die Segmente liegen.
+    explicit SegmentLog(std::string userDir);
+    ~SegmentLog();
+
+    SegmentLog(const SegmentLog &) = delete;
+    SegmentLog &operator=(const SegmentLog &) = delete;
+
+    /// Sperrt das Log prozessübergreifend (flock auf "segments.lock") bis zum Destruktor.
+    /// @return false, wenn die Sperrdatei nicht angelegt werden kann.
+    bool lock();
+
+    /// @return true, wenn das Log genau an end endet (jüngstes Segment und seine Länge),
+    ///         der Index also alle Datensätze kennt.
+    bool isAt(const LogPosition &end) const;
+
+    /// @return true, wenn es mindestens ein Segment gibt.
+    bool exists() const;
+
+    /// Hängt eine Nachricht an.
+    /// @param end Stand des Logs; wird fortgeschrieben.
+    /// @param entry Nummer, Absender und Betreff; Ausgabe: Segment und Lage des Bodys.
+    /// @param body Nachrichtentext.
+    /// @return false bei Schreibfehler (das Segment wird auf end zurückgesetzt).
+    bool append(LogPosition &end, IndexEntry &entry, const std::string &body);
+
+    /// Hängt Löschdatensätze an (ein write()).
+    /// @param end Stand des Logs; wird fortgeschrieben.
+    /// @param ids Gelöschte Nummern.
+    /// @return false bei Schreibfehler.
+    bool appendTombstones(LogPosition &end, const std::vector<int> &ids);
+
+    /// Liest alle Segmente der Reihe nach: spätere Datensätze einer Nummer ersetzen
+    /// frühere, Löschdatensätze entfernen sie. Ein abgerissener Datensatz am Ende des
+    /// jüngsten Segments (Absturz beim Schreiben) wird abgeschnitten.
+    /// @param entries Ausgabe: gültige Nachrichten aufsteigend nach Nummer.
+    /// @param end Ausgabe: Stand des Logs inkl. toter Bytes.
+    /// @return false, wenn das Verzeichnis nicht lesbar ist.
+    bool scan(std::vector<IndexEntry> &entries, LogPosition &end);
+
+    /// Kopiert die angegebenen Nachrichten in neue Segmente hinter end. Die alten
+    /// Segmente bleiben stehen, bis der Aufrufer den Index umgestellt hat (removeBefore()).
+    /// @param entries Gültige Nachrichten; Ausgabe: neue Lage.
+    /// @param end Stand vorher; Ausgabe: Stand des umgeschriebenen Logs.
+    /// @return Nummer des ersten neuen Segments oder 0 bei Fehler.
+    uint32_t compact(std::vector<IndexEntry> &entries, LogPosition &end);
+
+    /// Entfernt alle Segmente mit kleinerer Nummer.
+    void removeBefore(uint32_t segment);
+
+    /// Entfernt alle Segmente und die Sperrdatei (Konvertierung ins Datei-Layout).
+    void removeAll();
+
+    /// @return Dateiname eines Segments relativ zum Benutzerverzeichnis.
+    static std::string fileName(uint32_t segment);
+
+    /// Öffnet ein Segment zum Lesen.
+    /// @return fd oder -1.
+    int open(uint32_t segment) const;
+
+    /// Liest den vollständigen Betreff einer Nachricht aus ihrem Segment.
+    /// @param fd Geöffnetes Segment der Nachricht.
+    static bool readSubject(int fd, const IndexEntry &entry, std::string &subject);
+
+    /// Liest den Body einer Nachricht aus ihrem Segment.
+    /// @param fd Geöffnetes Segment der Nachricht.
+    static bool readBody(int fd, const IndexEntry &entry, std::string &body);
+
+    /// @return Länge des Datensatzes einer Nachricht im Segment.
+    static uint64_t recordSize(const IndexEntry &entry);
+
+private:
+    std::string dir_;
+    int lockFd_ = -1;
+
+    std::string segmentPath(uint32_t segment) const;
+    bool segments(std::vector<uint32_t> &numbers) const;
+    static void roll(LogPosition &end, uint64_t bytes);
+    bool write(LogPosition &end, const std::string &records);
+    uint64_t scanSegment(uint32_t segment, bool last, std::map<int, IndexEntry> &live);
+};
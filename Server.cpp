@@ -2,29 +2,59 @@
 
 #include "BlacklistManager.h"
 #include "ClientSession.h"
+#include "DiskStage.h"
+#include "EventLoop.h"
 #include "LdapAuthenticator.h"
 #include "MailStore.h"
+#include "UringLoop.h"
+#include "WorkerPool.h"
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <thread>
 #include <unistd.h>
+#include <vector>
+
+namespace {
+    constexpr int HANDOVER_TIMEOUT = 10; // Sekunden bis zur Bereitschaftsmeldung des Nachfolgers
+    constexpr size_t DISK_QUEUE_PER_WORKER = 64; // wartende Disk-Aufträge je Disk-Worker
+}
 
 using namespace std;
 
-// Konstruktor: Port und Spool-Verzeichnis merken
-Server::Server(int port, string spoolDir)
-    : port_(port), spoolDir_(move(spoolDir)) {}
+// Konstruktor: Port, Spool-Verzeichnis und Optionen merken
+Server::Server(int port, string spoolDir, ServerOptions options)
+    : port_(port), spoolDir_(move(spoolDir)), options_(move(options)) {}
+
+Server::~Server() {
+    for (int fd : stopPipe_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
 
 // TCP-Server-Socket einrichten (binden + listen)
-bool Server::setupSocket(int &sockfd) {
-    // IPv4, TCP
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+bool Server::setupSocket(int &sockfd, bool reusePort) {
+    // IPv4, TCP; nicht-blockierend, weil nach einer Übergabe zwei Prozesse
+    // denselben Listener pollen und nur einer die Verbindung bekommt
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sockfd < 0) {
         perror("socket");
         return false;
@@ -34,6 +64,14 @@ bool Server::setupSocket(int &sockfd) {
     int opt = 1;
     setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
+    // SO_REUSEPORT → mehrere Listener auf demselben Port, der Kernel verteilt
+    // eingehende Verbindungen auf sie (ein Listener pro Acceptor-Thread)
+    if (reusePort && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(sockfd);
+        return false;
+    }
+
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY; // auf allen Interfaces lauschen
@@ -46,8 +84,8 @@ bool Server::setupSocket(int &sockfd) {
         return false;
     }
 
-    // In den Listen-Mode gehen, max. 20 Verbindungen in der Queue
-    if (listen(sockfd, 20) < 0) {
+    // In den Listen-Mode gehen, Queue-Länge laut Option (Default 20)
+    if (listen(sockfd, options_.backlog > 0 ? options_.backlog : 20) < 0) {
         perror("listen");
         close(sockfd);
         return false;
@@ -55,53 +93,386 @@ bool Server::setupSocket(int &sockfd) {
     return true;
 }
 
-// Haupt-Serverloop
-bool Server::run() {
-    int serverSock = -1;
-    if (!setupSocket(serverSock)) {
+// Zusätzlicher Listener für Clients auf demselben Host (AF_UNIX, Pfad aus -u)
+bool Server::setupUnixSocket(int &sockfd) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (options_.unixPath.size() >= sizeof(addr.sun_path)) {
+        cerr << "Socket-Pfad zu lang: " << options_.unixPath << endl;
         return false;
     }
+    memcpy(addr.sun_path, options_.unixPath.c_str(), options_.unixPath.size() + 1);
 
-    // Zentrale Komponenten einmalig anlegen
-    MailStore store(spoolDir_);                          // speichert Mails als Dateien
-    BlacklistManager blacklist(spoolDir_ + "/blacklist.db"); // IP-Sperren
-    LdapAuthenticator authenticator;                     // kümmert sich um LDAP-Login
+    // Nicht-blockierend wie die TCP-Listener (Übergabe an einen Nachfolger)
+    sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        return false;
+    }
 
-    cout << "twmailer-server listening on port " << port_
-         << ", spool dir: " << spoolDir_ << endl;
+    // Übrig gebliebene Socket-Datei eines beendeten Servers entfernen, nichts anderes
+    struct stat st {};
+    if (lstat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(addr.sun_path);
+    }
+
+    if (bind(sockfd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        perror("bind");
+        close(sockfd);
+        return false;
+    }
+    if (listen(sockfd, options_.backlog > 0 ? options_.backlog : 20) < 0) {
+        perror("listen");
+        close(sockfd);
+        return false;
+    }
+    return true;
+}
+
+// Gibt die Zähler periodisch auf stdout aus (nur wenn -s gesetzt ist)
+void Server::startStatsReporter() {
+    if (options_.statsInterval <= 0) {
+        return;
+    }
+    int interval = options_.statsInterval;
+    thread([this, interval]() {
+        while (true) {
+            this_thread::sleep_for(chrono::seconds(interval));
+            cout << "[stats] " << stats_.summary();
+            if (pool_) {
+                cout << " workers=" << pool_->workers()
+                     << " busy_workers=" << pool_->busy()
+                     << " queued=" << pool_->queued()
+                     << "/" << pool_->queueDepth();
+            }
+            if (disk_) {
+                cout << " disk_queued=" << disk_->queued() << "/" << disk_->queueDepth();
+            }
+            cout << endl;
+        }
+    }).detach();
+}
+
+// Ressourcen der gewählten Betriebsart anlegen (Worker-Pool bzw. epoll-Loops)
+bool Server::startMode() {
+    if (options_.mode == ServerMode::Pool) {
+        size_t workers = options_.poolSize > 0 ? static_cast<size_t>(options_.poolSize) : 1;
+        size_t depth = options_.queueDepth > 0 ? static_cast<size_t>(options_.queueDepth) : 1;
+        pool_ = make_unique<WorkerPool>(workers, depth);
+        busyLine_ = options_.busyReply + "\n";
+        cout << "Pool-Modus mit " << workers << " Worker(n), Queue-Tiefe " << depth << endl;
+    } else if (options_.mode == ServerMode::Reactor) {
+        int loopCount = options_.loopThreads > 0 ? options_.loopThreads : 1;
+        for (int i = 0; i < loopCount; ++i) {
+            loops_.push_back(make_unique<EventLoop>(stats_));
+            if (!loops_.back()->start()) {
+                return false;
+            }
+        }
+        cout << "Reaktor-Modus mit " << loopCount << " epoll-Loop(s)" << endl;
+    } else if (options_.mode == ServerMode::Uring) {
+        // Ohne io_uring-Unterstützung im Kernel: zurück zum blockierenden Thread-Modus
+        if (!UringLoop::isSupported()) {
+            cerr << "io_uring nicht verfügbar, verwende Thread-Modus" << endl;
+            options_.mode = ServerMode::Threads;
+            return true;
+        }
+        int loopCount = options_.loopThreads > 0 ? options_.loopThreads : 1;
+        for (int i = 0; i < loopCount; ++i) {
+            uringLoops_.push_back(make_unique<UringLoop>(stats_));
+            if (!uringLoops_.back()->start()) {
+                return false;
+            }
+        }
+        cout << "io_uring-Modus mit " << loopCount << " Loop(s)" << endl;
+    }
+
+    // Plattenzugriffe der Loop-Sessions auf eigene Disk-Worker auslagern
+    if ((options_.mode == ServerMode::Reactor || options_.mode == ServerMode::Uring) &&
+        options_.diskWorkers > 0) {
+        size_t workers = static_cast<size_t>(options_.diskWorkers);
+        disk_ = make_unique<DiskStage>(workers, workers * DISK_QUEUE_PER_WORKER, stats_);
+        cout << "Disk-Stufe mit " << workers << " Worker(n), Queue-Tiefe "
+             << disk_->queueDepth() << endl;
+    }
+    return true;
+}
+
+// Blockierende Session bis zum QUIT oder Verbindungsende (Thread- und Pool-Modus)
+void Server::runSession(int clientSock, const string &clientIp) {
+    ++stats_.activeSessions;
+    ClientSession session(clientSock, clientIp, *store_, *blacklist_, *authenticator_,
+                          options_.limits, stats_);
+    session.run();
+    --stats_.activeSessions;
+}
+
+// Eine angenommene Verbindung je nach Betriebsart weiterreichen
+void Server::dispatch(int clientSock, const string &clientIp) {
+    if (options_.mode == ServerMode::Reactor) {
+        // Blacklist-Prüfung übernimmt ClientSession::start() im Loop-Thread;
+        // Verbindungen werden reihum auf die Loops verteilt
+        auto session = make_unique<ClientSession>(clientSock, clientIp, *store_, *blacklist_,
+                                                  *authenticator_, options_.limits, stats_,
+                                                  disk_.get());
+        size_t idx = nextLoop_.fetch_add(1) % loops_.size();
+        loops_[idx]->addSession(move(session));
+        return;
+    }
+
+    if (options_.mode == ServerMode::Uring) {
+        // Blockierender Socket: io_uring wartet intern auf Daten
+        auto session = make_unique<ClientSession>(clientSock, clientIp, *store_, *blacklist_,
+                                                  *authenticator_, options_.limits, stats_,
+                                                  disk_.get());
+        size_t idx = nextLoop_.fetch_add(1) % uringLoops_.size();
+        uringLoops_[idx]->addSession(move(session));
+        return;
+    }
+
+    // Direkt blocken, wenn IP bereits auf Blacklist
+    if (blacklist_->isBlacklisted(clientIp)) {
+        ++stats_.blacklisted;
+        send(clientSock, "ERR\n", 4, MSG_NOSIGNAL);
+        close(clientSock);
+        return;
+    }
+
+    if (options_.mode == ServerMode::Pool) {
+        bool accepted = pool_->trySubmit([this, clientSock, clientIp]() {
+            runSession(clientSock, clientIp);
+        });
+
+        // Queue voll: sofort antworten und schließen statt endlos zu warten
+        if (!accepted) {
+            ++stats_.rejectedBusy;
+            send(clientSock, busyLine_.data(), busyLine_.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(clientSock);
+        }
+        return;
+    }
 
-    // Endlosschleife: neue Clients annehmen
+    // Für jede Verbindung ein eigener Thread mit eigener ClientSession
+    thread([this, clientSock, clientIp]() {
+        runSession(clientSock, clientIp); // bearbeitet Kommandos bis zum QUIT oder Verbindungsende
+    }).detach(); // Thread loslösen, kein join nötig
+}
+
+// Accept-Loop für einen Listening-Socket (läuft in einem eigenen Acceptor-Thread)
+void Server::acceptLoop(int serverSock, int acceptorIndex, bool local) {
+    // Optional an eine CPU binden, damit Accept-Arbeit über die Kerne verteilt bleibt
+    if (options_.pinAcceptors) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(static_cast<int>(acceptorIndex % (cpus > 0 ? cpus : 1)), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    int flags = SOCK_CLOEXEC;
+    if (options_.mode == ServerMode::Reactor) {
+        flags |= SOCK_NONBLOCK;
+    }
+
+    // Neue Clients annehmen, bis die Stop-Pipe lesbar wird (Übergabe an Nachfolger)
+    pollfd fds[2] = {{serverSock, POLLIN, 0}, {stopPipe_[0], POLLIN, 0}};
     while (true) {
+        // Blockiert, bis ein Client sich verbindet oder gestoppt wird
+        if (poll(fds, 2, -1) < 0) {
+            if (errno != EINTR) {
+                perror("poll");
+            }
+            continue;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+
         sockaddr_in clientAddr{};
         socklen_t clientLen = sizeof(clientAddr);
-
-        // Blockiert, bis ein Client sich verbindet
-        int clientSock = accept(serverSock,
-                                reinterpret_cast<sockaddr *>(&clientAddr),
-                                &clientLen);
+        int clientSock = accept4(serverSock,
+                                 local ? nullptr : reinterpret_cast<sockaddr *>(&clientAddr),
+                                 local ? nullptr : &clientLen, flags);
         if (clientSock < 0) {
-            perror("accept");
+            // Verbindung hat ein anderer Acceptor bzw. Prozess bekommen
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                errno != ECONNABORTED) {
+                perror("accept");
+            }
+            continue;
+        }
+        ++stats_.accepted;
+
+        // Lokale Clients haben keine IP: Blacklist-Schlüssel ist die Benutzer-ID des
+        // verbundenen Prozesses, die der Kernel beim connect() festhält
+        if (local) {
+            ucred cred{};
+            socklen_t credLen = sizeof(cred);
+            if (getsockopt(clientSock, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) < 0) {
+                perror("getsockopt(SO_PEERCRED)");
+                close(clientSock);
+                continue;
+            }
+            dispatch(clientSock, "uid:" + to_string(cred.uid));
             continue;
         }
 
         // IP-Adresse des Clients als String holen
-        string clientIp = inet_ntoa(clientAddr.sin_addr);
+        char ipBuf[INET_ADDRSTRLEN];
+        string clientIp = inet_ntop(AF_INET, &clientAddr.sin_addr, ipBuf, sizeof(ipBuf));
 
-        // Direkt blocken, wenn IP bereits auf Blacklist
-        if (blacklist.isBlacklisted(clientIp)) {
-            send(clientSock, "ERR\n", 4, 0);
-            close(clientSock);
+        dispatch(clientSock, clientIp);
+    }
+}
+
+// Sessions, die noch laufen oder im Pool auf einen Worker warten
+size_t Server::pendingSessions() const {
+    size_t pending = stats_.activeSessions.load();
+    if (pool_) {
+        pending += pool_->queued();
+    }
+    return pending;
+}
+
+// Nach der Übergabe: laufende Sessions bis zur Drain-Frist zu Ende laufen lassen
+void Server::drainSessions() {
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(max(options_.drainTimeout, 0));
+    cout << "Übergabe abgeschlossen, warte auf " << pendingSessions() << " Session(s)" << endl;
+    while (pendingSessions() > 0 && chrono::steady_clock::now() < deadline) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+
+    size_t left = pendingSessions();
+    if (left > 0) {
+        // Session-Threads greifen noch auf Store & Co. zu → ohne Destruktoren beenden
+        cout << "Drain-Frist abgelaufen, beende " << left << " Session(s)" << endl;
+        _exit(0);
+    }
+}
+
+// Haupt-Serverloop
+bool Server::run() {
+    // sendfile() kennt kein MSG_NOSIGNAL: abgebrochene Verbindungen nicht per SIGPIPE beenden
+    signal(SIGPIPE, SIG_IGN);
+
+    // SIGUSR2 (Neustart) in allen Threads blockieren, der Haupt-Thread holt es per sigwait()
+    sigset_t restartSignal;
+    sigemptyset(&restartSignal);
+    sigaddset(&restartSignal, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &restartSignal, nullptr);
+
+    // Listener vom Vorgänger übernehmen oder selbst anlegen
+    // (ein Listening-Socket pro Acceptor, bei mehreren mit SO_REUSEPORT)
+    vector<int> listeners;
+    bool inherited = restart_.adoptListeners(listeners);
+    if (!inherited) {
+        int acceptorCount = options_.acceptors > 0 ? options_.acceptors : 1;
+        bool reusePort = acceptorCount > 1;
+        for (int i = 0; i < acceptorCount; ++i) {
+            int sock = -1;
+            if (!setupSocket(sock, reusePort)) {
+                for (int fd : listeners) {
+                    close(fd);
+                }
+                return false;
+            }
+            listeners.push_back(sock);
+        }
+    }
+
+    // Lokaler Listener zusätzlich zu den TCP-Listenern; nach einer Übergabe ist er
+    // bereits unter den übernommenen Sockets
+    vector<bool> local;
+    bool haveLocal = false;
+    for (int fd : listeners) {
+        int domain = AF_INET;
+        socklen_t len = sizeof(domain);
+        getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len);
+        local.push_back(domain == AF_UNIX);
+        haveLocal = haveLocal || domain == AF_UNIX;
+    }
+    if (!options_.unixPath.empty() && !haveLocal) {
+        int sock = -1;
+        if (!setupUnixSocket(sock)) {
+            for (int fd : listeners) {
+                close(fd);
+            }
+            return false;
+        }
+        listeners.push_back(sock);
+        local.push_back(true);
+    }
+    int acceptorCount = static_cast<int>(listeners.size());
+
+    if (pipe2(stopPipe_, O_CLOEXEC) < 0) {
+        perror("pipe2");
+        return false;
+    }
+
+    // Zentrale Komponenten einmalig anlegen
+    store_ = make_unique<MailStore>(spoolDir_, options_.layout, options_.cacheBytes,
+                                   options_.bodyCacheBytes, options_.syncWindowUs,
+                                   options_.compressBodies, stats_);
+    if (inherited) {
+        // Der Vorgänger liefert bis zu seiner Drain-Frist noch aus und löscht am selben Spool
+        store_->suspendCaches(chrono::steady_clock::now() +
+                              chrono::seconds(max(options_.drainTimeout, 0) + 1));
+    }
+    blacklist_ = make_unique<BlacklistManager>(spoolDir_ + "/blacklist.db"); // IP-Sperren
+    authenticator_ = make_unique<LdapAuthenticator>();                     // kümmert sich um LDAP-Login
+
+    if (!startMode()) {
+        return false;
+    }
+
+    cout << "twmailer-server listening on port " << port_
+         << ", spool dir: " << spoolDir_ << endl;
+    if (!options_.unixPath.empty()) {
+        cout << "Lokale Clients über " << options_.unixPath << endl;
+    }
+    int tcpCount = static_cast<int>(count(local.begin(), local.end(), false));
+    if (inherited) {
+        cout << acceptorCount << " Listener vom Vorgängerprozess übernommen" << endl;
+    } else if (tcpCount > 1) {
+        cout << tcpCount << " Acceptor-Threads mit SO_REUSEPORT" << endl;
+    }
+    startStatsReporter();
+
+    // Jeder Acceptor in einem eigenen Thread, der Haupt-Thread wartet auf Signale
+    vector<thread> acceptors;
+    for (int i = 0; i < acceptorCount; ++i) {
+        acceptors.emplace_back([this, sock = listeners[i], i, isLocal = local[i]]() {
+            acceptLoop(sock, i, isLocal);
+        });
+    }
+    restart_.notifyReady(); // Vorgänger darf jetzt aufhören anzunehmen
+
+    // Neustart: Nachfolger starten; scheitert er, läuft dieser Prozess einfach weiter
+    while (true) {
+        int sig = 0;
+        if (sigwait(&restartSignal, &sig) != 0) {
             continue;
         }
+        cout << "SIGUSR2: übergebe Listener an neuen Prozess" << endl;
+        if (HotRestart::handOver(options_.restartArgs, listeners, HANDOVER_TIMEOUT)) {
+            break;
+        }
+        cerr << "Übergabe fehlgeschlagen, Server läuft weiter" << endl;
+    }
 
-        // Für jede Verbindung ein eigener Thread mit eigener ClientSession
-        thread([clientSock, clientIp, &store, &blacklist, &authenticator]() {
-            ClientSession session(clientSock, clientIp, store, blacklist, authenticator);
-            session.run(); // bearbeitet Kommandos bis zum QUIT oder Verbindungsende
-        }).detach(); // Thread loslösen, kein join nötig
+    // Annahme beenden; die Listener gehören jetzt dem Nachfolger. Ab jetzt schreibt und
+    // löscht auch er, die eigenen Caches erführen davon nichts
+    store_->suspendCaches(chrono::steady_clock::time_point::max());
+    if (write(stopPipe_[1], "x", 1) < 0) {
+        perror("write");
+    }
+    for (auto &t : acceptors) {
+        t.join();
+    }
+    for (int fd : listeners) {
+        close(fd);
     }
 
-    // wird faktisch nie erreicht, da while(true)
-    close(serverSock);
+    drainSessions();
     return true;
 }
@@ -1,27 +1,104 @@
 #pragma once
 
+#include "HotRestart.h"
+#include "MailStore.h"
+#include "ServerStats.h"
+#include "SessionLimits.h"
+
+#include <atomic>
+#include <memory>
 #include <string>
+#include <vector>
 
-class MailStore;
 class BlacklistManager;
 class LdapAuthenticator;
+class WorkerPool;
+class EventLoop;
+class UringLoop;
+class DiskStage;
+
+/// Betriebsart, in der der Server akzeptierte Verbindungen abarbeitet.
+enum class ServerMode {
+    Threads, ///< ein blockierender Thread pro Verbindung
+    Pool,    ///< fester Worker-Pool mit begrenzter Queue und BUSY-Ablehnung
+    Reactor, ///< nicht-blockierende Sockets auf wenigen epoll-Loop-Threads
+    Uring    ///< io_uring-Loops mit gebündelten Empfangs-/Sendeaufträgen
+};
+
+/// Einstellungen des Servers, die über die Kommandozeile gesetzt werden.
+struct ServerOptions {
+    ServerMode mode = ServerMode::Threads;
+    int loopThreads = 2; ///< Anzahl der Loop-Threads im Reaktor- bzw. io_uring-Modus
+    int poolSize = 16;   ///< Worker-Threads im Pool-Modus
+    int queueDepth = 64; ///< maximale Anzahl wartender Verbindungen im Pool-Modus
+    std::string busyReply = "BUSY"; ///< Antwortzeile bei voller Queue
+    int statsInterval = 0; ///< Sekunden zwischen Statistik-Ausgaben (0 = aus)
+    int acceptors = 1;   ///< Acceptor-Threads; >1 → je ein eigener SO_REUSEPORT-Listener
+    bool pinAcceptors = false; ///< Acceptor-Threads reihum an CPUs binden
+    int backlog = 20;    ///< listen()-Backlog pro Listening-Socket
+    SessionLimits limits; ///< Zeit- und Größenlimits pro Session
+    int drainTimeout = 30; ///< Sekunden, die alte Sessions nach einer Übergabe weiterlaufen dürfen
+    std::vector<std::string> restartArgs; ///< Kommandozeile für den Neustart per SIGUSR2
+    std::string unixPath; ///< Pfad eines zusätzlichen AF_UNIX-Listeners (leer = keiner)
+    size_t cacheBytes = size_t{64} << 20; ///< Budget des Postfach-Metadaten-Caches (0 = aus)
+    size_t bodyCacheBytes = size_t{64} << 20; ///< Budget des BodyCache (0 = aus)
+    int syncWindowUs = -1;   ///< durable-Modus: Gruppen-Commit-Fenster in µs (-1 = aus)
+    int diskWorkers = 4;     ///< Disk-Worker im Reaktor-/io_uring-Modus (0 = im Loop-Thread)
+    bool compressBodies = false; ///< neue Bodies komprimiert ablegen (BodyCompressor)
+    StoreLayout layout = StoreLayout::Files; ///< Ablage der Nachrichten im Spool
+};
 
 /// Hauptklasse für den TW-Mailer-Server.
 /// Öffnet den Listening-Socket, akzeptiert Clients und startet Session-Threads.
+/// Optional nimmt ein zusätzlicher AF_UNIX-Listener lokale Clients (Gateways, Jobs)
+/// am TCP-Stack vorbei an; sie werden über SO_PEERCRED als "uid:<n>" geführt.
 class Server {
 public:
     /// Erstellt den Server mit Port und Spool-Verzeichnis.
     /// @param port TCP-Port für eingehende Verbindungen.
     /// @param spoolDir Verzeichnis für alle Maildaten.
-    Server(int port, std::string spoolDir);
+    /// @param options Betriebsart und Tuning-Parameter.
+    Server(int port, std::string spoolDir, ServerOptions options = ServerOptions());
 
     /// Startet den Accept-Loop und bedient Clients parallel.
+    /// Bei SIGUSR2 werden die Listener an einen neu gestarteten Prozess übergeben;
+    /// danach nimmt dieser Prozess nichts mehr an und endet, sobald alle Sessions
+    /// beendet sind oder die Drain-Frist abgelaufen ist.
     /// @return true, falls der Server erfolgreich beendet wurde.
     bool run();
 
+    ~Server();
+
 private:
     int port_;
     std::string spoolDir_;
+    ServerOptions options_;
+    ServerStats stats_;
+
+    // Zentrale Komponenten, werden in run() angelegt
+    std::unique_ptr<MailStore> store_;
+    std::unique_ptr<BlacklistManager> blacklist_;
+    std::unique_ptr<LdapAuthenticator> authenticator_;
+
+    // Ressourcen der jeweiligen Betriebsart
+    std::unique_ptr<WorkerPool> pool_;
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+    std::vector<std::unique_ptr<UringLoop>> uringLoops_;
+    std::unique_ptr<DiskStage> disk_; // nach den Loops: wird vor ihnen abgebaut
+    std::atomic<size_t> nextLoop_{0};
+    std::string busyLine_;
+
+    // Übergabe an einen Nachfolgeprozess
+    HotRestart restart_;
+    int stopPipe_[2] = {-1, -1}; // lesbar → Acceptors beenden ihre Schleife
 
-    bool setupSocket(int &sockfd);
+    bool setupSocket(int &sockfd, bool reusePort);
+    bool setupUnixSocket(int &sockfd);
+    bool startMode();
+    void startStatsReporter();
+    void acceptLoop(int serverSock, int acceptorIndex, bool local);
+    void dispatch(int clientSock, const std::string &clientIp);
+    void runSession(int clientSock, const std::string &clientIp);
+    size_t pendingSessions() const;
+    void drainSessions();
 };
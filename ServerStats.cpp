@@ -0,0 +1,111 @@
+#include "ServerStats.h"
+
+#include <sstream>
+
+namespace {
+    constexpr const char *COMMAND_NAMES[] = {"login", "send", "list", "read", "del", "mread", "mdel"};
+
+    void raiseMax(std::atomic<uint64_t> &max, uint64_t value) {
+        uint64_t prev = max.load();
+        while (value > prev && !max.compare_exchange_weak(prev, value)) {
+        }
+    }
+
+    void record(CommandTiming &t, uint64_t micros) {
+        ++t.count;
+        t.totalMicros += micros;
+        raiseMax(t.maxMicros, micros);
+    }
+}
+
+using namespace std;
+
+void ServerStats::recordCommand(StatCommand cmd, uint64_t micros) {
+    record(commands[static_cast<size_t>(cmd)], micros);
+}
+
+void ServerStats::recordSyncBatch(uint64_t members) {
+    ++syncBatches;
+    syncWaits += members;
+    raiseMax(syncMaxBatch, members);
+}
+
+void ServerStats::recordSyncWait(uint64_t micros) {
+    record(syncLatency, micros);
+}
+
+string ServerStats::summary() const {
+    ostringstream out;
+    out << "accepted=" << accepted.load()
+        << " blacklisted=" << blacklisted.load()
+        << " rejected_busy=" << rejectedBusy.load()
+        << " active=" << activeSessions.load()
+        << " idle_timeouts=" << idleTimeouts.load()
+        << " command_timeouts=" << commandTimeouts.load()
+        << " body_too_large=" << bodyTooLarge.load()
+        << " line_too_long=" << lineTooLong.load();
+
+    uint64_t plain = compressPlain.load();
+    if (plain > 0) {
+        uint64_t wire = compressWire.load();
+        out << " compress_plain=" << plain << " compress_wire=" << wire
+            << " compress_saved=" << (plain > wire ? plain - wire : 0);
+    }
+
+    uint64_t hits = cacheHits.load();
+    uint64_t misses = cacheMisses.load();
+    if (hits + misses > 0) {
+        out << " cache_hits=" << hits << " cache_misses=" << misses
+            << " cache_evictions=" << cacheEvictions.load() << " cache_bytes=" << cacheBytes.load();
+    }
+
+    uint64_t bodyHitCount = bodyHits.load();
+    uint64_t bodyMissCount = bodyMisses.load();
+    if (bodyHitCount + bodyMissCount > 0) {
+        out << " body_hits=" << bodyHitCount << " body_misses=" << bodyMissCount
+            << " body_rejected=" << bodyRejected.load() << " body_evictions=" << bodyEvictions.load()
+            << " body_bytes=" << bodyBytes.load();
+    }
+
+    // Gruppen-Commit: Gruppengröße und Wartezeit der Schreiber
+    uint64_t batches = syncBatches.load();
+    uint64_t waits = syncLatency.count.load();
+    if (batches > 0 && waits > 0) {
+        out << " sync_batches=" << batches << " sync_avg_batch=" << syncWaits.load() / batches
+            << " sync_max_batch=" << syncMaxBatch.load()
+            << " sync_wait=avg" << syncLatency.totalMicros.load() / waits << "us"
+            << "/max" << syncLatency.maxMicros.load() << "us";
+    }
+
+    // Disk-Stufe: Aufträge, gesammelte Durchgänge und Gegendruck
+    uint64_t jobs = diskJobs.load();
+    if (jobs > 0) {
+        out << " disk_jobs=" << jobs << " disk_batches=" << diskBatches.load()
+            << " disk_queue_full=" << diskQueueFull.load();
+    }
+
+    // SEND an mehrere Empfänger: geteilte Nachrichtendateien statt Kopien
+    uint64_t links = fanoutLinks.load();
+    if (links > 0) {
+        out << " fanout_links=" << links << " fanout_saved=" << fanoutSaved.load();
+    }
+
+    // Kompression der Bodies im Spool: Klartext gegen geschriebene Bytes
+    uint64_t zipped = zipPlain.load();
+    if (zipped > 0) {
+        out << " zip_bodies=" << zipBodies.load() << " zip_plain=" << zipped
+            << " zip_stored=" << zipStored.load();
+    }
+
+    // Pro Kommando: Anzahl, durchschnittliche und maximale Laufzeit
+    for (size_t i = 0; i < static_cast<size_t>(StatCommand::Count); ++i) {
+        uint64_t n = commands[i].count.load();
+        if (n == 0) {
+            continue;
+        }
+        out << " " << COMMAND_NAMES[i] << "=" << n
+            << "/avg" << commands[i].totalMicros.load() / n << "us"
+            << "/max" << commands[i].maxMicros.load() << "us";
+    }
+    return out.str();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/// Kommandos mit eigener Laufzeitmessung.
+enum class StatCommand { Login, Send, List, Read, Delete, MultiRead, MultiDelete, Count };
+
+/// Laufzeit eines Kommandotyps: Anzahl, Summe und Maximum in Mikrosekunden.
+struct CommandTiming {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> totalMicros{0};
+    std::atomic<uint64_t> maxMicros{0};
+};
+
+/// Zähler für den Serverbetrieb, die von mehreren Threads gleichzeitig erhöht werden.
+/// Wird vom Server periodisch als eine Log-Zeile ausgegeben (Option -s).
+struct ServerStats {
+    std::atomic<uint64_t> accepted{0};       ///< angenommene Verbindungen
+    std::atomic<uint64_t> blacklisted{0};    ///< wegen Blacklist sofort abgewiesen
+    std::atomic<uint64_t> rejectedBusy{0};   ///< wegen voller Worker-Queue abgewiesen
+    std::atomic<uint64_t> activeSessions{0}; ///< aktuell laufende Sessions
+    std::atomic<uint64_t> idleTimeouts{0};   ///< wegen Leerlauf zwischen Kommandos beendet
+    std::atomic<uint64_t> commandTimeouts{0}; ///< Kommando (inkl. Antwort) hat die Frist überschritten
+    std::atomic<uint64_t> bodyTooLarge{0};   ///< SEND-Body über der maximalen Größe
+    std::atomic<uint64_t> lineTooLong{0};    ///< Zeile über der maximalen Länge
+    std::atomic<uint64_t> compressPlain{0};  ///< Antwortbytes vor der Kompression (COMPRESS aktiv)
+    std::atomic<uint64_t> compressWire{0};   ///< dieselben Antworten als Frames auf der Leitung
+    std::atomic<uint64_t> cacheHits{0};      ///< Postfach-Metadaten aus dem Cache bedient
+    std::atomic<uint64_t> cacheMisses{0};    ///< Postfach nicht (mehr) im Cache
+    std::atomic<uint64_t> cacheEvictions{0}; ///< wegen des Speicherbudgets verdrängte Postfächer
+    std::atomic<uint64_t> cacheBytes{0};     ///< aktuell belegter Cache-Speicher
+    std::atomic<uint64_t> bodyHits{0};       ///< READ/MREAD aus dem Body-Cache bedient
+    std::atomic<uint64_t> bodyMisses{0};     ///< Nachricht nicht im Body-Cache
+    std::atomic<uint64_t> bodyRejected{0};   ///< vom Häufigkeitsfilter nicht aufgenommen
+    std::atomic<uint64_t> bodyEvictions{0};  ///< zugunsten häufiger gelesener verdrängt
+    std::atomic<uint64_t> bodyBytes{0};      ///< aktuell belegter Body-Cache-Speicher
+    std::atomic<uint64_t> syncBatches{0};    ///< Gruppen-Commits (ein syncfs() je Gruppe)
+    std::atomic<uint64_t> syncWaits{0};      ///< darin bediente Wartende
+    std::atomic<uint64_t> syncMaxBatch{0};   ///< größte Gruppe
+    std::atomic<uint64_t> diskJobs{0};       ///< Aufträge an die Disk-Stufe
+    std::atomic<uint64_t> diskBatches{0};    ///< Durchgänge der Disk-Worker (ein Postfach je)
+    std::atomic<uint64_t> diskQueueFull{0};  ///< Aufträge, die auf Platz in der Queue warteten
+    std::atomic<uint64_t> fanoutLinks{0};    ///< SEND-Empfänger, die die Datei nur verlinkt bekamen
+    std::atomic<uint64_t> fanoutSaved{0};    ///< dadurch nicht geschriebene Body-Bytes
+    std::atomic<uint64_t> zipBodies{0};      ///< komprimiert gespeicherte Bodies (Option -Z)
+    std::atomic<uint64_t> zipPlain{0};       ///< Body-Bytes aller SENDs mit -Z vor der Kompression
+    std::atomic<uint64_t> zipStored{0};      ///< davon tatsächlich geschriebene Bytes
+
+    /// Laufzeit der Handler (Store-Zugriff und Aufbereiten der Antwort, ohne Netzwerk).
+    CommandTiming commands[static_cast<size_t>(StatCommand::Count)];
+
+    /// Wartezeit auf den Gruppen-Commit (durable-Modus), Zählung in syncLatency.count.
+    CommandTiming syncLatency;
+
+    /// Erfasst eine Kommandoausführung.
+    /// @param cmd Kommandotyp.
+    /// @param micros Dauer in Mikrosekunden.
+    void recordCommand(StatCommand cmd, uint64_t micros);
+
+    /// Erfasst einen abgeschlossenen Gruppen-Commit.
+    /// @param members Anzahl der Wartenden, die er bedient hat.
+    void recordSyncBatch(uint64_t members);
+
+    /// Erfasst die Wartezeit eines Aufrufers auf seinen Gruppen-Commit.
+    /// @param micros Dauer in Mikrosekunden.
+    void recordSyncWait(uint64_t micros);
+
+    /// @return Alle Zähler als einzeilige "key=value"-Liste (Kommandos nur, wenn ausgeführt).
+    std::string summary() const;
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "LineFramer.h"
+
+#include <cstddef>
+
+/// Grenzen pro Client-Session gegen langsame oder böswillige Clients.
+/// Jede Überschreitung führt zu einem ERR und zum Verbindungsabbau und wird in
+/// ServerStats gezählt. Ein Wert von 0 schaltet die jeweilige Grenze ab.
+struct SessionLimits {
+    int idleTimeout = 0;       ///< Sekunden ohne Kommando, bevor die Session beendet wird
+    int commandTimeout = 60;   ///< Sekunden, die ein einzelnes Kommando inkl. Antwort dauern darf
+    size_t maxBody = 16 * 1024 * 1024;             ///< maximale Body-Größe bei SEND in Bytes
+    size_t maxLine = LineFramer::DEFAULT_MAX_LINE; ///< maximale Zeilenlänge in Bytes
+};
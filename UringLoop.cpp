@@ -0,0 +1,498 @@
+#include "UringLoop.h"
+
+#include "ClientSession.h"
+#include "ServerStats.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    constexpr unsigned RING_ENTRIES = 256;  // Einträge im Submission-Ring
+    constexpr size_t RECV_BUFFER = 16384;   // Empfangspuffer pro Verbindung
+    constexpr size_t SEND_IOV = 64;         // Antwortsegmente pro SENDMSG
+
+    // Markierungen im user_data-Feld (Connection-Zeiger ist mind. 8-Byte-aligned)
+    constexpr uint64_t TAG_RECV = 1;
+    constexpr uint64_t TAG_SEND = 2;
+    constexpr uint64_t TAG_MASK = 7;
+    constexpr uint64_t WAKE_DATA = 0;
+    constexpr uint64_t TIMER_DATA = 3; // kein Connection-Zeiger, nur die Markierung
+
+    int sysSetup(unsigned entries, io_uring_params *p) {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+    }
+
+    int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags,
+                                        nullptr, 0));
+    }
+
+    int sysRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs) {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+    }
+}
+
+using namespace std;
+
+// Zustand einer Verbindung im Loop: Session plus Puffer für den laufenden Auftrag
+struct UringLoop::Connection {
+    unique_ptr<ClientSession> session;
+    bool sending = false; // laufender Auftrag ist SENDMSG (sonst RECV oder keiner)
+    bool expired = false; // Frist abgelaufen, ERR wird noch gesendet
+    bool parked = false;  // WAIT: kein Auftrag unterwegs, bis Post kommt oder die Zeit abläuft
+    char buffer[RECV_BUFFER];
+    iovec iov[SEND_IOV];
+    msghdr msg;
+};
+
+UringLoop::UringLoop(ServerStats &stats) : stats_(stats) {}
+
+UringLoop::~UringLoop() {
+    stop();
+    if (sqes_) {
+        munmap(sqes_, sqesSize_);
+    }
+    if (cqRing_ && cqRing_ != sqRing_) {
+        munmap(cqRing_, cqRingSize_);
+    }
+    if (sqRing_) {
+        munmap(sqRing_, sqRingSize_);
+    }
+    if (ringFd_ >= 0) {
+        close(ringFd_);
+    }
+    if (wakeFd_ >= 0) {
+        close(wakeFd_);
+    }
+}
+
+// Kurzer Test-Ring: existiert io_uring und kennt der Kernel RECV, SENDMSG, READ und TIMEOUT?
+bool UringLoop::isSupported() {
+    io_uring_params params{};
+    int fd = sysSetup(4, &params);
+    if (fd < 0) {
+        return false;
+    }
+
+    const size_t probeSize = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    vector<unsigned char> storage(probeSize, 0);
+    auto *probe = reinterpret_cast<io_uring_probe *>(storage.data());
+    bool ok = sysRegister(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    if (ok) {
+        for (unsigned op : {IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_READ, IORING_OP_TIMEOUT}) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                ok = false;
+            }
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+// Ring anlegen und Submission-/Completion-Queue in den Prozess mappen
+bool UringLoop::setupRing(unsigned entries) {
+    io_uring_params params{};
+    ringFd_ = sysSetup(entries, &params);
+    if (ringFd_ < 0) {
+        perror("io_uring_setup");
+        return false;
+    }
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) {
+        sqRingSize_ = cqRingSize_ = max(sqRingSize_, cqRingSize_);
+    }
+
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ringFd_, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED) {
+        sqRing_ = nullptr;
+        perror("mmap");
+        return false;
+    }
+
+    if (singleMmap) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ringFd_, IORING_OFF_CQ_RING);
+        if (cqRing_ == MAP_FAILED) {
+            cqRing_ = nullptr;
+            perror("mmap");
+            return false;
+        }
+    }
+
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ringFd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+    auto *sq = static_cast<char *>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqEntries_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+    sqArray_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+    auto *cq = static_cast<char *>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+}
+
+bool UringLoop::start() {
+    if (!setupRing(RING_ENTRIES)) {
+        return false;
+    }
+
+    // eventfd weckt den Loop, wenn der Accept-Thread neue Sessions übergibt
+    wakeFd_ = eventfd(0, EFD_CLOEXEC);
+    if (wakeFd_ < 0) {
+        perror("eventfd");
+        return false;
+    }
+
+    thread_ = thread([this]() { loop(); });
+    return true;
+}
+
+void UringLoop::stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    stopping_ = true;
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd_, &one, sizeof(one));
+    (void)ignored;
+    thread_.join();
+}
+
+void UringLoop::addSession(unique_ptr<ClientSession> session) {
+    // Schon beim Einreihen zählen: sonst sieht drainSessions() eine gerade angenommene
+    // Verbindung, die der Loop noch nicht übernommen hat, nicht und beendet den Prozess
+    ++stats_.activeSessions;
+    {
+        lock_guard<mutex> lock(mtx_);
+        incoming_.push_back(move(session));
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd_, &one, sizeof(one));
+    (void)ignored;
+}
+
+// Freien SQE holen; ist der Ring voll, werden die gesammelten Aufträge zuerst abgeschickt
+io_uring_sqe *UringLoop::nextSqe() {
+    unsigned tail = *sqTail_;
+    while (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+        submitAndWait(0);
+    }
+
+    unsigned index = tail & sqMask_;
+    io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+    ++pendingSubmit_;
+    return sqe;
+}
+
+// Alle gesammelten Aufträge mit einem Syscall abschicken und ggf. auf Completions warten
+void UringLoop::submitAndWait(unsigned minComplete) {
+    while (true) {
+        int ret = sysEnter(ringFd_, pendingSubmit_, minComplete,
+                           minComplete > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (ret >= 0) {
+            pendingSubmit_ -= min(pendingSubmit_, static_cast<unsigned>(ret));
+            return;
+        }
+        if (errno != EINTR) {
+            perror("io_uring_enter");
+            return;
+        }
+    }
+}
+
+void UringLoop::queueWakeRead() {
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakeFd_;
+    sqe->addr = reinterpret_cast<uint64_t>(&wakeValue_);
+    sqe->len = sizeof(wakeValue_);
+    sqe->user_data = WAKE_DATA;
+}
+
+void UringLoop::queueRecv(Connection &conn) {
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.session->fd();
+    sqe->addr = reinterpret_cast<uint64_t>(conn.buffer);
+    sqe->len = sizeof(conn.buffer);
+    sqe->user_data = reinterpret_cast<uint64_t>(&conn) | TAG_RECV;
+    conn.sending = false;
+}
+
+// Alle gesammelten Antworten einer Verbindung als ein SENDMSG-Auftrag
+void UringLoop::queueSend(Connection &conn) {
+    conn.msg = msghdr{};
+    conn.msg.msg_iov = conn.iov;
+    conn.msg.msg_iovlen = conn.session->outputIov(conn.iov, SEND_IOV);
+
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn.session->fd();
+    sqe->addr = reinterpret_cast<uint64_t>(&conn.msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = reinterpret_cast<uint64_t>(&conn) | TAG_SEND;
+    conn.sending = true;
+}
+
+// Nächsten Schritt einer Verbindung einreihen: erst alle Antworten senden,
+// dann wieder empfangen; pro Verbindung ist höchstens ein Auftrag unterwegs.
+// Eine Session in WAIT wird ohne Auftrag geparkt
+void UringLoop::advance(Connection &conn) {
+    conn.parked = false;
+    if (conn.session->hasPendingOutput()) {
+        queueSend(conn);
+    } else if (conn.session->finished()) {
+        closeConnection(conn);
+    } else if (conn.session->waiting()) {
+        conn.parked = true;
+        conn.sending = false;
+    } else {
+        queueRecv(conn);
+    }
+}
+
+// Neue Post für eine wartende Verbindung (aus dem speichernden Thread)
+void UringLoop::notify(Connection *conn) {
+    {
+        lock_guard<mutex> lock(mtx_);
+        notified_.push_back(conn);
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd_, &one, sizeof(one));
+    (void)ignored;
+}
+
+// Geweckte Verbindungen beantworten ihr WAIT (läuft im Loop-Thread). Läuft gerade ein
+// SENDMSG, bleibt die Session bis zu dessen Completion unangetastet
+void UringLoop::processNotified() {
+    vector<Connection *> batch;
+    {
+        lock_guard<mutex> lock(mtx_);
+        batch.swap(notified_);
+    }
+
+    for (Connection *conn : batch) {
+        if (connections_.count(conn) == 0 || conn->sending) {
+            continue; // beim Senden holt handleCompletion() den Weckruf nach
+        }
+        conn->session->onNotify();
+        // Auch weiter wartend senden, was schon fertig ist (z.B. die Antwort eines Disk-Auftrags
+        // vor einem gepipelinten WAIT); advance() parkt danach erneut
+        if (conn->parked && (!conn->session->waiting() || conn->session->hasPendingOutput())) {
+            schedule(*conn);
+            advance(*conn);
+        }
+    }
+}
+
+void UringLoop::closeConnection(Connection &conn) {
+    close(conn.session->fd());
+    if (connections_.erase(&conn) > 0) {
+        --stats_.activeSessions;
+    }
+}
+
+// Übergebene Sessions übernehmen (läuft im Loop-Thread)
+void UringLoop::adoptIncoming() {
+    vector<unique_ptr<ClientSession>> batch;
+    {
+        lock_guard<mutex> lock(mtx_);
+        batch.swap(incoming_);
+    }
+
+    for (auto &session : batch) {
+        auto conn = make_unique<Connection>();
+        conn->session = move(session);
+        conn->session->start(); // gesperrte IP: ERR wird gesendet, danach geschlossen
+        Connection &ref = *conn;
+        ref.session->setWakeHandler([this, c = &ref]() { notify(c); });
+        connections_[&ref] = move(conn);
+        schedule(ref);
+        advance(ref);
+    }
+}
+
+void UringLoop::handleCompletion(const io_uring_cqe &cqe) {
+    if (cqe.user_data == WAKE_DATA) {
+        if (!stopping_) {
+            adoptIncoming();
+            processNotified();
+            queueWakeRead();
+        }
+        return;
+    }
+
+    if (cqe.user_data == TIMER_DATA) {
+        timerAt_ = ClientSession::Clock::time_point::max(); // beim nächsten armTimer() neu stellen
+        expireConnections();
+        return;
+    }
+
+    auto *conn = reinterpret_cast<Connection *>(cqe.user_data & ~TAG_MASK);
+    uint64_t tag = cqe.user_data & TAG_MASK;
+
+    // Vorübergehende Fehler: denselben Auftrag erneut einreihen
+    if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+        tag == TAG_RECV ? queueRecv(*conn) : queueSend(*conn);
+        return;
+    }
+
+    ClientSession::Clock::time_point before = conn->session->deadline();
+    if (tag == TAG_RECV) {
+        if (cqe.res <= 0 && !conn->expired) {
+            closeConnection(*conn); // EOF oder Fehler
+            return;
+        }
+        if (cqe.res > 0) {
+            conn->session->onData(conn->buffer, static_cast<size_t>(cqe.res));
+        }
+    } else {
+        if (cqe.res < 0) {
+            closeConnection(*conn);
+            return;
+        }
+        conn->session->outputSent(static_cast<size_t>(cqe.res));
+
+        // Während des Sendens eingetroffene Weckrufe bzw. abgelaufenes WAIT nachholen
+        if (conn->session->inWait() &&
+            conn->session->deadline() <= ClientSession::Clock::now()) {
+            conn->session->expire();
+        } else {
+            conn->session->onNotify();
+        }
+    }
+    if (conn->session->deadline() < before) {
+        schedule(*conn);
+    }
+    advance(*conn);
+}
+
+// Frist einer Verbindung in den Heap eintragen (ohne aktives Limit nicht nötig)
+void UringLoop::schedule(Connection &conn) {
+    ClientSession::Clock::time_point at = conn.session->deadline();
+    if (at != ClientSession::Clock::time_point::max()) {
+        timers_.push({at, &conn});
+    }
+}
+
+// TIMEOUT-Auftrag für den frühesten Heap-Eintrag stellen, falls noch keiner früh genug steht
+void UringLoop::armTimer() {
+    if (timers_.empty() || timers_.top().at >= timerAt_) {
+        return;
+    }
+    timerAt_ = timers_.top().at;
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(timerAt_.time_since_epoch()).count();
+    timerSpec_.tv_sec = ns / 1000000000;
+    timerSpec_.tv_nsec = ns % 1000000000;
+
+    // Absolute Zeit auf CLOCK_MONOTONIC, derselben Uhr wie steady_clock
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(&timerSpec_);
+    sqe->len = 1;
+    sqe->timeout_flags = IORING_TIMEOUT_ABS;
+    sqe->user_data = TIMER_DATA;
+}
+
+// Fällige Heap-Einträge prüfen; verschobene Fristen neu eintragen, abgelaufene beenden
+void UringLoop::expireConnections() {
+    ClientSession::Clock::time_point now = ClientSession::Clock::now();
+    while (!timers_.empty() && timers_.top().at <= now) {
+        Connection *conn = timers_.top().conn;
+        timers_.pop();
+
+        if (connections_.count(conn) == 0 || conn->expired) {
+            continue;
+        }
+        if (conn->session->deadline() > now) {
+            schedule(*conn);
+            continue;
+        }
+
+        // Abgelaufenes WAIT: leere Antwort senden; läuft ein SENDMSG, erledigt das
+        // handleCompletion() nach dessen Completion
+        if (conn->sending && conn->session->inWait()) {
+            continue;
+        }
+        if (conn->session->expire()) {
+            schedule(*conn);
+            if (conn->parked) {
+                advance(*conn);
+            }
+            continue;
+        }
+
+        // Der laufende Auftrag wird per shutdown() beendet: ein wartendes RECV liefert EOF,
+        // danach geht ERR raus; ein hängendes SENDMSG (Client liest nicht) schlägt fehl
+        conn->expired = true;
+        bool sending = conn->sending;
+        shutdown(conn->session->fd(), sending ? SHUT_RDWR : SHUT_RD);
+    }
+}
+
+// Haupt-Loop: Aufträge gebündelt abschicken, Completions abarbeiten
+void UringLoop::loop() {
+    queueWakeRead();
+
+    while (!stopping_) {
+        armTimer();
+        submitAndWait(1);
+
+        unsigned head = *cqHead_;
+        unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            io_uring_cqe cqe = cqes_[head & cqMask_];
+            ++head;
+            __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+            handleCompletion(cqe);
+            if (stopping_) {
+                break;
+            }
+            tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    // Beim Stoppen alle verbliebenen Verbindungen schließen; die Puffer bleiben bis zum
+    // Schließen des Rings im Destruktor erhalten, da noch Aufträge darauf zeigen können
+    for (auto &entry : connections_) {
+        close(entry.first->session->fd());
+        --stats_.activeSessions;
+    }
+
+    // Auch noch nicht übernommene Verbindungen, die addSession() schon gezählt hat
+    lock_guard<mutex> lock(mtx_);
+    for (auto &session : incoming_) {
+        close(session->fd());
+        --stats_.activeSessions;
+    }
+    incoming_.clear();
+}
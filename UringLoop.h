@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <linux/io_uring.h>
+
+class ClientSession;
+struct ServerStats;
+
+/// io_uring-basierter I/O-Loop als Alternative zum epoll-Reaktor.
+/// Statt auf Bereitschaft zu warten und danach recv()/send() aufzurufen, werden
+/// Empfangs- und Sendeaufträge (RECV/SENDMSG) direkt in den Submission-Ring gestellt und gesammelt
+/// mit einem einzigen io_uring_enter() abgeschickt. Die Sessions laufen als derselbe
+/// Zustandsautomat wie im Reaktor-Modus. Verwendet die rohen Syscalls, keine liburing.
+/// Session-Fristen liegen in einem Min-Heap pro Loop; für den frühesten Eintrag steht
+/// ein einzelner TIMEOUT-Auftrag im Ring.
+class UringLoop {
+public:
+    /// @param stats Gemeinsame Serverzähler (aktive Sessions).
+    explicit UringLoop(ServerStats &stats);
+    ~UringLoop();
+
+    UringLoop(const UringLoop &) = delete;
+    UringLoop &operator=(const UringLoop &) = delete;
+
+    /// Prüft, ob der Kernel io_uring mit RECV/SENDMSG/READ/TIMEOUT unterstützt.
+    /// @return false auf Kerneln ohne (ausreichendes) io_uring.
+    static bool isSupported();
+
+    /// Legt den Ring an und startet den Loop-Thread.
+    /// @return true bei Erfolg.
+    bool start();
+
+    /// Übergibt eine neue Session an den Loop (thread-sicher, aus dem Accept-Thread).
+    /// @param session Session mit blockierendem Socket, Besitz geht an den Loop über.
+    void addSession(std::unique_ptr<ClientSession> session);
+
+    /// Beendet den Loop-Thread und schließt alle noch offenen Sessions.
+    void stop();
+
+private:
+    struct Connection;
+
+    ServerStats &stats_;
+    int ringFd_ = -1;
+    int wakeFd_ = -1;
+    uint64_t wakeValue_ = 0;
+    std::thread thread_;
+    std::atomic<bool> stopping_{false};
+
+    // Gemappte Ringe
+    void *sqRing_ = nullptr;
+    size_t sqRingSize_ = 0;
+    void *cqRing_ = nullptr;
+    size_t cqRingSize_ = 0;
+    io_uring_sqe *sqes_ = nullptr;
+    size_t sqesSize_ = 0;
+
+    unsigned *sqHead_ = nullptr;
+    unsigned *sqTail_ = nullptr;
+    unsigned sqMask_ = 0;
+    unsigned sqEntries_ = 0;
+    unsigned *sqArray_ = nullptr;
+    unsigned *cqHead_ = nullptr;
+    unsigned *cqTail_ = nullptr;
+    unsigned cqMask_ = 0;
+    io_uring_cqe *cqes_ = nullptr;
+    unsigned pendingSubmit_ = 0;
+
+    std::mutex mtx_;
+    std::vector<std::unique_ptr<ClientSession>> incoming_; // vom Accept-Thread übergeben
+    std::vector<Connection *> notified_;                   // geweckte WAIT-Verbindungen
+
+    std::unordered_map<Connection *, std::unique_ptr<Connection>> connections_; // nur im Loop-Thread
+
+    /// Heap-Eintrag: spätestens zu diesem Zeitpunkt wird die Frist der Verbindung geprüft.
+    struct Timer {
+        std::chrono::steady_clock::time_point at;
+        Connection *conn;
+        bool operator>(const Timer &other) const { return at > other.at; }
+    };
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+    std::chrono::steady_clock::time_point timerAt_ = std::chrono::steady_clock::time_point::max();
+    __kernel_timespec timerSpec_{};
+
+    bool setupRing(unsigned entries);
+    io_uring_sqe *nextSqe();
+    void submitAndWait(unsigned minComplete);
+
+    void queueWakeRead();
+    void queueRecv(Connection &conn);
+    void queueSend(Connection &conn);
+    void adoptIncoming();
+    void notify(Connection *conn);
+    void processNotified();
+    void handleCompletion(const io_uring_cqe &cqe);
+    void advance(Connection &conn);
+    void closeConnection(Connection &conn);
+    void schedule(Connection &conn);
+    void armTimer();
+    void expireConnections();
+
+    void loop();
+};
@@ -0,0 +1,137 @@
+#include "WireCompressor.h"
+
+#include <algorithm>
+
+namespace {
+    constexpr size_t FRAME_HEADER = 5;           // Typ + 4-Byte-Länge
+    constexpr size_t MAX_FRAME_PLAIN = 65536;    // Klartext pro Frame (größere Daten → mehrere Frames)
+    constexpr size_t MAX_FRAME_WIRE = 2 * MAX_FRAME_PLAIN; // größere Frames werden abgelehnt
+    constexpr size_t INFLATE_CHUNK = 16384;      // Ausgabepuffer pro inflate()-Aufruf
+    constexpr int WINDOW_BITS = 13;              // 8 KiB Fenster, rohes deflate ohne zlib-Header
+    constexpr int MEM_LEVEL = 6;                 // ca. 64 KiB Kompressorzustand pro Verbindung
+}
+
+using namespace std;
+
+WireCompressor::WireCompressor(size_t threshold) : threshold_(threshold) {
+    deflateReady_ = deflateInit2(&deflate_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -WINDOW_BITS,
+                                 MEM_LEVEL, Z_DEFAULT_STRATEGY) == Z_OK;
+    inflateReady_ = inflateInit2(&inflate_, -WINDOW_BITS) == Z_OK;
+}
+
+WireCompressor::~WireCompressor() {
+    if (deflateReady_) {
+        deflateEnd(&deflate_);
+    }
+    if (inflateReady_) {
+        inflateEnd(&inflate_);
+    }
+}
+
+void WireCompressor::appendFrame(char type, string_view payload, string &out) {
+    uint32_t len = static_cast<uint32_t>(payload.size());
+    char header[FRAME_HEADER] = {type, static_cast<char>(len >> 24), static_cast<char>(len >> 16),
+                                 static_cast<char>(len >> 8), static_cast<char>(len)};
+    out.append(header, FRAME_HEADER);
+    out.append(payload);
+}
+
+// Ein Stück Klartext durch den fortlaufenden deflate-Strom schicken, als 'Z'-Frame
+void WireCompressor::appendDeflated(string_view slice, string &out) {
+    size_t headerPos = out.size();
+    out.append(FRAME_HEADER, '\0');
+
+    deflate_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(slice.data()));
+    deflate_.avail_in = static_cast<uInt>(slice.size());
+    size_t bound = deflateBound(&deflate_, slice.size()) + 16;
+    do {
+        size_t old = out.size();
+        out.resize(old + bound);
+        deflate_.next_out = reinterpret_cast<Bytef *>(&out[old]);
+        deflate_.avail_out = static_cast<uInt>(bound);
+        deflate(&deflate_, Z_SYNC_FLUSH); // Frame endet an Byte-Grenze, Empfänger kann sofort entpacken
+        out.resize(old + bound - deflate_.avail_out);
+    } while (deflate_.avail_out == 0);
+
+    uint32_t len = static_cast<uint32_t>(out.size() - headerPos - FRAME_HEADER);
+    out[headerPos] = 'Z';
+    out[headerPos + 1] = static_cast<char>(len >> 24);
+    out[headerPos + 2] = static_cast<char>(len >> 16);
+    out[headerPos + 3] = static_cast<char>(len >> 8);
+    out[headerPos + 4] = static_cast<char>(len);
+}
+
+void WireCompressor::encode(string_view plain, string &out) {
+    while (!plain.empty()) {
+        string_view slice = plain.substr(0, MAX_FRAME_PLAIN);
+        plain.remove_prefix(slice.size());
+        if (slice.size() < threshold_ || !deflateReady_) {
+            appendFrame('R', slice, out);
+        } else {
+            appendDeflated(slice, out);
+        }
+    }
+}
+
+// Ein 'Z'-Frame entpacken; mehr als MAX_FRAME_PLAIN Klartext pro Frame ist ungültig
+bool WireCompressor::inflateFrame(const char *payload, size_t len, string &plain) {
+    if (!inflateReady_) {
+        return false;
+    }
+    inflate_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(payload));
+    inflate_.avail_in = static_cast<uInt>(len);
+
+    // Weiterlaufen, solange Eingabe übrig ist oder der Ausgabepuffer ganz voll wurde
+    // (dann kann zlib noch Klartext zurückhalten)
+    size_t start = plain.size();
+    do {
+        size_t produced = plain.size() - start;
+        if (produced > MAX_FRAME_PLAIN) {
+            return false; // mehr Klartext als je komprimiert wurde → manipuliertes Frame
+        }
+        size_t old = plain.size();
+        size_t room = min(INFLATE_CHUNK, MAX_FRAME_PLAIN + 1 - produced);
+        plain.resize(old + room);
+        inflate_.next_out = reinterpret_cast<Bytef *>(&plain[old]);
+        inflate_.avail_out = static_cast<uInt>(room);
+        int ret = inflate(&inflate_, Z_SYNC_FLUSH);
+        plain.resize(old + room - inflate_.avail_out);
+        if (ret == Z_BUF_ERROR && inflate_.avail_in == 0) {
+            break; // alles entpackt, nichts mehr ausstehend
+        }
+        if (ret != Z_OK) {
+            return false;
+        }
+    } while (inflate_.avail_in > 0 || inflate_.avail_out == 0);
+    return true;
+}
+
+bool WireCompressor::decode(const char *data, size_t len, string &plain, size_t maxPlain) {
+    pending_.append(data, len);
+
+    size_t pos = 0;
+    while (pending_.size() - pos >= FRAME_HEADER) {
+        const auto *h = reinterpret_cast<const unsigned char *>(pending_.data() + pos);
+        char type = static_cast<char>(h[0]);
+        size_t frameLen = (size_t{h[1]} << 24) | (size_t{h[2]} << 16) | (size_t{h[3]} << 8) | h[4];
+        if ((type != 'R' && type != 'Z') || frameLen > MAX_FRAME_WIRE) {
+            return false;
+        }
+        if (pending_.size() - pos - FRAME_HEADER < frameLen) {
+            break; // Frame noch unvollständig
+        }
+
+        const char *payload = pending_.data() + pos + FRAME_HEADER;
+        if (type == 'R') {
+            plain.append(payload, frameLen);
+        } else if (!inflateFrame(payload, frameLen, plain)) {
+            return false;
+        }
+        if (plain.size() > maxPlain) {
+            return false; // ein Frame entpackt höchstens MAX_FRAME_PLAIN, mehr wird nie belegt
+        }
+        pos += FRAME_HEADER + frameLen;
+    }
+    pending_.erase(0, pos);
+    return true;
+}
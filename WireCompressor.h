@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+/// Komprimierte Übertragung nach "COMPRESS", genutzt von Server und Client.
+/// Nach der Aushandlung besteht der Datenstrom in beide Richtungen aus Frames:
+/// 1 Byte Typ ('R' = roh, 'Z' = deflate), 4-Byte-Länge (Big Endian), Nutzdaten.
+/// Nutzdaten ab einer Mindestgröße laufen durch einen deflate-Strom, der über die
+/// ganze Verbindung erhalten bleibt (das Wörterbuch wächst mit), und werden am
+/// Frame-Ende mit Z_SYNC_FLUSH abgeschlossen. Kleine Antworten wie "OK" gehen roh raus.
+class WireCompressor {
+public:
+    static constexpr size_t DEFAULT_THRESHOLD = 512;
+
+    /// @param threshold Nutzdaten ab dieser Größe werden komprimiert.
+    explicit WireCompressor(size_t threshold = DEFAULT_THRESHOLD);
+    ~WireCompressor();
+
+    WireCompressor(const WireCompressor &) = delete;
+    WireCompressor &operator=(const WireCompressor &) = delete;
+
+    /// @return true, wenn beide zlib-Ströme initialisiert werden konnten.
+    bool ok() const { return deflateReady_ && inflateReady_; }
+
+    /// Verpackt ausgehende Daten als Frame(s) und hängt sie an out an.
+    /// @param plain Klartext.
+    /// @param out Ausgabe: Frames für den Socket.
+    void encode(std::string_view plain, std::string &out);
+
+    /// Entpackt empfangene Bytes. Vollständige Frames werden als Klartext angehängt,
+    /// ein unvollständiges Frame bleibt bis zum nächsten Aufruf gepuffert.
+    /// @param data Vom Socket gelesene Bytes.
+    /// @param len Anzahl der Bytes.
+    /// @param plain Ausgabe: entpackter Klartext.
+    /// @param maxPlain Höchstens so viele Bytes Klartext in plain (gegen Frames, die zu
+    ///                 einem Vielfachen ihrer Größe entpacken).
+    /// @return false bei ungültigem Frame, defektem deflate-Strom oder mehr als
+    ///         maxPlain Bytes Klartext.
+    bool decode(const char *data, size_t len, std::string &plain,
+                size_t maxPlain = std::numeric_limits<size_t>::max());
+
+private:
+    z_stream deflate_{};
+    z_stream inflate_{};
+    bool deflateReady_ = false;
+    bool inflateReady_ = false;
+    size_t threshold_;
+    std::string pending_; // noch unvollständiges Frame
+
+    void appendFrame(char type, std::string_view payload, std::string &out);
+    void appendDeflated(std::string_view slice, std::string &out);
+    bool inflateFrame(const char *payload, size_t len, std::string &plain);
+};
@@ -0,0 +1,69 @@
+#include "WorkerPool.h"
+
+using namespace std;
+
+WorkerPool::WorkerPool(size_t workers, size_t queueDepth)
+    : queueDepth_(queueDepth) {
+    if (workers == 0) {
+        workers = 1;
+    }
+    for (size_t i = 0; i < workers; ++i) {
+        threads_.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        lock_guard<mutex> lock(mtx_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : threads_) {
+        t.join();
+    }
+}
+
+bool WorkerPool::trySubmit(function<void()> job) {
+    {
+        lock_guard<mutex> lock(mtx_);
+        // Admission Control: volle Queue → sofort ablehnen
+        if (stopping_ || queue_.size() >= queueDepth_) {
+            return false;
+        }
+        queue_.push_back(move(job));
+    }
+    cv_.notify_one();
+    return true;
+}
+
+size_t WorkerPool::queued() const {
+    lock_guard<mutex> lock(mtx_);
+    return queue_.size();
+}
+
+size_t WorkerPool::busy() const {
+    lock_guard<mutex> lock(mtx_);
+    return busy_;
+}
+
+// Worker: Aufträge aus der Queue holen, bis der Pool beendet wird
+void WorkerPool::workerLoop() {
+    while (true) {
+        function<void()> job;
+        {
+            unique_lock<mutex> lock(mtx_);
+            cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return; // stopping_ und nichts mehr zu tun
+            }
+            job = move(queue_.front());
+            queue_.pop_front();
+            ++busy_;
+        }
+
+        job();
+
+        lock_guard<mutex> lock(mtx_);
+        --busy_;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fester Pool von Worker-Threads mit begrenzter Übergabe-Queue.
+/// Der Accept-Loop reicht Aufträge mit trySubmit() weiter; ist die Queue voll,
+/// wird der Auftrag sofort abgelehnt, statt unbegrenzt Threads oder Wartende anzuhäufen.
+class WorkerPool {
+public:
+    /// @param workers Anzahl der Worker-Threads.
+    /// @param queueDepth Maximale Anzahl wartender Aufträge.
+    WorkerPool(size_t workers, size_t queueDepth);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    /// Stellt einen Auftrag in die Queue, ohne zu blockieren.
+    /// @param job Auszuführende Arbeit.
+    /// @return false, wenn die Queue voll ist (Auftrag wurde nicht übernommen).
+    bool trySubmit(std::function<void()> job);
+
+    /// @return Anzahl der aktuell wartenden Aufträge.
+    size_t queued() const;
+
+    /// @return Anzahl der Worker, die gerade einen Auftrag bearbeiten.
+    size_t busy() const;
+
+    size_t workers() const { return threads_.size(); }
+    size_t queueDepth() const { return queueDepth_; }
+
+private:
+    size_t queueDepth_;
+    std::vector<std::thread> threads_;
+
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> queue_;
+    size_t busy_ = 0;
+    bool stopping_ = false;
+
+    void workerLoop();
+};
@@ -1,16 +1,30 @@
+#include "LineFramer.h"
+#include "WireCompressor.h"
+
 #include <arpa/inet.h>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <vector>
 
 using namespace std;
 
+// Kompression (-z): nach COMPRESS laufen alle Daten in beide Richtungen als Frames
+static unique_ptr<WireCompressor> compressor;
+
 // Schickt den gesamten String über den Socket (ggf. in mehreren send()-Aufrufen)
-static bool sendAll(int sockfd, const string &data) {
+static bool sendAll(int sockfd, const string &plain) {
+    string framed;
+    if (compressor) {
+        compressor->encode(plain, framed);
+    }
+    const string &data = compressor ? framed : plain;
     const char *buf = data.c_str();
     size_t total = 0;
     size_t len = data.size();
@@ -22,22 +36,85 @@ static bool sendAll(int sockfd, const string &data) {
     return true;
 }
 
-// Liest eine Zeile vom Socket (bis '\n'), entfernt optionales '\r'
+// Empfangspuffer der (einzigen) Serververbindung
+static LineFramer framer;
+
+// Einmal vom Socket lesen und (ggf. entpackt) an den Framer geben
+static ssize_t fillInput(int sockfd) {
+    if (!compressor) {
+        return framer.fill(sockfd);
+    }
+    char buf[16384];
+    ssize_t n = recv(sockfd, buf, sizeof(buf), 0);
+    if (n > 0) {
+        string plain;
+        if (!compressor->decode(buf, static_cast<size_t>(n), plain)) {
+            cerr << "Invalid compressed data from server\n";
+            return -1;
+        }
+        framer.append(plain.data(), plain.size());
+    }
+    return n;
+}
+
+// Liest eine Zeile vom Socket (bis '\n'), entfernt optionales '\r'.
+// Gelesen wird blockweise über den Framer, nicht Byte für Byte.
 static bool recvLine(int sockfd, string &line) {
-    line.clear();
-    char c;
+    string_view view;
     while (true) {
-        ssize_t n = recv(sockfd, &c, 1, 0);
-        if (n <= 0) {
-            return false; // Fehler oder Verbindung weg
+        LineFramer::Status st = framer.next(view);
+        if (st == LineFramer::Status::Line) {
+            break;   // Zeile komplett
         }
-        if (c == '\n') break;   // Zeile komplett
-        line.push_back(c);
+        if (st == LineFramer::Status::TooLong || fillInput(sockfd) <= 0) {
+            return false; // Fehler, Verbindung weg oder Zeile zu lang
+        }
+    }
+    line.assign(view);
+    return true;
+}
+
+// Binärmodus (-b): nach PROTO BIN tragen alle Felder ein 4-Byte-Längenpräfix (Big Endian)
+static bool binary = false;
+
+// Ein Anfragefeld im aktuellen Modus anhängen (Text: Zeile mit \n)
+static void addField(string &req, const string &field) {
+    if (binary) {
+        uint32_t len = static_cast<uint32_t>(field.size());
+        char header[4] = {static_cast<char>(len >> 24), static_cast<char>(len >> 16),
+                          static_cast<char>(len >> 8), static_cast<char>(len)};
+        req.append(header, sizeof(header));
+        req += field;
+    } else {
+        req += field + "\n";
+    }
+}
+
+// Liest einen Block fester Größe über den Framer
+static bool recvBlock(int sockfd, size_t len, string_view &block) {
+    while (!framer.take(len, block)) {
+        if (fillInput(sockfd) <= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Ein Antwortfeld empfangen (Text: eine Zeile)
+static bool recvField(int sockfd, string &field) {
+    if (!binary) {
+        return recvLine(sockfd, field);
+    }
+    string_view view;
+    if (!recvBlock(sockfd, 4, view)) {
+        return false;
     }
-    // CRLF → optionales '\r' entfernen
-    if (!line.empty() && line.back() == '\r') {
-        line.pop_back();
+    const auto *b = reinterpret_cast<const unsigned char *>(view.data());
+    size_t len = (size_t{b[0]} << 24) | (size_t{b[1]} << 16) | (size_t{b[2]} << 8) | b[3];
+    if (!recvBlock(sockfd, len, view)) {
+        return false;
     }
+    field.assign(view);
     return true;
 }
 
@@ -64,9 +141,9 @@ static bool doLOGIN(int sockfd, string &username, bool &loggedIn) {
 
     // Protokoll: LOGIN\n<user>\n<pass>\n
     string req;
-    req += "LOGIN\n";
-    req += username + "\n";
-    req += password + "\n";
+    addField(req, "LOGIN");
+    addField(req, username);
+    addField(req, password);
 
     if (!sendAll(sockfd, req)) {
         cerr << "Error sending LOGIN request\n";
@@ -74,7 +151,7 @@ static bool doLOGIN(int sockfd, string &username, bool &loggedIn) {
     }
 
     string resp;
-    if (!recvLine(sockfd, resp)) {
+    if (!recvField(sockfd, resp)) {
         cerr << "No response from server\n";
         return false;
     }
@@ -98,7 +175,7 @@ static void doSEND(int sockfd, const string &username, bool loggedIn) {
 
     string receiver, subject;
 
-    cout << "Receiver (max 8 chars, a-z,0-9): ";
+    cout << "Receiver (max 8 chars, a-z,0-9; several separated by commas): ";
     getline(cin, receiver);
     cout << "Subject (max 80 chars): ";
     getline(cin, subject);
@@ -112,13 +189,18 @@ static void doSEND(int sockfd, const string &username, bool loggedIn) {
         body += line + "\n";
     }
 
-    // Protokoll: SEND\n<receiver>\n<subject>\n<body>.\n
+    // Protokoll: SEND\n<receiver>[,<receiver>...]\n<subject>\n<body>.\n
+    // (binär: vier Felder, der Body als ein Feld ohne Terminator)
     string req;
-    req += "SEND\n";
-    req += receiver + "\n";
-    req += subject + "\n";
-    req += body;
-    req += ".\n";
+    addField(req, "SEND");
+    addField(req, receiver);
+    addField(req, subject);
+    if (binary) {
+        addField(req, body);
+    } else {
+        req += body;
+        req += ".\n";
+    }
 
     if (!sendAll(sockfd, req)) {
         cerr << "Error sending SEND request\n";
@@ -126,7 +208,7 @@ static void doSEND(int sockfd, const string &username, bool loggedIn) {
     }
 
     string resp;
-    if (!recvLine(sockfd, resp)) {
+    if (!recvField(sockfd, resp)) {
         cerr << "No response from server\n";
         return;
     }
@@ -142,7 +224,7 @@ static void doLIST(int sockfd, const string &username, bool loggedIn) {
     }
 
     string req;
-    req += "LIST\n";
+    addField(req, "LIST");
 
     if (!sendAll(sockfd, req)) {
         cerr << "Error sending LIST request\n";
@@ -150,7 +232,7 @@ static void doLIST(int sockfd, const string &username, bool loggedIn) {
     }
 
     string line;
-    if (!recvLine(sockfd, line)) {
+    if (!recvField(sockfd, line)) {
         cerr << "No response from server\n";
         return;
     }
@@ -160,7 +242,7 @@ static void doLIST(int sockfd, const string &username, bool loggedIn) {
 
     // Jede weitere Zeile ist eine Betreffzeile
     for (int i = 1; i <= count; ++i) {
-        if (!recvLine(sockfd, line)) {
+        if (!recvField(sockfd, line)) {
             cerr << "Unexpected end of response\n";
             return;
         }
@@ -168,49 +250,71 @@ static void doLIST(int sockfd, const string &username, bool loggedIn) {
     }
 }
 
-// READ-Kommando: einzelne Nachricht mit Body anzeigen
-static void doREAD(int sockfd, const string &username, bool loggedIn) {
-    if (!loggedIn) {
-        cout << "Bitte zuerst LOGIN ausführen.\n";
-        return;
+// Pipelining-Modus (-p): READ/DEL nehmen mehrere Nummern, alle Requests gehen in einem Paket raus
+static bool pipelined = false;
+
+// Nachrichtennummern abfragen; im Pipelining-Modus mehrere (durch Leerzeichen/Komma getrennt).
+// Bereiche wie "9-20" (und ohne -p auch Listen) setzen batch: dann geht die Liste als
+// ein MREAD/MDEL raus
+static vector<string> askNumbers(bool &batch) {
+    cout << "Message number(s), e.g. 3 or 3,5,9-20: ";
+    string input;
+    getline(cin, input);
+
+    batch = input.find('-') != string::npos ||
+            (!pipelined && input.find_first_of(", ") != string::npos);
+    if (!pipelined && !batch) {
+        return {input};
     }
 
-    string num;
-    cout << "Message number: ";
-    getline(cin, num);
-
-    // Protokoll: READ\n<num>\n
-    string req;
-    req += "READ\n";
-    req += num + "\n";
-
-    if (!sendAll(sockfd, req)) {
-        cerr << "Error sending READ request\n";
-        return;
+    vector<string> nums;
+    string cur;
+    for (char c : input) {
+        if (c == ' ' || c == ',') {
+            if (!cur.empty()) nums.push_back(cur);
+            cur.clear();
+        } else {
+            cur.push_back(c);
+        }
     }
+    if (!cur.empty()) nums.push_back(cur);
+    return nums;
+}
+
+static bool printMessage(int sockfd);
 
+// Antwort auf ein READ empfangen und ausgeben
+// @return false, wenn die Verbindung unterbrochen wurde
+static bool printReadResponse(int sockfd) {
     string line;
-    if (!recvLine(sockfd, line)) {
+    if (!recvField(sockfd, line)) {
         cerr << "No response from server\n";
-        return;
+        return false;
     }
 
     if (line == "ERR") {
         cout << "Server: ERR\n";
-        return;
+        return true;
     }
     if (line != "OK") {
         cout << "Unexpected response: " << line << "\n";
-        return;
+        return true;
     }
+    return printMessage(sockfd);
+}
+
+// Kopf und Body einer Nachricht empfangen und ausgeben (READ und MREAD)
+// @return false, wenn die Verbindung unterbrochen wurde
+static bool printMessage(int sockfd) {
+    string line;
 
     // Header: Sender, Receiver, Subject
     string sender, receiver, subject;
-    if (!recvLine(sockfd, sender) ||
-        !recvLine(sockfd, receiver) ||
-        !recvLine(sockfd, subject)) {
+    if (!recvField(sockfd, sender) ||
+        !recvField(sockfd, receiver) ||
+        !recvField(sockfd, subject)) {
         cerr << "Incomplete message header\n";
-        return;
+        return false;
     }
 
     cout << "Sender:   " << sender << "\n";
@@ -218,62 +322,183 @@ static void doREAD(int sockfd, const string &username, bool loggedIn) {
     cout << "Subject:  " << subject << "\n";
     cout << "Body:\n";
 
-    // Body bis Zeile mit "." lesen
+    // Binär: Body ist ein Feld mit bekannter Länge
+    if (binary) {
+        string body;
+        if (!recvField(sockfd, body)) {
+            cerr << "Connection lost while reading body\n";
+            return false;
+        }
+        cout << body;
+        if (!body.empty() && body.back() != '\n') {
+            cout << "\n";
+        }
+        return true;
+    }
+
+    // Body bis Zeile mit "." lesen; der Server verdoppelt den Punkt am Anfang einer
+    // Body-Zeile, der zusätzliche wird hier wieder entfernt
     while (true) {
         if (!recvLine(sockfd, line)) {
             cerr << "Connection lost while reading body\n";
-            return;
+            return false;
         }
         if (line == ".") break;
-        cout << line << "\n";
+        cout << (line[0] == '.' ? line.substr(1) : line) << "\n";
+    }
+    return true;
+}
+
+// Nummern und Bereiche zu einer Liste für MREAD/MDEL zusammenfügen, z.B. "3,5,9-20"
+static string joinNumbers(const vector<string> &nums) {
+    string spec;
+    for (const string &num : nums) {
+        if (!spec.empty()) spec += ",";
+        spec += num;
     }
+    return spec;
 }
 
-// DEL-Kommando: Nachricht löschen
-static void doDEL(int sockfd, const string &username, bool loggedIn) {
-    if (!loggedIn) {
-        cout << "Bitte zuerst LOGIN ausführen.\n";
+// MREAD: alle Nachrichten der Liste in einer Anfrage und einer Antwort
+static void doMREAD(int sockfd, const vector<string> &nums) {
+    string req;
+    addField(req, "MREAD");
+    addField(req, joinNumbers(nums));
+    if (!sendAll(sockfd, req)) {
+        cerr << "Error sending MREAD request\n";
         return;
     }
 
-    string num;
-    cout << "Message number: ";
-    getline(cin, num);
+    // Antwort: Anzahl, dann pro Nachricht Nummer + Nachricht
+    string line;
+    if (!recvField(sockfd, line)) {
+        cerr << "No response from server\n";
+        return;
+    }
+    if (line == "ERR") {
+        cout << "Server: ERR\n";
+        return;
+    }
+    int count = atoi(line.c_str());
+    cout << "Messages found: " << count << "\n";
+    for (int i = 0; i < count; ++i) {
+        if (!recvField(sockfd, line)) {
+            cerr << "Unexpected end of response\n";
+            return;
+        }
+        cout << "--- Message " << line << " ---\n";
+        if (!printMessage(sockfd)) {
+            return;
+        }
+    }
+}
 
-    // Protokoll: DEL\n<num>\n
+// MDEL: alle Nachrichten der Liste mit einer Anfrage löschen
+static void doMDEL(int sockfd, const vector<string> &nums) {
     string req;
-    req += "DEL\n";
-    req += num + "\n";
-
+    addField(req, "MDEL");
+    addField(req, joinNumbers(nums));
     if (!sendAll(sockfd, req)) {
-        cerr << "Error sending DEL request\n";
+        cerr << "Error sending MDEL request\n";
         return;
     }
 
     string line;
-    if (!recvLine(sockfd, line)) {
+    if (!recvField(sockfd, line)) {
         cerr << "No response from server\n";
         return;
     }
+    if (line == "ERR") {
+        cout << "Server: ERR\n";
+    } else {
+        cout << "Deleted: " << line << "\n";
+    }
+}
+
+// READ-Kommando: Nachricht(en) mit Body anzeigen
+static void doREAD(int sockfd, bool loggedIn) {
+    if (!loggedIn) {
+        cout << "Bitte zuerst LOGIN ausführen.\n";
+        return;
+    }
 
-    cout << "Server: " << line << "\n";
+    bool batch = false;
+    vector<string> nums = askNumbers(batch);
+    if (batch) {
+        doMREAD(sockfd, nums);
+        return;
+    }
+
+    // Protokoll: READ\n<num>\n – bei mehreren Nummern alle Requests hintereinander
+    string req;
+    for (const string &num : nums) {
+        addField(req, "READ");
+        addField(req, num);
+    }
+
+    if (!sendAll(sockfd, req)) {
+        cerr << "Error sending READ request\n";
+        return;
+    }
+
+    // Antworten kommen in derselben Reihenfolge zurück
+    for (const string &num : nums) {
+        if (nums.size() > 1) {
+            cout << "--- Message " << num << " ---\n";
+        }
+        if (!printReadResponse(sockfd)) {
+            return;
+        }
+    }
 }
 
-int main(int argc, char *argv[]) {
-    // Erwartet: IP und Port als Parameter
-    if (argc != 3) {
-        cerr << "Usage: ./twmailer-client <ip> <port>\n";
-        return 1;
+// DEL-Kommando: Nachricht(en) löschen
+static void doDEL(int sockfd, bool loggedIn) {
+    if (!loggedIn) {
+        cout << "Bitte zuerst LOGIN ausführen.\n";
+        return;
     }
 
-    const char *ip = argv[1];
-    int port = atoi(argv[2]);
+    bool batch = false;
+    vector<string> nums = askNumbers(batch);
+    if (batch) {
+        doMDEL(sockfd, nums);
+        return;
+    }
 
+    // Protokoll: DEL\n<num>\n – bei mehreren Nummern alle Requests hintereinander
+    string req;
+    for (const string &num : nums) {
+        addField(req, "DEL");
+        addField(req, num);
+    }
+
+    if (!sendAll(sockfd, req)) {
+        cerr << "Error sending DEL request\n";
+        return;
+    }
+
+    for (const string &num : nums) {
+        string line;
+        if (!recvField(sockfd, line)) {
+            cerr << "No response from server\n";
+            return;
+        }
+        if (nums.size() > 1) {
+            cout << num << ": ";
+        }
+        cout << "Server: " << line << "\n";
+    }
+}
+
+// TCP-Verbindung zum Server aufbauen
+// @return Socket oder -1 bei Fehler (Meldung bereits ausgegeben)
+static int connectTcp(const char *ip, int port) {
     // TCP-Socket anlegen
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
         perror("socket");
-        return 1;
+        return -1;
     }
 
     // Zieladresse vorbereiten
@@ -283,17 +508,103 @@ int main(int argc, char *argv[]) {
     if (inet_pton(AF_INET, ip, &addr.sin_addr) <= 0) {
         cerr << "Invalid IP address\n";
         close(sockfd);
-        return 1;
+        return -1;
     }
 
     // Verbindung zum Server aufbauen
     if (connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         perror("connect");
         close(sockfd);
-        return 1;
+        return -1;
     }
 
     cout << "Connected to " << ip << ":" << port << "\n";
+    return sockfd;
+}
+
+// Lokale Verbindung über den AF_UNIX-Listener des Servers (-u), ohne TCP-Stack
+// @return Socket oder -1 bei Fehler (Meldung bereits ausgegeben)
+static int connectLocal(const char *path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        cerr << "Socket path too long\n";
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        close(sockfd);
+        return -1;
+    }
+
+    cout << "Connected to unix:" << path << "\n";
+    return sockfd;
+}
+
+int main(int argc, char *argv[]) {
+    // Optional -p (Pipelining), -b (Binärprotokoll) und -z (Kompression), danach IP und Port
+    bool compress = false;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; ++argi) {
+        if (strcmp(argv[argi], "-p") == 0) {
+            pipelined = true;
+        } else if (strcmp(argv[argi], "-b") == 0) {
+            binary = true;
+        } else if (strcmp(argv[argi], "-z") == 0) {
+            compress = true;
+        } else {
+            break;
+        }
+    }
+    // Ziel: "<ip> <port>" oder "unix:<pfad>" für einen Server auf demselben Host
+    bool local = argc - argi == 1 && strncmp(argv[argi], "unix:", 5) == 0;
+    if (argc - argi != 2 && !local) {
+        cerr << "Usage: ./twmailer-client [-p] [-b] [-z] <ip> <port>\n"
+                "       ./twmailer-client [-p] [-b] [-z] unix:<socket-path>\n";
+        return 1;
+    }
+
+    int sockfd = local ? connectLocal(argv[argi] + 5) : connectTcp(argv[argi], atoi(argv[argi + 1]));
+    if (sockfd < 0) {
+        return 1;
+    }
+
+    // Binärprotokoll aushandeln; lehnt der Server ab, bleibt es beim Textprotokoll
+    if (binary) {
+        string resp;
+        if (!sendAll(sockfd, "PROTO BIN\n") || !recvLine(sockfd, resp)) {
+            cerr << "No response from server\n";
+            close(sockfd);
+            return 1;
+        }
+        if (resp != "OK") {
+            cout << "Server unterstützt kein Binärprotokoll, verwende Text.\n";
+            binary = false;
+        }
+    }
+
+    // Kompression aushandeln; die Bestätigung kommt noch unkomprimiert
+    if (compress) {
+        string req, resp;
+        addField(req, "COMPRESS");
+        if (!sendAll(sockfd, req) || !recvField(sockfd, resp)) {
+            cerr << "No response from server\n";
+            close(sockfd);
+            return 1;
+        }
+        if (resp == "OK") {
+            compressor = make_unique<WireCompressor>();
+        } else {
+            cout << "Server unterstützt keine Kompression, übertrage unkomprimiert.\n";
+        }
+    }
 
     bool loggedIn = false;
     string username;
@@ -312,12 +623,13 @@ int main(int argc, char *argv[]) {
         } else if (choice == "3") {
             doLIST(sockfd, username, loggedIn);
         } else if (choice == "4") {
-            doREAD(sockfd, username, loggedIn);
+            doREAD(sockfd, loggedIn);
         } else if (choice == "5") {
-            doDEL(sockfd, username, loggedIn);
+            doDEL(sockfd, loggedIn);
         } else if (choice == "6") {
             // QUIT an Server schicken und beenden
-            string req = "QUIT\n";
+            string req;
+            addField(req, "QUIT");
             sendAll(sockfd, req);
             break;
         } else {
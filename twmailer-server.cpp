@@ -1,21 +1,219 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <climits>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <unistd.h>
 
 #include "Server.h"
 
 using namespace std;
 
+// Speicherbudget in MiB lesen; Werte, die in Bytes nicht in size_t passen, sind ungültig
+static bool parseMiB(const char *text, size_t &bytes) {
+    char *end = nullptr;
+    errno = 0;
+    unsigned long long mib = strtoull(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || text[0] == '-' || mib > (SIZE_MAX >> 20)) {
+        return false;
+    }
+    bytes = static_cast<size_t>(mib) << 20;
+    return true;
+}
+
+// Absoluter Pfad des eigenen Binaries für den Neustart: execve() sucht nicht im PATH,
+// und ein relativer Pfad gilt nur im aktuellen Verzeichnis. Wie die Shell wird ein
+// Name ohne '/' im PATH gesucht. /proc/self/exe ist nur die Rückfallebene, weil es nach
+// einem Update weiter auf das alte Binary zeigt.
+static string resolveExecutable(const char *argv0) {
+    char resolved[PATH_MAX];
+    if (strchr(argv0, '/')) {
+        if (realpath(argv0, resolved)) {
+            return resolved;
+        }
+    } else if (const char *path = getenv("PATH")) {
+        istringstream dirs(path);
+        string dir;
+        while (getline(dirs, dir, ':')) {
+            string candidate = (dir.empty() ? string(".") : dir) + "/" + argv0;
+            if (access(candidate.c_str(), X_OK) == 0 && realpath(candidate.c_str(), resolved)) {
+                return resolved;
+            }
+        }
+    }
+    ssize_t n = readlink("/proc/self/exe", resolved, sizeof(resolved) - 1);
+    if (n > 0) {
+        return string(resolved, static_cast<size_t>(n));
+    }
+    return argv0;
+}
+
+static void usage() {
+    cerr << "Usage: ./twmailer-server [-m threads|pool|reactor|uring] [-l <loops>] [-w <workers>]\n"
+            "                         [-q <queue-depth>] [-B <busy-reply>] [-s <seconds>]\n"
+            "                         [-a <acceptors>] [-P] [-k <backlog>] [-D <seconds>]\n"
+            "                         [-I <seconds>] [-C <seconds>] [-b <bytes>] [-L <bytes>]\n"
+            "                         [-u <socket-path>] [-c <MiB>] [-M <MiB>] [-F <micros>]\n"
+            "                         [-S files|segments] [-Z] [-X]\n"
+            "                         <port> <mail-spool-directory>\n"
+            "  -m  Betriebsart: Thread pro Verbindung (Default), Worker-Pool, epoll-Reaktor\n"
+            "      oder io_uring (fällt ohne Kernel-Unterstützung auf threads zurück)\n"
+            "  -l  Anzahl der Loop-Threads im Reaktor-/io_uring-Modus (Default 2)\n"
+            "  -w  Worker-Threads im Pool-Modus (Default 16)\n"
+            "  -q  Maximal wartende Verbindungen im Pool-Modus (Default 64)\n"
+            "  -B  Antwortzeile bei voller Queue, z.B. BUSY oder ERR (Default BUSY)\n"
+            "  -s  Statistik alle <seconds> Sekunden ausgeben (Default aus)\n"
+            "  -a  Acceptor-Threads mit je eigenem SO_REUSEPORT-Listener (Default 1)\n"
+            "  -P  Acceptor-Threads reihum an CPUs binden\n"
+            "  -k  listen()-Backlog pro Listener (Default 20)\n"
+            "  -I  Leerlauf-Timeout zwischen Kommandos in Sekunden (Default 0 = aus)\n"
+            "  -C  Frist pro Kommando inkl. Antwort in Sekunden (Default 60, 0 = aus)\n"
+            "  -b  Maximale Body-Größe bei SEND in Bytes (Default 16 MiB, 0 = unbegrenzt)\n"
+            "  -L  Maximale Zeilenlänge in Bytes (Default 65536)\n"
+            "  -D  Drain-Frist nach einer Übergabe per SIGUSR2 in Sekunden (Default 30)\n"
+            "  -u  Zusätzlicher AF_UNIX-Listener für lokale Clients (Blacklist nach Benutzer-ID)\n"
+            "  -c  Speicherbudget des Postfach-Metadaten-Caches in MiB (Default 64, 0 = aus)\n"
+            "  -M  Speicherbudget des Caches häufig gelesener Nachrichten in MiB\n"
+            "      (Default 64, 0 = aus)\n"
+            "  -F  durable-Modus: SEND bestätigt erst nach fsync, gleichzeitige SENDs teilen\n"
+            "      sich einen Gruppen-Commit mit diesem Sammelfenster in µs (Default aus)\n"
+            "  -W  Disk-Worker für SEND/DEL/MDEL/LIST im Reaktor-/io_uring-Modus\n"
+            "      (Default 4, 0 = direkt im Loop-Thread)\n"
+            "  -S  Ablage: eine Datei pro Nachricht (Default) oder Segment-Log pro Postfach\n"
+            "  -Z  Neue Bodies komprimiert ablegen (ältere bleiben lesbar, Default aus)\n"
+            "  -X  Spool in die mit -S gewählte Ablage konvertieren und beenden\n"
+            "      (nur bei gestopptem Server)\n"
+            "SIGUSR2 startet das Binary neu und übergibt die Listener ohne Unterbrechung.\n";
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: ./twmailer-server <port> <mail-spool-directory>\n";
+    ServerOptions options;
+    bool convert = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:l:w:q:B:s:a:Pk:D:I:C:b:L:u:c:M:F:W:S:ZX")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "threads") == 0) {
+                options.mode = ServerMode::Threads;
+            } else if (strcmp(optarg, "pool") == 0) {
+                options.mode = ServerMode::Pool;
+            } else if (strcmp(optarg, "reactor") == 0) {
+                options.mode = ServerMode::Reactor;
+            } else if (strcmp(optarg, "uring") == 0) {
+                options.mode = ServerMode::Uring;
+            } else {
+                usage();
+                return 1;
+            }
+            break;
+        case 'l':
+            options.loopThreads = atoi(optarg);
+            break;
+        case 'w':
+            options.poolSize = atoi(optarg);
+            break;
+        case 'q':
+            options.queueDepth = atoi(optarg);
+            break;
+        case 'B':
+            options.busyReply = optarg;
+            break;
+        case 's':
+            options.statsInterval = atoi(optarg);
+            break;
+        case 'a':
+            options.acceptors = atoi(optarg);
+            break;
+        case 'P':
+            options.pinAcceptors = true;
+            break;
+        case 'k':
+            options.backlog = atoi(optarg);
+            break;
+        case 'I':
+            options.limits.idleTimeout = atoi(optarg);
+            break;
+        case 'C':
+            options.limits.commandTimeout = atoi(optarg);
+            break;
+        case 'b':
+            options.limits.maxBody = strtoull(optarg, nullptr, 10);
+            break;
+        case 'L':
+            options.limits.maxLine = strtoull(optarg, nullptr, 10);
+            break;
+        case 'D':
+            options.drainTimeout = atoi(optarg);
+            break;
+        case 'u':
+            options.unixPath = optarg;
+            break;
+        case 'c':
+            if (!parseMiB(optarg, options.cacheBytes)) {
+                usage();
+                return 1;
+            }
+            break;
+        case 'M':
+            if (!parseMiB(optarg, options.bodyCacheBytes)) {
+                usage();
+                return 1;
+            }
+            break;
+        case 'F':
+            options.syncWindowUs = max(0, atoi(optarg));
+            break;
+        case 'W':
+            options.diskWorkers = max(0, atoi(optarg));
+            break;
+        case 'S':
+            if (strcmp(optarg, "files") == 0) {
+                options.layout = StoreLayout::Files;
+            } else if (strcmp(optarg, "segments") == 0) {
+                options.layout = StoreLayout::Segments;
+            } else {
+                usage();
+                return 1;
+            }
+            break;
+        case 'Z':
+            options.compressBodies = true;
+            break;
+        case 'X':
+            convert = true;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage();
         return 1;
     }
 
-    int port = atoi(argv[1]);
-    string spoolDir = argv[2];
+    int port = atoi(argv[optind]);
+    string spoolDir = argv[optind + 1];
+
+    if (convert) {
+        if (!MailStore::convertSpool(spoolDir, options.layout)) {
+            cerr << "Spool konnte nicht vollständig konvertiert werden." << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Für den Neustart per SIGUSR2 mit identischer Kommandozeile, aber absolutem Programmpfad
+    options.restartArgs.assign(argv, argv + argc);
+    options.restartArgs[0] = resolveExecutable(argv[0]);
 
-    Server server(port, spoolDir);
+    Server server(port, spoolDir, options);
     if (!server.run()) {
         cerr << "Server konnte nicht gestartet werden." << endl;
         return 1;